@@ -0,0 +1,839 @@
+/**
+ * Benchmark of the decoding pipeline on synthetic data, reporting one JSON object on standard output so that
+ * runs can be compared by scripts, e.g. to catch performance regressions.
+ *
+ * A sequence of -L symbols is sampled from the model (a built-in model, a model file, or with -n a random
+ * categorical model of that many states and -a symbols) and written as a text sequence file. Then each phase is
+ * timed on its own, the best of -r repeats:
+ *
+ *   generate    sampling the sequence from the model
+ *   parse       reading the text sequence file (hmm_read_sequence)
+ *   forward     the Viterbi score recurrence
+ *   traceback   recovering the path
+ *   output      printing the path in the -F format, labels (state numbers for models without labels) unless
+ *               set, to /dev/null unless -o names a file
+ *
+ * Every phase is reported with its time and throughput in symbols per second, followed by the peak resident set
+ * size of the process and the share of positions where the decoded path matches the sampled states.
+ *
+ * With -B or -T the sequence is also decoded exactly, and a "beam" object reports the time of that decode, the
+ * share of positions where the pruned path agrees with the exact one and how much lower its score is, so that
+ * the beam can be narrowed until pruning starts to change the result.
+ *
+ * With -V the sequence is also decoded by every configuration that must give the same result, and an
+ * "equivalence" object reports for each whether its path and score are bit-identical to those of a plain full
+ * decode with the scalar kernel: every other kernel the CPU supports, packed backpointers, checkpointing,
+ * hmm_decoder, the dense table for a model with predecessor lists, and hmm_viterbi_batch on the sequence cut into
+ * records of assorted lengths, with and without lanes, on one thread and on -j threads, and on a CUDA device when
+ * there is one. HMM_VITERBI_PARALLEL must agree with itself across thread counts; float and fixed-point scores
+ * are only reported, as their path may legitimately differ. Any required check that fails makes the exit status
+ * EX_SOFTWARE. -u makes the random model tie-heavy, so that the tie rule (see hmm_argmax) decides much of the
+ * path.
+ *
+ * With -E an hmm_incremental decoder follows -E edits of the sampled sequence, each changing BENCH_EDIT_SPAN
+ * symbols at a random position, and an "incremental" object reports the time of building it, the mean and the
+ * longest update, against a full decode of the whole sequence, and whether the final path and score are
+ * bit-identical to those of a new incremental decoder on the edited sequence (EX_SOFTWARE if not).
+ *
+ * Usage: ./hmm_bench [-m model | -n states [-a symbols] [-e successors] [-u]] [-L length] [-r repeats]
+ *                    [-s seed] [-c interval] [-p] [-P chunk] [-B width] [-T threshold] [-j threads] [-S score]
+ *                    [-g sequence_file] [-o output_file] [-F format] [-V] [-E edits]
+ *   -m model          model to sample from and decode with, durbin (default), poisson or a model file
+ *   -n states         random categorical model with this many states instead, sticky like the examples
+ *   -a symbols        alphabet of the random model, default 6
+ *   -e successors     transitions out of each state of the random model, itself included, instead of all n;
+ *                     a handful gives the sparse, banded matrices of profile models
+ *   -u                random model with equal transitions out of each state and emissions shared by states
+ *                     n apart modulo the alphabet, so that candidates often tie exactly
+ *   -L length         symbols to sample, default 1000000
+ *   -r repeats        runs of every phase, default 3
+ *   -s seed           seed of the sampler and the random model, default 1
+ *   -c, -p, -P, -B, -T, -j, -S  decoder options as for hmm_decode
+ *   -g sequence_file  keep the sampled sequence in this file instead of a temporary one
+ *   -o output_file    where the output phase writes the path, default /dev/null
+ *   -F format         format of the output phase as for hmm_decode -o: labels (default), binary or segments
+ *   -V                check that every exact decoding configuration gives the same path
+ *   -E edits          time incremental re-decoding after this many local edits
+ *
+ * Build by compiling hmm_bench.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o hmm_bench hmm_bench.c ../hmm/[a-z]*.c -lm -pthread
+ *
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../hmm/hmm.h"
+
+#define USAGE "Usage: ./hmm_bench [-m model | -n states [-a symbols] [-e successors] [-u]] [-L length] " \
+              "[-r repeats] [-s seed] [-c interval] [-p] [-P chunk] [-B width] [-T threshold] [-j threads] " \
+              "[-S score] [-g sequence_file] [-o output_file] [-F format] [-V] [-E edits]"
+
+// labels of random models, as for model files without a labels line
+#define BENCH_LABELS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+// probability of staying in the same state in a random model
+#define BENCH_STAY 0.9
+// -V: records of the batch checks take lengths from BENCH_RECORD_MIN up to BENCH_RECORD_MIN + BENCH_RECORD_SPREAD
+#define BENCH_RECORD_MIN 100
+#define BENCH_RECORD_SPREAD 4000
+// -E: symbols changed by every edit
+#define BENCH_EDIT_SPAN 8
+
+enum
+{
+    PHASE_GENERATE,
+    PHASE_PARSE,
+    PHASE_FORWARD,
+    PHASE_TRACEBACK,
+    PHASE_OUTPUT,
+    N_PHASES
+};
+
+static const char *phase_names[N_PHASES] = { "generate", "parse", "forward", "traceback", "output" };
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void keep_best(double *best, double seconds)
+{
+    if (*best < 0 || seconds < *best)
+    {
+        *best = seconds;
+    }
+}
+
+// random weights in (0, 1] scaled to sum to total, or all equal for a tie-heavy model
+static int equal_weights;
+
+static void random_row(double *row, int count, double total)
+{
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        row[i] = equal_weights ? 1 : 1 - drand48();
+        sum += row[i];
+    }
+    for (int i = 0; i < count; i++)
+    {
+        row[i] *= total / sum;
+    }
+}
+
+// a categorical model that stays in each state with probability BENCH_STAY and emits from a random distribution.
+// With successors below n, state i only moves on to states i + 1 .. i + successors - 1 (mod n), a banded matrix
+static hmm_model *random_model(int n, int m, int successors)
+{
+    hmm_model *model = hmm_model_new(n, m, HMM_EMIT_CATEGORICAL);
+    double *p = malloc((size_t) n * (n > m ? n : m) * sizeof(double));
+    if (!model || !p)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+
+    random_row(p, n, 1);
+    hmm_model_set_init(model, p);
+    for (int i = 0; i < n; i++)
+    {
+        if (n == 1)
+        {
+            p[0] = 1;
+            break;
+        }
+        double *row = p + (size_t) i * n;
+        if (successors > 0 && successors < n)
+        {
+            double weights[successors];
+            random_row(weights, successors - 1, 1 - BENCH_STAY);
+            memset(row, 0, n * sizeof(double));
+            for (int d = 1; d < successors; d++)
+            {
+                row[(i + d) % n] = weights[d - 1];
+            }
+            // a single successor is the state itself
+            row[i] = successors > 1 ? BENCH_STAY : 1;
+            continue;
+        }
+        random_row(row, n, 1 - BENCH_STAY);
+        row[i] += BENCH_STAY;
+    }
+    hmm_model_set_trans(model, p);
+
+    // emission columns sum to 1 over the symbols of each state
+    double *column = malloc(m * sizeof(double));
+    if (!column)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    for (int j = 0; j < n; j++)
+    {
+        random_row(column, m, 1);
+        // tie-heavy: state j prefers symbol j mod m, like every state m apart from it
+        if (equal_weights && m > 1)
+        {
+            for (int k = 0; k < m; k++)
+            {
+                column[k] = k == j % m ? 0.5 : 0.5 / (m - 1);
+            }
+        }
+        for (int k = 0; k < m; k++)
+        {
+            p[(size_t) k * n + j] = column[k];
+        }
+    }
+    hmm_model_set_emit(model, p);
+    free(column);
+    free(p);
+    return model;
+}
+
+static void write_sequence(FILE *f, const char *name, const int *seq, size_t length, int base)
+{
+    for (size_t t = 0; t < length; t++)
+    {
+        fprintf(f, "%d\n", seq[t] + base);
+    }
+    if (fflush(f) != 0 || ferror(f))
+    {
+        err(EX_IOERR, "%s", name);
+    }
+}
+
+// the path as hmm_decode -o prints it; labels formats print state numbers for models without labels
+static void print_path(FILE *f, const char *name, const hmm_state *path, size_t length, const char *labels,
+                       int n_states, hmm_path_format format)
+{
+    hmm_path_writer *w = hmm_path_writer_new(f, format, labels, n_states, 0);
+    if (!w || hmm_path_write(w, path, length) != 0 || hmm_path_end(w) != 0 || fflush(f) != 0)
+    {
+        err(EX_IOERR, "%s", name);
+    }
+    hmm_path_writer_free(w);
+}
+
+
+// -V: decodes of the sampled sequence compared with a reference decode
+typedef struct
+{
+    const hmm_model *model;
+    const hmm_obs *obs;
+    hmm_state *path;
+    int failed;             // required checks that were not bit-identical
+    int printed;
+} equivalence;
+
+// reports one decode against the reference path; same_scores tells whether its scores matched bit for bit
+static void report_check(equivalence *eq, const char *name, int required, const hmm_state *expect,
+                         const hmm_state *path, size_t length, int same_scores)
+{
+    size_t agree = 0;
+    for (size_t t = 0; t < length; t++)
+    {
+        agree += path[t] == expect[t];
+    }
+    int identical = agree == length && same_scores;
+    eq->failed += required && !identical;
+    printf("%s      { \"check\": \"%s\", \"required\": %s, \"identical\": %s, \"path_agreement\": %.6f }",
+           eq->printed++ ? ",\n" : "", name, required ? "true" : "false", identical ? "true" : "false",
+           (double) agree / length);
+}
+
+static void decode_check(equivalence *eq, const char *name, int required, const hmm_state *expect,
+                         double expect_score, const hmm_viterbi_opts *opts)
+{
+    double score;
+    if (hmm_viterbi_obs(eq->model, eq->obs, eq->path, &score, opts) != 0)
+    {
+        err(EX_DATAERR, "decoding for %s", name);
+    }
+    report_check(eq, name, required, expect, eq->path, eq->obs->length,
+                 memcmp(&score, &expect_score, sizeof(double)) == 0);
+}
+
+// the sequence cut into records and decoded by hmm_viterbi_batch; expect and expect_scores hold every record
+// decoded alone
+static void batch_check(equivalence *eq, const char *name, hmm_batch_item *items, size_t count,
+                        const hmm_state *expect, const double *expect_scores, int threads,
+                        const hmm_viterbi_opts *opts)
+{
+    if (hmm_viterbi_batch(eq->model, items, count, threads, opts) != 0)
+    {
+        err(EX_DATAERR, "decoding for %s", name);
+    }
+    int same_scores = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        same_scores &= memcmp(&items[i].log_prob, &expect_scores[i], sizeof(double)) == 0;
+    }
+    report_check(eq, name, 1, expect, eq->path, eq->obs->length, same_scores);
+}
+
+static void print_equivalence(hmm_model *model, const hmm_obs *obs, int threads, equivalence *eq)
+{
+    size_t length = obs->length;
+    hmm_state *expect = malloc(length * sizeof(hmm_state));
+    hmm_state *other = malloc(length * sizeof(hmm_state));
+    eq->model = model;
+    eq->obs = obs;
+    eq->path = malloc(length * sizeof(hmm_state));
+    if (!expect || !other || !eq->path)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+
+    hmm_viterbi_opts opts;
+    hmm_viterbi_opts_init(&opts);
+    const char *kernel = hmm_kernel_name();
+    hmm_kernel_select("scalar");
+    double expect_score;
+    if (hmm_viterbi_obs(model, obs, expect, &expect_score, &opts) != 0)
+    {
+        err(EX_DATAERR, "reference decoding");
+    }
+
+    printf("  \"equivalence\": {\n    \"reference\": \"full, scalar kernel\",\n    \"checks\": [\n");
+    opts.trace = HMM_TRACE_PACKED;
+    decode_check(eq, "packed backpointers", 1, expect, expect_score, &opts);
+    opts.trace = HMM_TRACE_BYTES;
+    static const char *kernels[] = { "avx2", "avx512", "neon" };
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        if (hmm_kernel_select(kernels[k]) == 0)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "%s kernel", kernels[k]);
+            decode_check(eq, name, 1, expect, expect_score, &opts);
+        }
+    }
+    hmm_kernel_select(kernel);
+
+    opts.mode = HMM_VITERBI_CHECKPOINT;
+    decode_check(eq, "checkpoint", 1, expect, expect_score, &opts);
+    opts.mode = HMM_VITERBI_FULL;
+
+    double score;
+    hmm_decoder *dec = hmm_decoder_new(model, length, NULL);
+    if (!dec || hmm_decoder_viterbi(dec, obs, eq->path, &score) != 0)
+    {
+        err(EX_DATAERR, "hmm_decoder");
+    }
+    report_check(eq, "hmm_decoder", 1, expect, eq->path, length, memcmp(&score, &expect_score, sizeof(double)) == 0);
+    hmm_decoder_free(dec);
+
+    if (model->pred_start)
+    {
+        // the decoders take the dense table while the lists are detached
+        int32_t *pred_start = model->pred_start;
+        model->pred_start = NULL;
+        decode_check(eq, "dense transitions", 1, expect, expect_score, &opts);
+        model->pred_start = pred_start;
+    }
+
+    // records of assorted lengths, each decoded alone for reference
+    size_t count = 0;
+    hmm_batch_item *items = malloc((length / BENCH_RECORD_MIN + 1) * sizeof(hmm_batch_item));
+    double *record_scores = malloc((length / BENCH_RECORD_MIN + 1) * sizeof(double));
+    if (!items || !record_scores)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    size_t width = obs->type == HMM_OBS_U8 ? 1 : obs->type == HMM_OBS_U16 ? 2 : sizeof(int);
+    for (size_t from = 0; from < length; count++)
+    {
+        size_t n = BENCH_RECORD_MIN + (count * 7919) % BENCH_RECORD_SPREAD;
+        n = n < length - from ? n : length - from;
+        hmm_obs record = { obs->type, n, (const char *) obs->data + from * width };
+        if (hmm_viterbi_obs(model, &record, other + from, &record_scores[count], &opts) != 0)
+        {
+            err(EX_DATAERR, "reference decoding of records");
+        }
+        items[count].obs = record;
+        items[count].path = eq->path + from;
+        from += n;
+    }
+    static const int lanes[] = { 1, 8, 16 };
+    for (size_t l = 0; l < sizeof(lanes) / sizeof(lanes[0]); l++)
+    {
+        for (int one = 1; one >= 0; one--)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "batch, lanes %d, %s", lanes[l], one ? "1 thread" : "-j threads");
+            hmm_viterbi_opts batch_opts = opts;
+            batch_opts.lanes = lanes[l];
+            batch_check(eq, name, items, count, other, record_scores, one ? 1 : threads, &batch_opts);
+        }
+    }
+    if (hmm_backend_available(HMM_BACKEND_CUDA))
+    {
+        hmm_viterbi_opts cuda_opts = opts;
+        cuda_opts.backend = HMM_BACKEND_CUDA;
+        batch_check(eq, "batch, cuda", items, count, other, record_scores, threads, &cuda_opts);
+    }
+    free(items);
+    free(record_scores);
+
+    // the parallel decoder against itself on one thread, and how it compares with the reference
+    opts.mode = HMM_VITERBI_PARALLEL;
+    opts.threads = 1;
+    double parallel_score;
+    if (hmm_viterbi_obs(model, obs, other, &parallel_score, &opts) != 0)
+    {
+        err(EX_DATAERR, "parallel decoding");
+    }
+    opts.threads = threads;
+    decode_check(eq, "parallel, -j threads against 1 thread", 1, other, parallel_score, &opts);
+    report_check(eq, "parallel", 0, expect, other, length,
+                 memcmp(&parallel_score, &expect_score, sizeof(double)) == 0);
+    opts.mode = HMM_VITERBI_FULL;
+    opts.threads = 0;
+
+    static const hmm_score narrow[] = { HMM_SCORE_FLOAT, HMM_SCORE_FIXED };
+    static const char *narrow_names[] = { "float scores", "fixed-point scores" };
+    for (int k = 0; k < 2; k++)
+    {
+        opts.score = narrow[k];
+        decode_check(eq, narrow_names[k], 0, expect, expect_score, &opts);
+    }
+    printf("\n    ],\n    \"failed\": %d\n  },\n", eq->failed);
+
+    free(expect);
+    free(other);
+    free(eq->path);
+}
+
+
+// -E: an incremental decoder of a copy of seq through random edits; nonzero if its result is not that of a new one
+static int print_incremental(const hmm_model *model, const int *seq, size_t length, int edits)
+{
+    int *edited = malloc(length * sizeof(int));
+    hmm_state *path = malloc(length * sizeof(hmm_state));
+    if (!edited || !path)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    memcpy(edited, seq, length * sizeof(int));
+    hmm_obs obs = { HMM_OBS_INT, length, edited };
+
+    double start = now();
+    hmm_incremental *inc = hmm_incremental_new(model, &obs, 0);
+    if (!inc)
+    {
+        err(EX_DATAERR, "incremental decoding");
+    }
+    double build = now() - start;
+
+    // categorical symbols change to another symbol, counts by one
+    int m = model->n_symbols;
+    double total = 0;
+    double longest = 0;
+    for (int e = 0; e < edits; e++)
+    {
+        size_t from = lrand48() % length;
+        size_t count = length - from < BENCH_EDIT_SPAN ? length - from : BENCH_EDIT_SPAN;
+        for (size_t t = from; t < from + count; t++)
+        {
+            int s = edited[t];
+            edited[t] = m > 1 ? (s + 1 + lrand48() % (m - 1)) % m : s > 0 && lrand48() % 2 ? s - 1 : s + 1;
+        }
+        start = now();
+        if (hmm_incremental_update(inc, from, count) != 0)
+        {
+            err(EX_DATAERR, "incremental update");
+        }
+        double seconds = now() - start;
+        total += seconds;
+        longest = seconds > longest ? seconds : longest;
+    }
+
+    double score;
+    double fresh_score;
+    const hmm_state *kept = hmm_incremental_path(inc, &score);
+    start = now();
+    if (hmm_viterbi_obs(model, &obs, path, NULL, NULL) != 0)
+    {
+        err(EX_DATAERR, "decoding the edited sequence");
+    }
+    double full = now() - start;
+    size_t agree = 0;
+    for (size_t t = 0; t < length; t++)
+    {
+        agree += kept[t] == path[t];
+    }
+    hmm_incremental *fresh = hmm_incremental_new(model, &obs, 0);
+    if (!fresh)
+    {
+        err(EX_DATAERR, "incremental decoding of the edited sequence");
+    }
+    int identical = memcmp(kept, hmm_incremental_path(fresh, &fresh_score), length * sizeof(hmm_state)) == 0 &&
+                    memcmp(&score, &fresh_score, sizeof(double)) == 0;
+
+    printf("  \"incremental\": { \"edits\": %d, \"span\": %d, \"build_seconds\": %.6f, \"update_seconds\": %.6f, "
+           "\"longest_update_seconds\": %.6f, \"full_seconds\": %.6f, \"identical\": %s, "
+           "\"full_agreement\": %.6f },\n", edits, BENCH_EDIT_SPAN, build, edits ? total / edits : 0.0, longest, full,
+           identical ? "true" : "false", (double) agree / length);
+
+    hmm_incremental_free(inc);
+    hmm_incremental_free(fresh);
+    free(edited);
+    free(path);
+    return !identical;
+}
+
+
+int main (int argc, char *argv[])
+{
+    const char *model_name = "durbin";
+    const char *keep_name = NULL;
+    const char *out_name = "/dev/null";
+    hmm_path_format format = HMM_PATH_LABELS;
+    int random_states = 0;
+    int random_symbols = 6;
+    int random_successors = 0;
+    int verify = 0;
+    int incremental = 0;
+    int edits = 0;
+    size_t length = 1000000;
+    int repeats = 3;
+    unsigned long seed = 1;
+    hmm_viterbi_opts opts;
+    hmm_viterbi_timing timing;
+    int opt;
+
+    hmm_viterbi_opts_init(&opts);
+    while ((opt = getopt(argc, argv, "m:n:a:e:uL:r:s:c:pP:B:T:j:S:g:o:F:VE:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                model_name = optarg;
+                break;
+            case 'n':
+                random_states = atoi(optarg);
+                break;
+            case 'a':
+                random_symbols = atoi(optarg);
+                break;
+            case 'e':
+                random_successors = atoi(optarg);
+                break;
+            case 'u':
+                equal_weights = 1;
+                break;
+            case 'L':
+                length = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                opts.mode = HMM_VITERBI_CHECKPOINT;
+                opts.checkpoint = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                opts.trace = HMM_TRACE_PACKED;
+                break;
+            case 'P':
+                opts.mode = HMM_VITERBI_PARALLEL;
+                opts.chunk = strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                opts.mode = HMM_VITERBI_BEAM;
+                opts.beam_width = strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                opts.mode = HMM_VITERBI_BEAM;
+                opts.beam_threshold = strtod(optarg, NULL);
+                if (!(opts.beam_threshold >= 0))
+                {
+                    errx(EX_USAGE, "-T takes a log score margin of 0 or more");
+                }
+                break;
+            case 'j':
+                opts.threads = atoi(optarg);
+                break;
+            case 'S':
+                if (strcmp(optarg, "double") == 0)
+                {
+                    opts.score = HMM_SCORE_DOUBLE;
+                }
+                else if (strcmp(optarg, "float") == 0)
+                {
+                    opts.score = HMM_SCORE_FLOAT;
+                }
+                else if (strcmp(optarg, "fixed") == 0)
+                {
+                    opts.score = HMM_SCORE_FIXED;
+                }
+                else
+                {
+                    errx(EX_USAGE, "-S takes double, float or fixed");
+                }
+                break;
+            case 'g':
+                keep_name = optarg;
+                break;
+            case 'o':
+                out_name = optarg;
+                break;
+            case 'F':
+                if (strcmp(optarg, "labels") == 0)
+                {
+                    format = HMM_PATH_LABELS;
+                }
+                else if (strcmp(optarg, "binary") == 0)
+                {
+                    format = HMM_PATH_BINARY;
+                }
+                else if (strcmp(optarg, "segments") == 0)
+                {
+                    format = HMM_PATH_SEGMENTS;
+                }
+                else
+                {
+                    errx(EX_USAGE, "-F takes labels, binary or segments");
+                }
+                break;
+            case 'V':
+                verify = 1;
+                break;
+            case 'E':
+                incremental = 1;
+                edits = atoi(optarg);
+                break;
+            default:
+                errx(EX_USAGE, USAGE);
+        }
+    }
+    if (optind != argc || length == 0 || repeats < 1 || random_states < 0 || random_states > HMM_MAX_STATES ||
+        random_symbols < 1 || random_successors < 0 || edits < 0)
+    {
+        errx(EX_USAGE, USAGE);
+    }
+    if (opts.mode == HMM_VITERBI_BEAM && opts.score != HMM_SCORE_DOUBLE)
+    {
+        errx(EX_USAGE, "-B and -T prune double precision scores only");
+    }
+
+    hmm_modelfile loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    if (random_states)
+    {
+        srand48(seed);
+        loaded.model = random_model(random_states, random_symbols, random_successors);
+        loaded.info.name = "random";
+        loaded.info.labels = random_states <= 62 ? BENCH_LABELS : NULL;
+    }
+    else if (hmm_modelfile_load(model_name, &loaded) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: not a valid model file", model_name);
+        }
+        err(EX_NOINPUT, "Unknown model %s", model_name);
+    }
+    hmm_model *model = loaded.model;
+
+    int *sampled = malloc(length * sizeof(int));
+    hmm_state *truth = malloc(length * sizeof(hmm_state));
+    hmm_state *path = malloc(length * sizeof(hmm_state));
+    if (!sampled || !truth || !path)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+
+    double best[N_PHASES];
+    for (int p = 0; p < N_PHASES; p++)
+    {
+        best[p] = -1;
+    }
+
+    for (int r = 0; r < repeats; r++)
+    {
+        double start = now();
+        if (hmm_sample(model, length, seed, sampled, truth) != 0)
+        {
+            err(EX_DATAERR, "sampling from %s", model_name);
+        }
+        keep_best(&best[PHASE_GENERATE], now() - start);
+    }
+
+    char temp_name[] = "/tmp/hmm_bench.XXXXXX";
+    const char *seq_name = keep_name;
+    FILE *seq_file;
+    if (keep_name)
+    {
+        seq_file = fopen(keep_name, "w");
+    }
+    else
+    {
+        int fd = mkstemp(temp_name);
+        seq_file = fd < 0 ? NULL : fdopen(fd, "w");
+        seq_name = temp_name;
+    }
+    if (!seq_file)
+    {
+        err(EX_CANTCREAT, "%s", seq_name);
+    }
+    write_sequence(seq_file, seq_name, sampled, length, loaded.info.symbol_base);
+    fclose(seq_file);
+
+    int *seq = NULL;
+    size_t parsed = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        free(seq);
+        double start = now();
+        if (hmm_read_sequence(seq_name, loaded.info.symbol_base, &seq, &parsed) != 0)
+        {
+            err(EX_IOERR, "%s", seq_name);
+        }
+        keep_best(&best[PHASE_PARSE], now() - start);
+    }
+    if (!keep_name)
+    {
+        unlink(temp_name);
+    }
+    if (parsed != length)
+    {
+        errx(EX_SOFTWARE, "%s: read %zu symbols back instead of %zu", seq_name, parsed, length);
+    }
+
+    hmm_obs obs = { HMM_OBS_INT, length, seq };
+    if (hmm_model_cache_obs(model, &obs) != 0)
+    {
+        err(EX_OSERR, "hmm_model_cache_obs");
+    }
+    opts.timing = &timing;
+    double score = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        if (hmm_viterbi_obs(model, &obs, path, &score, &opts) != 0)
+        {
+            err(EX_DATAERR, "decoding");
+        }
+        keep_best(&best[PHASE_FORWARD], timing.forward);
+        keep_best(&best[PHASE_TRACEBACK], timing.traceback);
+    }
+
+    // what the beam cost in accuracy, against one exact decode
+    size_t beam_agree = 0;
+    double exact_score = 0;
+    double exact_seconds = 0;
+    if (opts.mode == HMM_VITERBI_BEAM)
+    {
+        hmm_viterbi_opts exact;
+        hmm_viterbi_opts_init(&exact);
+        exact.trace = opts.trace;
+        exact.timing = &timing;
+        hmm_state *exact_path = malloc(length * sizeof(hmm_state));
+        if (!exact_path)
+        {
+            errx(EX_OSERR, "Not enough memory.");
+        }
+        if (hmm_viterbi_obs(model, &obs, exact_path, &exact_score, &exact) != 0)
+        {
+            err(EX_DATAERR, "exact decoding");
+        }
+        exact_seconds = timing.forward + timing.traceback;
+        for (size_t t = 0; t < length; t++)
+        {
+            beam_agree += path[t] == exact_path[t];
+        }
+        free(exact_path);
+    }
+
+    FILE *out = fopen(out_name, "w");
+    if (!out)
+    {
+        err(EX_CANTCREAT, "%s", out_name);
+    }
+    for (int r = 0; r < repeats; r++)
+    {
+        rewind(out);
+        double start = now();
+        print_path(out, out_name, path, length, loaded.info.labels, model->n_states, format);
+        keep_best(&best[PHASE_OUTPUT], now() - start);
+    }
+    fclose(out);
+
+    size_t agree = 0;
+    for (size_t t = 0; t < length; t++)
+    {
+        agree += path[t] == truth[t];
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    static const char *trace_names[] = { "bytes", "packed" };
+    static const char *mode_names[] = { "full", "checkpoint", "parallel", "beam" };
+    static const char *score_names[] = { "double", "float", "fixed" };
+    static const char *format_names[] = { "labels", "binary", "segments" };
+    printf("{\n");
+    printf("  \"model\": \"%s\",\n", random_states ? "random" : model_name);
+    printf("  \"states\": %d,\n", model->n_states);
+    printf("  \"transitions\": \"%s\",\n", model->pred_start ? "sparse" : "dense");
+    printf("  \"symbols\": %d,\n", model->n_symbols);
+    printf("  \"emission\": \"%s\",\n", model->ops->name);
+    printf("  \"length\": %zu,\n", length);
+    printf("  \"seed\": %lu,\n", seed);
+    printf("  \"repeats\": %d,\n", repeats);
+    printf("  \"kernel\": \"%s\",\n", hmm_kernel_name());
+    printf("  \"mode\": \"%s\",\n", mode_names[opts.mode]);
+    printf("  \"trace\": \"%s\",\n", trace_names[opts.trace]);
+    printf("  \"score\": \"%s\",\n", score_names[opts.score]);
+    printf("  \"output\": \"%s\",\n", format_names[format]);
+    printf("  \"phases\": {\n");
+    for (int p = 0; p < N_PHASES; p++)
+    {
+        printf("    \"%s\": { \"seconds\": %.6f, \"symbols_per_second\": %.0f }%s\n", phase_names[p], best[p],
+               best[p] > 0 ? length / best[p] : 0.0, p + 1 < N_PHASES ? "," : "");
+    }
+    printf("  },\n");
+    if (opts.mode == HMM_VITERBI_BEAM)
+    {
+        printf("  \"beam\": { \"width\": %zu, \"threshold\": %g, \"exact_seconds\": %.6f, \"changed\": %s, "
+               "\"exact_agreement\": %.6f, \"score_gap\": %.6g },\n", opts.beam_width, opts.beam_threshold,
+               exact_seconds, beam_agree < length ? "true" : "false", (double) beam_agree / length,
+               exact_score - score);
+    }
+    equivalence eq = { NULL, NULL, NULL, 0, 0 };
+    if (verify)
+    {
+        print_equivalence(model, &obs, opts.threads, &eq);
+    }
+    if (incremental)
+    {
+        eq.failed += print_incremental(model, seq, length, edits);
+    }
+    printf("  \"peak_rss_kib\": %ld,\n", usage.ru_maxrss);
+    printf("  \"path_agreement\": %.6f\n", (double) agree / length);
+    printf("}\n");
+
+    free(sampled);
+    free(truth);
+    free(path);
+    free(seq);
+    if (random_states)
+    {
+        hmm_model_free(model);
+    }
+    else
+    {
+        hmm_modelfile_close(&loaded);
+    }
+    return eq.failed ? EX_SOFTWARE : 0;
+}
@@ -0,0 +1,1069 @@
+/**
+ * General purpose command line decoder built on the engine in ../hmm.
+ *
+ * Reads a sequence file in the one-entry-per-line format of the example programs, or standard input when no file
+ * (or "-") is given, and prints the most likely state path as one label character per position.
+ *
+ * Binary sequence files written by hmm_seqconv are recognised by their header and decoded directly from a
+ * read-only mapping of the file, without parsing or copying.
+ *
+ * gzip (or BGZF) and zstd compressed input, including manifest entries, is decompressed while it is decoded, BGZF
+ * and many-frame zstd on -j threads, in a build with -DHMM_ZLIB -lz and/or -DHMM_ZSTD -lzstd (see
+ * ../hmm/decompress.c).
+ *
+ * In streaming mode (-s) observations are decoded as they arrive and states are printed as soon as they are
+ * decided, so output on a pipe follows the input with a delay set by the model (or by -l) instead of its length.
+ *
+ * In batch mode (-b) the input holds many independent records, decoded in parallel with the model shared by all
+ * threads. It is either a multi-record file, where each record starts with a ">name" line followed by its
+ * symbols, or a manifest naming one text or binary sequence file per line. Each record is printed as ">name"
+ * followed by its path, in input order. Records of small models are decoded 8 at a time side by side in SIMD
+ * lanes (see ../hmm/batch_lanes.c); -L changes that to 16 or, with 1, to one at a time. -D cuda decodes the
+ * batch on a CUDA device instead, in a build that includes it (see ../hmm/batch_cuda.cu).
+ *
+ * Batch input is read by a thread of its own, a few thousand records ahead of the decoders, so that reading and
+ * decoding overlap. The files named by a manifest, e.g. the shards of a large data set on network storage, are
+ * loaded by -r threads at once, and binary ones read into memory before they are decoded.
+ *
+ * With -f the posterior state probabilities of every position are printed instead of the Viterbi path, one line
+ * per position: the label of the most probable state followed by the probability of each state.
+ *
+ * -S decodes with float or fixed-point scores instead of double (see ../hmm/viterbi_narrow.c), and -v then also
+ * decodes in double precision and reports on standard error whether, and where, the two paths differ.
+ *
+ * -o replaces the label characters with a packed binary array of state numbers, or with one "start end label"
+ * line per run of a single state, positions zero-based and end exclusive; batch mode prints segments below each
+ * ">name" line.
+ *
+ * With -t the path is compared with a state file (the last field of each line a state label, as in
+ * durbin_state.txt or sample_states_1.txt) while it is decoded, reading both in one pass, and a JSON report is
+ * printed instead: agreement, precision and recall per state, the confusion matrix (rows true states, columns
+ * decoded) and the precision and recall of segment boundaries (see ../hmm/accuracy.c). -s compares as states are
+ * decided.
+ *
+ * Models with Gaussian emissions (see ../hmm/model_file.c) read a text file of real numbers instead, one per
+ * line, and decode it as a whole: not in streaming or batch mode.
+ *
+ * -B and -T prune the decode to a beam of the best states of every position (see ../hmm/viterbi_beam.c): much
+ * faster for models with many states, but the path is then only approximately the most likely one.
+ *
+ * When built with -DHMM_STATS (library included), the time, bytes and symbols of every phase are written as JSON
+ * at exit, to the file named by the HMM_STATS_FILE environment variable or else to standard error.
+ *
+ * Usage: ./hmm_decode [-m model] [-c interval] [-p] [-s] [-l lag] [-P chunk] [-B width] [-T threshold] [-b]
+ *                     [-j threads] [-L lanes] [-D device] [-r readers] [-f] [-S score] [-v] [-o format]
+ *                     [-t truth_file [-w tolerance]] [my_sequence_file.txt]
+ *   -m model      built-in model, durbin (default) or poisson, or a model file (see ../hmm/model_file.c)
+ *   -c interval   checkpointed decoding with a score column every interval positions, 0 for sqrt(n)
+ *                 (with -f, Forward-Backward in bounded memory)
+ *   -p            bit-packed backpointers
+ *   -s            streaming output
+ *   -l lag        with -s, decide every position at the latest lag observations after it
+ *   -P chunk      decode one sequence on several threads in chunks of this many positions, 0 for the default
+ *   -B width      beam decoding keeping at most this many states per position
+ *   -T threshold  beam decoding keeping only states within this log score of the best one
+ *   -b            batch mode, the input is a multi-record file or a manifest
+ *   -j threads    with -b or -P, worker threads, default one per online CPU
+ *   -L lanes      with -b, records decoded together: 8 (default), 16, or 1 for one at a time
+ *   -D device     with -b, where records are decoded: cpu (default) or cuda
+ *   -r readers    with -b and a manifest, files loaded at once, default 4
+ *   -f            posterior probabilities from Forward-Backward
+ *   -S score      path score type: double (default), float or fixed
+ *   -v            with -S, report any divergence from the double precision path
+ *   -o format     path output: labels (default), binary (one byte per state) or segments (see ../hmm/pathio.c)
+ *   -t truth_file report the accuracy of the path against the true states in this file instead of printing it
+ *   -w tolerance  with -t, positions by which a segment boundary may miss the true one, default 0
+ *
+ * Build by compiling hmm_decode.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o hmm_decode hmm_decode.c ../hmm/[a-z]*.c -lm -pthread
+ *
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "../hmm/hmm.h"
+
+#define USAGE "Usage: ./hmm_decode [-m model] [-c interval] [-p] [-s] [-l lag] [-P chunk] [-B width] [-T threshold] " \
+              "[-b] [-j threads] [-L lanes] [-D device] [-r readers] [-f] [-S score] [-v] [-o format] " \
+              "[-t truth_file [-w tolerance]] [my_sequence_file.txt]"
+
+// records decoded per parallel batch, bounding memory for files with very many records
+#define BATCH_CHUNK 16384
+// chunks read ahead of the one being decoded, and the default threads loading the files of a manifest
+#define BATCH_AHEAD 2
+#define BATCH_LOADERS 4
+// true states read from the -t file at a time
+#define TRUTH_BLOCK 65536
+
+static const hmm_example *example;
+static hmm_path_writer *writer;
+static int validate;
+// -t: the truth file decoded states are compared with instead of being printed
+static hmm_accuracy *accuracy;
+static int accuracy_states;
+static FILE *truth_file;
+static const char *truth_name;
+
+
+// reads the next whitespace separated non-negative integer; returns 0 at end of input
+static int read_symbol(FILE *f, const char *name, int *out)
+{
+    int ch;
+    do
+    {
+        ch = getc(f);
+    }
+    while (ch != EOF && isspace(ch));
+
+    if (ch == EOF)
+    {
+        if (ferror(f))
+        {
+            err(EX_IOERR, "%s", name);
+        }
+        return 0;
+    }
+    if (!isdigit(ch))
+    {
+        errx(EX_DATAERR, "%s: unexpected character '%c'", name, ch);
+    }
+
+    long value = 0;
+    while (ch != EOF && isdigit(ch))
+    {
+        value = value * 10 + (ch - '0');
+        if (value > 0x7fffffff)
+        {
+            errx(EX_DATAERR, "%s: symbol out of range", name);
+        }
+        ch = getc(f);
+    }
+    if (ch != EOF)
+    {
+        ungetc(ch, f);
+    }
+
+    *out = (int) value - example->symbol_base;
+    return 1;
+}
+
+// adds decoded states to the accuracy report, next to the same number of states from the truth file
+static void compare_states(const hmm_state *states, size_t count)
+{
+    static hmm_state truth[TRUTH_BLOCK];
+
+    for (size_t done = 0; done < count; )
+    {
+        size_t want = count - done < TRUTH_BLOCK ? count - done : TRUTH_BLOCK;
+        size_t got;
+        if (hmm_read_states(truth_file, example->labels, accuracy_states, truth, want, &got) != 0)
+        {
+            if (errno == EINVAL)
+            {
+                errx(EX_DATAERR, "%s: unknown state", truth_name);
+            }
+            err(EX_IOERR, "%s", truth_name);
+        }
+        if (got < want)
+        {
+            errx(EX_DATAERR, "%s: fewer states than the decoded path", truth_name);
+        }
+        hmm_accuracy_add(accuracy, states + done, truth, got);
+        done += got;
+    }
+}
+
+// prints the accuracy report once the whole path has been compared
+static void report_accuracy(void)
+{
+    hmm_state extra;
+    size_t got;
+    if (hmm_read_states(truth_file, example->labels, accuracy_states, &extra, 1, &got) == 0 && got)
+    {
+        errx(EX_DATAERR, "%s: more states than the decoded path", truth_name);
+    }
+    if (hmm_accuracy_report(stdout, accuracy, example->labels) != 0)
+    {
+        err(EX_IOERR, "stdout");
+    }
+    hmm_accuracy_free(accuracy);
+    fclose(truth_file);
+}
+
+// appends states to the path being printed, and with end also finishes it
+static void print_states(const hmm_state *states, size_t count, int end)
+{
+    if (accuracy)
+    {
+        compare_states(states, count);
+        return;
+    }
+    HMM_STATS_START(mark);
+    if (hmm_path_write(writer, states, count) != 0 || (end && hmm_path_end(writer) != 0))
+    {
+        err(EX_IOERR, "stdout");
+    }
+    HMM_STATS_STOP(HMM_PHASE_OUTPUT, mark, count, count);
+}
+
+static int posterior_sink(void *ctx, size_t position, const double *posterior)
+{
+    int n = *(const int *) ctx;
+    (void) position;
+
+    putchar(example->labels[hmm_argmax(posterior, n)]);
+    for (int j = 0; j < n; j++)
+    {
+        printf("\t%.6f", posterior[j]);
+    }
+    return putchar('\n') == EOF ? -1 : 0;
+}
+
+static int stream_sink(void *ctx, size_t position, const hmm_state *states, size_t count)
+{
+    (void) ctx;
+    (void) position;
+    print_states(states, count, 0);
+    return hmm_path_flush(writer);
+}
+
+
+static void decode_stream(const hmm_model *model, FILE *f, const char *name, size_t lag)
+{
+    hmm_stream *stream = hmm_stream_new(model, lag, stream_sink, NULL);
+    if (!stream)
+    {
+        err(EX_OSERR, "hmm_stream_new");
+    }
+
+    int obs;
+    while (read_symbol(f, name, &obs))
+    {
+        if (hmm_stream_push(stream, obs) != 0)
+        {
+            err(EX_DATAERR, "%s", name);
+        }
+    }
+    if (hmm_stream_finish(stream) != 0)
+    {
+        err(EX_IOERR, "stdout");
+    }
+    print_states(NULL, 0, 1);
+    hmm_stream_free(stream);
+}
+
+// compares a path decoded with narrow scores against the double precision path of the same observations
+static void check_path(const hmm_model *model, const hmm_obs *obs, const char *name, const hmm_viterbi_opts *opts,
+                       const hmm_state *path, double score)
+{
+    size_t n = obs->length;
+    hmm_state *wide = malloc((n ? n : 1) * sizeof(hmm_state));
+    if (!wide)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    hmm_viterbi_opts wide_opts = *opts;
+    wide_opts.score = HMM_SCORE_DOUBLE;
+    double wide_score;
+    if (hmm_viterbi_obs(model, obs, wide, &wide_score, &wide_opts) != 0)
+    {
+        err(EX_DATAERR, "%s", name);
+    }
+
+    size_t differ = 0;
+    size_t first = 0;
+    for (size_t t = 0; t < n; t++)
+    {
+        if (path[t] != wide[t] && differ++ == 0)
+        {
+            first = t;
+        }
+    }
+    if (differ)
+    {
+        fprintf(stderr, "%s: %zu of %zu states differ from the double precision path, the first at position %zu; "
+                "score %.9g against %.9g\n", name, differ, n, first, score, wide_score);
+    }
+    else
+    {
+        fprintf(stderr, "%s: same path as in double precision; score %.9g against %.9g\n", name, score, wide_score);
+    }
+    free(wide);
+}
+
+// the Viterbi path of obs, or its posteriors when post is not NULL
+static void decode_obs(hmm_model *model, const hmm_obs *obs, const char *name, const hmm_viterbi_opts *opts,
+                       const hmm_posterior_opts *post)
+{
+    if (hmm_model_cache_obs(model, obs) != 0)
+    {
+        err(EX_OSERR, "hmm_model_cache_obs");
+    }
+
+    if (post)
+    {
+        if (hmm_posterior_each(model, obs, NULL, post, posterior_sink, &model->n_states) != 0)
+        {
+            if (ferror(stdout))
+            {
+                err(EX_IOERR, "stdout");
+            }
+            err(EX_DATAERR, "%s", name);
+        }
+        return;
+    }
+
+    size_t n = obs->length;
+    hmm_state *path = malloc((n ? n : 1) * sizeof(hmm_state));
+    if (!path)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    double score;
+    if (hmm_viterbi_obs(model, obs, path, &score, opts) != 0)
+    {
+        err(EX_DATAERR, "%s", name);
+    }
+    print_states(path, n, 1);
+    if (validate)
+    {
+        check_path(model, obs, name, opts, path, score);
+    }
+    free(path);
+}
+
+// a compressed input that was corrupt or cut short fails however much of it was read
+static void close_input(hmm_input *input, const char *name)
+{
+    if (hmm_input_close(input) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: compressed data is corrupt or cut short", name);
+        }
+        err(EX_DATAERR, "%s", name);
+    }
+}
+
+// reads all of input and checks that it decompressed cleanly before anything is decoded or printed
+static void decode_whole(hmm_model *model, hmm_input *input, const char *name, const hmm_viterbi_opts *opts,
+                         const hmm_posterior_opts *post)
+{
+    int fd = input->fd;
+    size_t n;
+    if (model->emission == HMM_EMIT_GAUSSIAN)
+    {
+        double *values;
+        if (hmm_read_values_fd(fd, &values, &n) != 0)
+        {
+            if (errno == EINVAL)
+            {
+                errx(EX_DATAERR, "%s: expected one real number per line", name);
+            }
+            err(EX_IOERR, "%s", name);
+        }
+        close_input(input, name);
+        hmm_obs obs = { HMM_OBS_F64, n, values };
+        decode_obs(model, &obs, name, opts, post);
+        free(values);
+        return;
+    }
+
+    int *seq;
+    if (hmm_read_sequence_fd(fd, example->symbol_base, &seq, &n) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: expected one non-negative integer per line", name);
+        }
+        err(EX_IOERR, "%s", name);
+    }
+    close_input(input, name);
+
+    hmm_obs obs = { HMM_OBS_INT, n, seq };
+    decode_obs(model, &obs, name, opts, post);
+    free(seq);
+}
+
+
+// binary sequence files are decoded straight from the mapping, their symbols are already zero-based
+static void decode_mapped(hmm_model *model, const char *name, const hmm_viterbi_opts *opts,
+                          const hmm_posterior_opts *post)
+{
+    hmm_seqfile file;
+    if (hmm_seqfile_open(name, &file) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: damaged binary sequence file", name);
+        }
+        err(EX_NOINPUT, "%s", name);
+    }
+
+    decode_obs(model, &file.obs, name, opts, post);
+    hmm_seqfile_close(&file);
+}
+
+
+// records of a batch file: either one per '>' header line with the symbols on the lines below it,
+// or, for a manifest, one per line naming a text or binary sequence file
+typedef struct
+{
+    char *name;
+    int *seq;
+    hmm_seqfile file;
+    hmm_batch_item item;
+} batch_record;
+
+typedef struct
+{
+    batch_record *records;
+    size_t count;
+    size_t cap;
+} batch_chunk;
+
+static batch_record *new_record(batch_chunk *chunk, const char *name, size_t name_len)
+{
+    if (chunk->count == chunk->cap)
+    {
+        chunk->cap = chunk->cap ? 2 * chunk->cap : 256;
+        chunk->records = realloc(chunk->records, chunk->cap * sizeof(batch_record));
+        if (!chunk->records)
+        {
+            errx(EX_OSERR, "Not enough memory.");
+        }
+    }
+    batch_record *rec = &chunk->records[chunk->count++];
+    memset(rec, 0, sizeof(*rec));
+    rec->name = strndup(name, name_len);
+    if (!rec->name)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    return rec;
+}
+
+static void load_manifest_entry(batch_record *rec)
+{
+    if (hmm_seqfile_is_binary(rec->name) == 1)
+    {
+        if (hmm_seqfile_open(rec->name, &rec->file) != 0)
+        {
+            err(EX_NOINPUT, "%s", rec->name);
+        }
+        // mapped pages would otherwise be read from storage by the decoders
+        hmm_seqfile_prefetch(&rec->file);
+        rec->item.obs = rec->file.obs;
+        return;
+    }
+
+    size_t n;
+    if (hmm_read_sequence(rec->name, example->symbol_base, &rec->seq, &n) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: expected one non-negative integer per line", rec->name);
+        }
+        err(EX_NOINPUT, "%s", rec->name);
+    }
+    rec->item.obs.type = HMM_OBS_INT;
+    rec->item.obs.length = n;
+    rec->item.obs.data = rec->seq;
+}
+
+// appends the integers on one line of a multi-record file to rec
+static void append_symbols(batch_record *rec, size_t *cap, const char *line, const char *name)
+{
+    for (const char *p = line; *p; )
+    {
+        if (isspace((unsigned char) *p))
+        {
+            p++;
+            continue;
+        }
+        if (!isdigit((unsigned char) *p))
+        {
+            errx(EX_DATAERR, "%s: unexpected character '%c' in record %s", name, *p, rec->name);
+        }
+        long value = 0;
+        while (isdigit((unsigned char) *p))
+        {
+            value = value * 10 + (*p++ - '0');
+            if (value > 0x7fffffff)
+            {
+                errx(EX_DATAERR, "%s: symbol out of range in record %s", name, rec->name);
+            }
+        }
+
+        size_t n = rec->item.obs.length;
+        if (n == *cap)
+        {
+            *cap = *cap ? 2 * *cap : 256;
+            rec->seq = realloc(rec->seq, *cap * sizeof(int));
+            if (!rec->seq)
+            {
+                errx(EX_OSERR, "Not enough memory.");
+            }
+        }
+        rec->seq[n] = (int) value - example->symbol_base;
+        rec->item.obs.length = n + 1;
+    }
+    rec->item.obs.type = HMM_OBS_INT;
+    rec->item.obs.data = rec->seq;
+}
+
+// reads up to limit records, of a manifest only their names; returns 0 once the file is exhausted
+static int read_chunk(FILE *f, const char *name, int multi_record, size_t limit, batch_chunk *chunk)
+{
+    static char *line;
+    static size_t line_cap;
+    static size_t seq_cap;
+    // a header read ahead by the previous chunk, if any
+    static char *pending;
+    ssize_t len;
+
+    chunk->count = 0;
+    if (multi_record && pending)
+    {
+        new_record(chunk, pending, strlen(pending));
+        free(pending);
+        pending = NULL;
+        seq_cap = 0;
+    }
+
+    while ((len = getline(&line, &line_cap, f)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+
+        if (!multi_record)
+        {
+            if (len > 0)
+            {
+                new_record(chunk, line, len);
+                if (chunk->count == limit)
+                {
+                    return 1;
+                }
+            }
+            continue;
+        }
+
+        if (line[0] == '>')
+        {
+            if (chunk->count == limit)
+            {
+                pending = strdup(line + 1);
+                return 1;
+            }
+            new_record(chunk, line + 1, len - 1);
+            seq_cap = 0;
+        }
+        else if (chunk->count == 0)
+        {
+            errx(EX_DATAERR, "%s: symbols before the first '>' header", name);
+        }
+        else
+        {
+            append_symbols(&chunk->records[chunk->count - 1], &seq_cap, line, name);
+        }
+    }
+    if (ferror(f))
+    {
+        err(EX_IOERR, "%s", name);
+    }
+    return 0;
+}
+
+// the files named by a chunk of a manifest, loaded by several threads at once: on network storage reading
+// one shard at a time would leave the link mostly idle
+typedef struct
+{
+    batch_chunk *chunk;
+    pthread_mutex_t lock;
+    size_t next;
+} manifest_load;
+
+static void *load_thread(void *arg)
+{
+    manifest_load *load = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&load->lock);
+        size_t i = load->next++;
+        pthread_mutex_unlock(&load->lock);
+        if (i >= load->chunk->count)
+        {
+            return NULL;
+        }
+        load_manifest_entry(&load->chunk->records[i]);
+    }
+}
+
+static void load_chunk(batch_chunk *chunk, int loaders)
+{
+    manifest_load load = { chunk, PTHREAD_MUTEX_INITIALIZER, 0 };
+    pthread_t tids[loaders];
+    int started = 0;
+    while (started < loaders - 1 && pthread_create(&tids[started], NULL, load_thread, &load) == 0)
+    {
+        started++;
+    }
+    load_thread(&load);
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    pthread_mutex_destroy(&load.lock);
+}
+
+// batch input read and parsed by a thread of its own, up to BATCH_AHEAD chunks ahead of the decoders, so that
+// decoding a chunk overlaps reading the next ones. Errors in the reader exit like those of the decoders
+typedef struct
+{
+    FILE *f;
+    const char *name;
+    int multi_record;
+    int loaders;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    batch_chunk chunks[BATCH_AHEAD];
+    int more[BATCH_AHEAD];
+    size_t taken;           // chunks handed to the decoders
+    size_t read;            // chunks read
+} batch_reader;
+
+static void *reader_thread(void *arg)
+{
+    batch_reader *r = arg;
+    int more;
+    do
+    {
+        pthread_mutex_lock(&r->lock);
+        while (r->read - r->taken == BATCH_AHEAD)
+        {
+            pthread_cond_wait(&r->drained, &r->lock);
+        }
+        size_t slot = r->read % BATCH_AHEAD;
+        pthread_mutex_unlock(&r->lock);
+
+        batch_chunk *chunk = &r->chunks[slot];
+        more = read_chunk(r->f, r->name, r->multi_record, BATCH_CHUNK, chunk);
+        if (!r->multi_record)
+        {
+            load_chunk(chunk, r->loaders);
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->more[slot] = more;
+        r->read++;
+        pthread_cond_signal(&r->filled);
+        pthread_mutex_unlock(&r->lock);
+    }
+    while (more);
+    return NULL;
+}
+
+static void decode_batch(hmm_model *model, FILE *f, const char *name, int threads, int loaders,
+                         const hmm_viterbi_opts *opts)
+{
+    // peek at the first character to tell a multi-record file from a manifest
+    int ch;
+    do
+    {
+        ch = getc(f);
+    }
+    while (ch != EOF && isspace(ch));
+    if (ch == EOF)
+    {
+        return;
+    }
+    ungetc(ch, f);
+
+    batch_reader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.f = f;
+    reader.name = name;
+    reader.multi_record = ch == '>';
+    reader.loaders = loaders;
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.filled, NULL);
+    pthread_cond_init(&reader.drained, NULL);
+    pthread_t reader_tid;
+    if (pthread_create(&reader_tid, NULL, reader_thread, &reader) != 0)
+    {
+        errx(EX_OSERR, "Cannot start the batch reader.");
+    }
+
+    hmm_batch_item *items = NULL;
+    int more;
+
+    do
+    {
+        pthread_mutex_lock(&reader.lock);
+        while (reader.read == reader.taken)
+        {
+            pthread_cond_wait(&reader.filled, &reader.lock);
+        }
+        size_t slot = reader.taken % BATCH_AHEAD;
+        more = reader.more[slot];
+        pthread_mutex_unlock(&reader.lock);
+        batch_chunk chunk = reader.chunks[slot];
+
+        items = realloc(items, (chunk.count ? chunk.count : 1) * sizeof(hmm_batch_item));
+        if (!items)
+        {
+            errx(EX_OSERR, "Not enough memory.");
+        }
+        for (size_t i = 0; i < chunk.count; i++)
+        {
+            batch_record *rec = &chunk.records[i];
+            rec->item.path = malloc((rec->item.obs.length ? rec->item.obs.length : 1) * sizeof(hmm_state));
+            if (!rec->item.path)
+            {
+                errx(EX_OSERR, "Not enough memory.");
+            }
+            // poisson tables are extended here, before the workers share the model
+            if (hmm_model_cache_obs(model, &rec->item.obs) != 0)
+            {
+                err(EX_OSERR, "hmm_model_cache_obs");
+            }
+            items[i] = rec->item;
+        }
+
+        hmm_viterbi_batch(model, items, chunk.count, threads, opts);
+
+        // output in input order, whatever order the workers finished in
+        for (size_t i = 0; i < chunk.count; i++)
+        {
+            batch_record *rec = &chunk.records[i];
+            if (items[i].status != 0)
+            {
+                errno = items[i].error;
+                err(EX_DATAERR, "%s", rec->name);
+            }
+            printf(">%s\n", rec->name);
+            print_states(items[i].path, items[i].obs.length, 1);
+
+            free(items[i].path);
+            free(rec->seq);
+            free(rec->name);
+            hmm_seqfile_close(&rec->file);
+        }
+
+        // the slot, whose record array read_chunk reuses, goes back to the reader
+        pthread_mutex_lock(&reader.lock);
+        reader.taken++;
+        pthread_cond_signal(&reader.drained);
+        pthread_mutex_unlock(&reader.lock);
+    }
+    while (more);
+
+    pthread_join(reader_tid, NULL);
+    pthread_cond_destroy(&reader.filled);
+    pthread_cond_destroy(&reader.drained);
+    pthread_mutex_destroy(&reader.lock);
+    free(items);
+    for (int k = 0; k < BATCH_AHEAD; k++)
+    {
+        free(reader.chunks[k].records);
+    }
+}
+
+
+int main (int argc, char *argv[])
+{
+    const char *model_name = "durbin";
+    hmm_viterbi_opts opts;
+    hmm_posterior_opts post_opts;
+    const hmm_posterior_opts *post = NULL;
+    int streaming = 0;
+    int batch = 0;
+    int threads = 0;
+    int readers = BATCH_LOADERS;
+    size_t lag = 0;
+    hmm_path_format format = HMM_PATH_LABELS;
+    int have_format = 0;
+    size_t tolerance = 0;
+    int opt;
+
+    hmm_viterbi_opts_init(&opts);
+    hmm_posterior_opts_init(&post_opts);
+    while ((opt = getopt(argc, argv, "m:c:psl:P:B:T:bj:L:D:r:fS:vo:t:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                model_name = optarg;
+                break;
+            case 'c':
+                opts.mode = HMM_VITERBI_CHECKPOINT;
+                opts.checkpoint = strtoul(optarg, NULL, 10);
+                post_opts.mode = HMM_POSTERIOR_CHECKPOINT;
+                post_opts.checkpoint = opts.checkpoint;
+                break;
+            case 'p':
+                opts.trace = HMM_TRACE_PACKED;
+                break;
+            case 's':
+                streaming = 1;
+                break;
+            case 'l':
+                lag = strtoul(optarg, NULL, 10);
+                break;
+            case 'P':
+                opts.mode = HMM_VITERBI_PARALLEL;
+                opts.chunk = strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                opts.mode = HMM_VITERBI_BEAM;
+                opts.beam_width = strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                opts.mode = HMM_VITERBI_BEAM;
+                opts.beam_threshold = strtod(optarg, NULL);
+                if (!(opts.beam_threshold >= 0))
+                {
+                    errx(EX_USAGE, "-T takes a log score margin of 0 or more");
+                }
+                break;
+            case 'b':
+                batch = 1;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                opts.threads = threads;
+                break;
+            case 'L':
+                opts.lanes = atoi(optarg);
+                if (opts.lanes != 1 && opts.lanes != 8 && opts.lanes != 16)
+                {
+                    errx(EX_USAGE, "-L takes 8, 16 or 1");
+                }
+                break;
+            case 'D':
+                if (strcmp(optarg, "cpu") == 0)
+                {
+                    opts.backend = HMM_BACKEND_CPU;
+                }
+                else if (strcmp(optarg, "cuda") == 0)
+                {
+                    opts.backend = HMM_BACKEND_CUDA;
+                }
+                else
+                {
+                    errx(EX_USAGE, "-D takes cpu or cuda");
+                }
+                break;
+            case 'r':
+                readers = atoi(optarg);
+                if (readers < 1)
+                {
+                    errx(EX_USAGE, "-r takes 1 or more readers");
+                }
+                break;
+            case 'f':
+                post = &post_opts;
+                break;
+            case 'S':
+                if (strcmp(optarg, "double") == 0)
+                {
+                    opts.score = HMM_SCORE_DOUBLE;
+                }
+                else if (strcmp(optarg, "float") == 0)
+                {
+                    opts.score = HMM_SCORE_FLOAT;
+                }
+                else if (strcmp(optarg, "fixed") == 0)
+                {
+                    opts.score = HMM_SCORE_FIXED;
+                }
+                else
+                {
+                    errx(EX_USAGE, "-S takes double, float or fixed");
+                }
+                break;
+            case 'v':
+                validate = 1;
+                break;
+            case 'o':
+                if (strcmp(optarg, "labels") == 0)
+                {
+                    format = HMM_PATH_LABELS;
+                }
+                else if (strcmp(optarg, "binary") == 0)
+                {
+                    format = HMM_PATH_BINARY;
+                }
+                else if (strcmp(optarg, "segments") == 0)
+                {
+                    format = HMM_PATH_SEGMENTS;
+                }
+                else
+                {
+                    errx(EX_USAGE, "-o takes labels, binary or segments");
+                }
+                have_format = 1;
+                break;
+            case 't':
+                truth_name = optarg;
+                break;
+            case 'w':
+                tolerance = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                errx(EX_USAGE, USAGE);
+        }
+    }
+    if (argc - optind > 1 || (post && (streaming || batch)) || (validate && (streaming || batch || post)))
+    {
+        errx(EX_USAGE, USAGE);
+    }
+    if (opts.score != HMM_SCORE_DOUBLE && (opts.mode != HMM_VITERBI_FULL || streaming || post))
+    {
+        errx(EX_USAGE, "float and fixed-point scores need full decoding, without -c, -P, -B, -T, -s or -f");
+    }
+    if (opts.mode == HMM_VITERBI_BEAM && (streaming || post))
+    {
+        errx(EX_USAGE, "-B and -T prune a Viterbi decode, without -s or -f");
+    }
+    if ((format != HMM_PATH_LABELS && post) || (format == HMM_PATH_BINARY && batch))
+    {
+        errx(EX_USAGE, "-o: posteriors are printed as text, and batch mode cannot print binary paths");
+    }
+    if (truth_name && (post || batch || have_format))
+    {
+        errx(EX_USAGE, "-t reports on a single Viterbi path, without -f, -b or -o");
+    }
+    if (opts.backend != HMM_BACKEND_CPU)
+    {
+        if (!batch || opts.mode != HMM_VITERBI_FULL || opts.score != HMM_SCORE_DOUBLE || post)
+        {
+            errx(EX_USAGE, "-D cuda decodes batches (-b) of full double precision paths only");
+        }
+        if (!hmm_backend_available(opts.backend))
+        {
+            errx(EX_UNAVAILABLE, "-D cuda: no CUDA device, or built without it");
+        }
+    }
+
+    hmm_modelfile loaded;
+    if (hmm_modelfile_load(model_name, &loaded) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: not a valid model file", model_name);
+        }
+        err(EX_NOINPUT, "Unknown model %s", model_name);
+    }
+    if (!loaded.info.labels)
+    {
+        errx(EX_DATAERR, "%s: a model with more than 62 states needs a labels line", model_name);
+    }
+    hmm_model *model = loaded.model;
+    example = &loaded.info;
+    if (model->emission == HMM_EMIT_GAUSSIAN && (streaming || batch))
+    {
+        errx(EX_USAGE, "%s: Gaussian models decode a whole sequence of real numbers, without -s or -b", model_name);
+    }
+    writer = hmm_path_writer_new(stdout, format, example->labels, model->n_states, 0);
+    if (!writer)
+    {
+        err(EX_OSERR, "hmm_path_writer_new");
+    }
+    if (truth_name)
+    {
+        truth_file = fopen(truth_name, "r");
+        if (!truth_file)
+        {
+            err(EX_NOINPUT, "%s", truth_name);
+        }
+        accuracy = hmm_accuracy_new(model->n_states, tolerance);
+        if (!accuracy)
+        {
+            err(EX_OSERR, "hmm_accuracy_new");
+        }
+        accuracy_states = model->n_states;
+    }
+
+    const char *name = "stdin";
+    FILE *f = stdin;
+    if (optind < argc && strcmp(argv[optind], "-") != 0)
+    {
+        name = argv[optind];
+        if (!streaming && !batch && model->emission != HMM_EMIT_GAUSSIAN && hmm_seqfile_is_binary(name) == 1)
+        {
+            decode_mapped(model, name, &opts, post);
+            if (accuracy)
+            {
+                report_accuracy();
+            }
+            hmm_path_writer_free(writer);
+            hmm_modelfile_close(&loaded);
+            HMM_STATS_REPORT(getenv("HMM_STATS_FILE"));
+            return 0;
+        }
+        f = fopen(name, "r");
+        if (!f)
+        {
+            err(EX_NOINPUT, "%s", name);
+        }
+    }
+    hmm_input input;
+    if (hmm_input_open(fileno(f), threads, &input) != 0)
+    {
+        if (errno == ENOTSUP)
+        {
+            errx(EX_DATAERR, "%s: compressed in a format this build cannot read", name);
+        }
+        err(EX_IOERR, "%s", name);
+    }
+    // the decompressed contents, on a descriptor of its own for hmm_input_close to close
+    FILE *in = f;
+    if (input.worker && !(in = fdopen(dup(input.fd), "r")))
+    {
+        err(EX_OSERR, "%s", name);
+    }
+
+    if (batch)
+    {
+        decode_batch(model, in, name, threads, readers, &opts);
+    }
+    else if (streaming)
+    {
+        decode_stream(model, in, name, lag);
+    }
+    else
+    {
+        decode_whole(model, &input, name, &opts, post);
+    }
+
+    if (in != f)
+    {
+        fclose(in);
+    }
+    close_input(&input, name);
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+    if (accuracy)
+    {
+        report_accuracy();
+    }
+    hmm_path_writer_free(writer);
+    hmm_modelfile_close(&loaded);
+    HMM_STATS_REPORT(getenv("HMM_STATS_FILE"));
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * Converts between the text and binary model file formats of ../hmm/model_file.c. The input is a model file of
+ * either form or the name of a built-in model, so e.g. "./hmm_modelconv durbin durbin.hmm" exports the casino
+ * model for editing. Binary files load without parsing; text files are for people.
+ *
+ * Usage: ./hmm_modelconv [-b] model out_file
+ *   -b   write the binary form instead of text
+ *
+ * Build by compiling hmm_modelconv.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o hmm_modelconv hmm_modelconv.c ../hmm/[a-z]*.c -lm -pthread
+ *
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "../hmm/hmm.h"
+
+#define USAGE "Usage: ./hmm_modelconv [-b] model out_file"
+
+
+int main (int argc, char *argv[])
+{
+    int binary = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                binary = 1;
+                break;
+            default:
+                errx(EX_USAGE, USAGE);
+        }
+    }
+    if (argc - optind != 2)
+    {
+        errx(EX_USAGE, USAGE);
+    }
+
+    hmm_modelfile loaded;
+    if (hmm_modelfile_load(argv[optind], &loaded) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: not a valid model file", argv[optind]);
+        }
+        err(EX_NOINPUT, "Unknown model %s", argv[optind]);
+    }
+
+    const char *out = argv[optind + 1];
+    int rc = binary ? hmm_modelfile_write_binary(out, loaded.model, &loaded.info)
+                    : hmm_modelfile_write(out, loaded.model, &loaded.info);
+    if (rc != 0)
+    {
+        err(EX_CANTCREAT, "%s", out);
+    }
+    hmm_modelfile_close(&loaded);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * Converts a text sequence file (one entry per line, as read by the example programs) into the binary sequence
+ * format of ../hmm/seqfile.c, which hmm_decode maps into memory instead of parsing.
+ *
+ * Symbols are stored zero-based: -b gives the value that stands for symbol 0, e.g. 1 for the die rolls of
+ * durbin_seq.txt. Counts up to 255 take one byte per symbol, larger alphabets two.
+ *
+ * Usage: ./hmm_seqconv [-b base] my_sequence_file.txt my_sequence_file.hseq
+ *
+ * Build by compiling hmm_seqconv.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o hmm_seqconv hmm_seqconv.c ../hmm/[a-z]*.c -lm -pthread
+ *
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "../hmm/hmm.h"
+
+
+int main (int argc, char *argv[])
+{
+    int base = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                base = atoi(optarg);
+                break;
+            default:
+                errx(EX_USAGE, "Usage: ./hmm_seqconv [-b base] my_sequence_file.txt my_sequence_file.hseq");
+        }
+    }
+    if (argc - optind != 2)
+    {
+        errx(EX_USAGE, "Usage: ./hmm_seqconv [-b base] my_sequence_file.txt my_sequence_file.hseq");
+    }
+
+    int *seq;
+    size_t n;
+    if (hmm_read_sequence(argv[optind], base, &seq, &n) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: expected one non-negative integer per line", argv[optind]);
+        }
+        err(EX_NOINPUT, "%s", argv[optind]);
+    }
+
+    if (hmm_seqfile_write(argv[optind + 1], seq, n) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: symbols must lie between %d and %d", argv[optind], base, base + UINT16_MAX);
+        }
+        err(EX_CANTCREAT, "%s", argv[optind + 1]);
+    }
+    free(seq);
+    return 0;
+}
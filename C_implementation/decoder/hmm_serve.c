@@ -0,0 +1,610 @@
+/**
+ * Decode server: loads its models once and decodes requests arriving on a Unix domain socket, so that small
+ * requests pay neither process startup nor model setup.
+ *
+ * Every -m model is loaded at startup and named in requests by that argument. Requests to one model from all
+ * connections are queued together and decoded as one batch (hmm_viterbi_batch, in SIMD lanes for small models):
+ * a batch is taken once -n requests are waiting, or once the most urgent waiting request has waited for its
+ * latency target, so that under load many requests share a batch and when idle none waits longer than asked.
+ * The waiting requests of a model are kept in a binary heap on the time they are due, so a batch takes the most
+ * urgent ones and neither queueing nor taking a request costs more than O(log depth). Paths are those of
+ * hmm_decode -b.
+ *
+ * Each model's batches are decoded by its own dispatcher on its own worker threads, so -j is split evenly among
+ * the models rather than given to each, which would have them oversubscribe the cores together. A model without
+ * requests leaves its share idle; with more models than threads each still gets one.
+ *
+ * The protocol is one line per request and one line per reply, replies in request order on each connection:
+ *
+ *   decode MODEL TARGET_MS SYMBOL ...   ok LOG_PROB LABELS, the path as one label character per position.
+ *                                       TARGET_MS is how long the request may wait for others to batch with,
+ *                                       0 for the -t default; SYMBOLs are as in the model's sequence files
+ *   stats                               ok followed by a JSON object: uptime and, for each model, the queue
+ *                                       depth, requests, batches, symbols, mean batch size, mean and largest
+ *                                       latency from arrival to reply in milliseconds, and requests and symbols per
+ *                                       second since the start
+ *   models                              ok followed by the model names
+ *
+ * Anything that fails is answered with "error" and a message, e.g. when the queue of a model already holds -q
+ * requests. Symbol and count models only: Gaussian models are refused at startup.
+ *
+ * Usage: ./hmm_serve [-m model ...] [-j threads] [-L lanes] [-n batch] [-t target_ms] [-q queue] socket_path
+ *   -m model      a model to serve, durbin, poisson or a model file; may be repeated, default durbin
+ *   -j threads    worker threads in all, split among the models, default one per online CPU
+ *   -L lanes      requests decoded together within a batch: 8 (default), 16, or 1 for one at a time
+ *   -n batch      most requests decoded as one batch, default 256
+ *   -t target_ms  latency target of requests that give none, default 2
+ *   -q queue      most requests waiting for one model before new ones are refused, default 65536
+ *
+ * e.g. printf 'decode durbin 0 1 6 6 6 2\n' | socat - UNIX-CONNECT:/tmp/hmm.sock
+ *
+ * Build by compiling hmm_serve.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o hmm_serve hmm_serve.c ../hmm/[a-z]*.c -lm -pthread
+ *
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../hmm/hmm.h"
+
+#define USAGE "Usage: ./hmm_serve [-m model ...] [-j threads] [-L lanes] [-n batch] [-t target_ms] [-q queue] " \
+              "socket_path"
+
+
+// one decode request, on the stack of its connection's thread until it is done
+typedef struct serve_request
+{
+    hmm_batch_item item;
+    double arrival;
+    double due;             // when the request stops waiting for others to batch with
+    uint64_t order;         // arrival number, taking requests due at the same time first come first served
+    int done;
+} serve_request;
+
+// a served model with its queue and totals, all under lock
+typedef struct
+{
+    const char *name;
+    hmm_modelfile loaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    pthread_cond_t decoded;
+    int threads;            // share of -j
+    serve_request **heap;   // waiting requests, a binary heap on due time
+    size_t depth;
+    size_t cap;
+    uint64_t arrivals;
+    uint64_t requests;
+    uint64_t batches;
+    uint64_t symbols;
+    double latency_sum;
+    double latency_max;
+} serve_model;
+
+static serve_model *models;
+static int n_models;
+static hmm_viterbi_opts opts;
+static size_t max_batch = 256;
+static size_t max_queue = 65536;
+static double default_target = 0.002;
+static double started;
+
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// whether a is taken before b: the one due first, or the one that arrived first
+static int before(const serve_request *a, const serve_request *b)
+{
+    return a->due < b->due || (a->due == b->due && a->order < b->order);
+}
+
+// adds r to the waiting requests of m; -1 if the heap cannot grow
+static int queue_push(serve_model *m, serve_request *r)
+{
+    if (m->depth == m->cap)
+    {
+        size_t cap = m->cap ? 2 * m->cap : 256;
+        serve_request **heap = realloc(m->heap, cap * sizeof(serve_request *));
+        if (!heap)
+        {
+            return -1;
+        }
+        m->heap = heap;
+        m->cap = cap;
+    }
+    r->order = m->arrivals++;
+    size_t i = m->depth++;
+    while (i > 0 && before(r, m->heap[(i - 1) / 2]))
+    {
+        m->heap[i] = m->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    m->heap[i] = r;
+    return 0;
+}
+
+// removes the most urgent waiting request of m, which has some
+static serve_request *queue_pop(serve_model *m)
+{
+    serve_request *top = m->heap[0];
+    serve_request *last = m->heap[--m->depth];
+    size_t i = 0;
+    for (size_t child; (child = 2 * i + 1) < m->depth; i = child)
+    {
+        if (child + 1 < m->depth && before(m->heap[child + 1], m->heap[child]))
+        {
+            child++;
+        }
+        if (!before(m->heap[child], last))
+        {
+            break;
+        }
+        m->heap[i] = m->heap[child];
+    }
+    m->heap[i] = last;
+    return top;
+}
+
+// the queued requests of m as batches, the most urgent first
+static void *dispatch_thread(void *arg)
+{
+    serve_model *m = arg;
+    serve_request **batch = malloc(max_batch * sizeof(serve_request *));
+    hmm_batch_item *items = malloc(max_batch * sizeof(hmm_batch_item));
+    if (!batch || !items)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&m->lock);
+        // until a batch is full or its most urgent request is due
+        while (m->depth < max_batch)
+        {
+            if (m->depth == 0)
+            {
+                pthread_cond_wait(&m->arrived, &m->lock);
+                continue;
+            }
+            double due = m->heap[0]->due;
+            if (now() >= due)
+            {
+                break;
+            }
+            struct timespec until = { (time_t) due, (long) ((due - (time_t) due) * 1e9) };
+            pthread_cond_timedwait(&m->arrived, &m->lock, &until);
+        }
+        size_t count = 0;
+        while (m->depth > 0 && count < max_batch)
+        {
+            batch[count++] = queue_pop(m);
+        }
+        pthread_mutex_unlock(&m->lock);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            // poisson tables are extended here, before the workers share the model
+            if (hmm_model_cache_obs(m->loaded.model, &batch[i]->item.obs) != 0)
+            {
+                err(EX_OSERR, "hmm_model_cache_obs");
+            }
+            items[i] = batch[i]->item;
+        }
+        hmm_viterbi_batch(m->loaded.model, items, count, m->threads, &opts);
+
+        double finished = now();
+        pthread_mutex_lock(&m->lock);
+        m->batches++;
+        for (size_t i = 0; i < count; i++)
+        {
+            serve_request *r = batch[i];
+            double latency = finished - r->arrival;
+            r->item = items[i];
+            r->done = 1;
+            m->requests++;
+            m->symbols += r->item.obs.length;
+            m->latency_sum += latency;
+            m->latency_max = latency > m->latency_max ? latency : m->latency_max;
+        }
+        pthread_cond_broadcast(&m->decoded);
+        pthread_mutex_unlock(&m->lock);
+    }
+    return NULL;
+}
+
+
+static void print_stats(FILE *out)
+{
+    double uptime = now() - started;
+    fprintf(out, "ok {\"uptime_s\": %.3f, \"models\": [", uptime);
+    for (int k = 0; k < n_models; k++)
+    {
+        serve_model *m = &models[k];
+        pthread_mutex_lock(&m->lock);
+        fprintf(out, "%s{\"name\": \"%s\", \"queue_depth\": %zu, \"requests\": %llu, \"batches\": %llu, "
+                "\"symbols\": %llu, \"mean_batch\": %.2f, \"latency_mean_ms\": %.3f, \"latency_max_ms\": %.3f, "
+                "\"requests_per_s\": %.1f, \"symbols_per_s\": %.1f}", k ? ", " : "", m->name, m->depth,
+                (unsigned long long) m->requests, (unsigned long long) m->batches,
+                (unsigned long long) m->symbols, m->batches ? (double) m->requests / m->batches : 0,
+                m->requests ? 1e3 * m->latency_sum / m->requests : 0, 1e3 * m->latency_max,
+                m->requests / uptime, m->symbols / uptime);
+        pthread_mutex_unlock(&m->lock);
+    }
+    fprintf(out, "]}\n");
+}
+
+// per connection buffers for the symbols and path of its current request
+typedef struct
+{
+    int *seq;
+    hmm_state *path;
+    size_t cap;
+} serve_buffers;
+
+static void decode_request(char *args, FILE *out, serve_buffers *buf)
+{
+    char *save;
+    char *name = strtok_r(args, " \t", &save);
+    char *target = strtok_r(NULL, " \t", &save);
+    serve_model *m = NULL;
+    for (int k = 0; name && k < n_models; k++)
+    {
+        if (strcmp(models[k].name, name) == 0)
+        {
+            m = &models[k];
+        }
+    }
+    if (!m)
+    {
+        fprintf(out, "error unknown model\n");
+        return;
+    }
+    char *stop;
+    double target_ms = target ? strtod(target, &stop) : -1;
+    if (!target || *stop || !(target_ms >= 0))
+    {
+        fprintf(out, "error expected a latency target of 0 or more milliseconds\n");
+        return;
+    }
+
+    size_t n = 0;
+    int base = m->loaded.info.symbol_base;
+    for (char *tok; (tok = strtok_r(NULL, " \t", &save)); )
+    {
+        long value = strtol(tok, &stop, 10);
+        if (*stop || value < base || value > 0x7fffffff)
+        {
+            fprintf(out, "error symbol out of range: %s\n", tok);
+            return;
+        }
+        if (n == buf->cap)
+        {
+            size_t cap = buf->cap ? 2 * buf->cap : 1024;
+            int *seq = realloc(buf->seq, cap * sizeof(int));
+            hmm_state *path = seq ? realloc(buf->path, cap * sizeof(hmm_state)) : NULL;
+            buf->seq = seq ? seq : buf->seq;
+            buf->path = path ? path : buf->path;
+            if (!seq || !path)
+            {
+                fprintf(out, "error %s\n", strerror(ENOMEM));
+                return;
+            }
+            buf->cap = cap;
+        }
+        buf->seq[n++] = (int) value - base;
+    }
+    if (n == 0)
+    {
+        fprintf(out, "error empty sequence\n");
+        return;
+    }
+
+    serve_request r;
+    memset(&r, 0, sizeof(r));
+    r.item.obs.type = HMM_OBS_INT;
+    r.item.obs.length = n;
+    r.item.obs.data = buf->seq;
+    r.item.path = buf->path;
+    r.arrival = now();
+    r.due = r.arrival + (target_ms > 0 ? target_ms * 1e-3 : default_target);
+
+    pthread_mutex_lock(&m->lock);
+    if (m->depth >= max_queue)
+    {
+        pthread_mutex_unlock(&m->lock);
+        fprintf(out, "error queue full\n");
+        return;
+    }
+    if (queue_push(m, &r) != 0)
+    {
+        pthread_mutex_unlock(&m->lock);
+        fprintf(out, "error %s\n", strerror(ENOMEM));
+        return;
+    }
+    pthread_cond_signal(&m->arrived);
+    while (!r.done)
+    {
+        pthread_cond_wait(&m->decoded, &m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    if (r.item.status != 0)
+    {
+        fprintf(out, "error %s\n", strerror(r.item.error));
+        return;
+    }
+    fprintf(out, "ok %.17g ", r.item.log_prob);
+    const char *labels = m->loaded.info.labels;
+    for (size_t t = 0; t < n; t++)
+    {
+        putc(labels[buf->path[t]], out);
+    }
+    putc('\n', out);
+}
+
+static void *connection_thread(void *arg)
+{
+    int fd = (int) (intptr_t) arg;
+    int out_fd = dup(fd);
+    FILE *in = fdopen(fd, "r");
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (!in || !out)
+    {
+        warn("connection");
+        if (in)
+        {
+            fclose(in);
+        }
+        else
+        {
+            close(fd);
+        }
+        if (out)
+        {
+            fclose(out);
+        }
+        else if (out_fd >= 0)
+        {
+            close(out_fd);
+        }
+        return NULL;
+    }
+
+    serve_buffers buf = { NULL, NULL, 0 };
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, in)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+        char *save;
+        char *command = strtok_r(line, " \t", &save);
+        char *args = strtok_r(NULL, "", &save);
+        if (!command)
+        {
+            continue;
+        }
+        if (strcmp(command, "decode") == 0)
+        {
+            decode_request(args ? args : "", out, &buf);
+        }
+        else if (strcmp(command, "stats") == 0)
+        {
+            print_stats(out);
+        }
+        else if (strcmp(command, "models") == 0)
+        {
+            fprintf(out, "ok");
+            for (int k = 0; k < n_models; k++)
+            {
+                fprintf(out, " %s", models[k].name);
+            }
+            fprintf(out, "\n");
+        }
+        else
+        {
+            fprintf(out, "error unknown request\n");
+        }
+        if (fflush(out) != 0)
+        {
+            break;
+        }
+    }
+
+    free(line);
+    free(buf.seq);
+    free(buf.path);
+    fclose(in);
+    fclose(out);
+    return NULL;
+}
+
+
+int main (int argc, char *argv[])
+{
+    const char *names[argc];
+    int threads = 0;
+    int opt;
+
+    hmm_viterbi_opts_init(&opts);
+    while ((opt = getopt(argc, argv, "m:j:L:n:t:q:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                names[n_models++] = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'L':
+                opts.lanes = atoi(optarg);
+                if (opts.lanes != 1 && opts.lanes != 8 && opts.lanes != 16)
+                {
+                    errx(EX_USAGE, "-L takes 8, 16 or 1");
+                }
+                break;
+            case 'n':
+                max_batch = strtoul(optarg, NULL, 10);
+                if (max_batch == 0)
+                {
+                    errx(EX_USAGE, "-n takes 1 or more requests");
+                }
+                break;
+            case 't':
+                default_target = strtod(optarg, NULL) * 1e-3;
+                if (!(default_target >= 0))
+                {
+                    errx(EX_USAGE, "-t takes 0 or more milliseconds");
+                }
+                break;
+            case 'q':
+                max_queue = strtoul(optarg, NULL, 10);
+                if (max_queue == 0)
+                {
+                    errx(EX_USAGE, "-q takes 1 or more requests");
+                }
+                break;
+            default:
+                errx(EX_USAGE, USAGE);
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        errx(EX_USAGE, USAGE);
+    }
+    const char *socket_path = argv[optind];
+    if (n_models == 0)
+    {
+        names[n_models++] = "durbin";
+    }
+
+    models = calloc(n_models, sizeof(serve_model));
+    if (!models)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    for (int k = 0; k < n_models; k++)
+    {
+        serve_model *m = &models[k];
+        m->name = names[k];
+        if (hmm_modelfile_load(m->name, &m->loaded) != 0)
+        {
+            if (errno == EINVAL)
+            {
+                errx(EX_DATAERR, "%s: not a valid model file", m->name);
+            }
+            err(EX_NOINPUT, "Unknown model %s", m->name);
+        }
+        if (!m->loaded.info.labels)
+        {
+            errx(EX_DATAERR, "%s: a model with more than 62 states needs a labels line", m->name);
+        }
+        if (m->loaded.model->emission == HMM_EMIT_GAUSSIAN)
+        {
+            errx(EX_DATAERR, "%s: only symbol and count models are served", m->name);
+        }
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        errx(EX_USAGE, "%s: socket path too long", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+    // a socket left behind by an earlier server, never any other file
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(socket_path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, SOMAXCONN))
+    {
+        err(EX_OSERR, "%s", socket_path);
+    }
+    // a client gone before its reply fails that write, not the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // -j in all, the first threads % n_models models taking one more
+    if (threads <= 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int) online : 1;
+    }
+    for (int k = 0; k < n_models; k++)
+    {
+        models[k].threads = threads / n_models + (k < threads % n_models);
+        models[k].threads = models[k].threads > 0 ? models[k].threads : 1;
+    }
+
+    started = now();
+    pthread_condattr_t monotonic;
+    pthread_condattr_init(&monotonic);
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+    for (int k = 0; k < n_models; k++)
+    {
+        serve_model *m = &models[k];
+        pthread_mutex_init(&m->lock, NULL);
+        pthread_cond_init(&m->arrived, &monotonic);
+        pthread_cond_init(&m->decoded, NULL);
+        if (pthread_create(&m->thread, NULL, dispatch_thread, m) != 0)
+        {
+            errx(EX_OSERR, "Cannot start the dispatcher of %s.", m->name);
+        }
+    }
+    pthread_condattr_destroy(&monotonic);
+
+    for (;;)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            // out of descriptors or memory: the connections being served will free some
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                warn("accept");
+                usleep(100000);
+                continue;
+            }
+            err(EX_OSERR, "accept");
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, connection_thread, (void *) (intptr_t) fd) != 0)
+        {
+            warnx("Cannot start a connection thread.");
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
@@ -0,0 +1,177 @@
+/**
+ * Fits the parameters of a model to a set of training sequences and writes the result as a model file
+ * (format in ../hmm/model_file.c), which hmm_decode -m reads.
+ *
+ * Training starts from the model given by -m, a built-in model or a model file, and keeps its number of
+ * states, emission type, symbol base and labels. Every file named on the command line is one training
+ * sequence, in the text format of the example programs or the binary format of hmm_seqconv. The E-step runs
+ * over the sequences on -j threads; the fitted model does not depend on the thread count.
+ *
+ * Usage: ./hmm_train [-m model] [-V] [-i iterations] [-t tolerance] [-a pseudocount] [-c interval] [-j threads]
+ *                    [-o model_file] my_sequence_file.txt ...
+ *   -m model        starting model, durbin (default), poisson or a model file
+ *   -V              Viterbi training (hard counts along the best path) instead of Baum-Welch
+ *   -i iterations   most parameter updates, default 100
+ *   -t tolerance    stop once an update improves the log-likelihood by less than this fraction, default 1e-8
+ *   -a pseudocount  added to every count, keeping unseen transitions and symbols possible
+ *   -c interval     Baum-Welch in bounded memory, a backward column every interval positions, 0 for sqrt(n)
+ *   -j threads      worker threads, default one per online CPU
+ *   -o model_file   where to write the fitted model, default standard output
+ *
+ * Build by compiling hmm_train.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o hmm_train hmm_train.c ../hmm/[a-z]*.c -lm -pthread
+ *
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "../hmm/hmm.h"
+
+#define USAGE "Usage: ./hmm_train [-m model] [-V] [-i iterations] [-t tolerance] [-a pseudocount] [-c interval] " \
+              "[-j threads] [-o model_file] my_sequence_file.txt ..."
+
+
+// one training sequence, parsed into seq or mapped into file
+typedef struct
+{
+    int *seq;
+    hmm_seqfile file;
+    hmm_obs obs;
+} train_sequence;
+
+static void load_sequence(const char *name, int base, train_sequence *s)
+{
+    memset(s, 0, sizeof(*s));
+    if (hmm_seqfile_is_binary(name) == 1)
+    {
+        if (hmm_seqfile_open(name, &s->file) != 0)
+        {
+            if (errno == EINVAL)
+            {
+                errx(EX_DATAERR, "%s: damaged binary sequence file", name);
+            }
+            err(EX_NOINPUT, "%s", name);
+        }
+        s->obs = s->file.obs;
+        return;
+    }
+
+    size_t n;
+    if (hmm_read_sequence(name, base, &s->seq, &n) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: expected one non-negative integer per line", name);
+        }
+        err(EX_NOINPUT, "%s", name);
+    }
+    s->obs.type = HMM_OBS_INT;
+    s->obs.length = n;
+    s->obs.data = s->seq;
+}
+
+
+int main (int argc, char *argv[])
+{
+    const char *model_name = "durbin";
+    const char *out_name = NULL;
+    hmm_train_opts opts;
+    int opt;
+
+    hmm_train_opts_init(&opts);
+    while ((opt = getopt(argc, argv, "m:Vi:t:a:c:j:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                model_name = optarg;
+                break;
+            case 'V':
+                opts.method = HMM_TRAIN_VITERBI;
+                break;
+            case 'i':
+                opts.max_iterations = atoi(optarg);
+                break;
+            case 't':
+                opts.tolerance = strtod(optarg, NULL);
+                break;
+            case 'a':
+                opts.pseudocount = strtod(optarg, NULL);
+                break;
+            case 'c':
+                opts.posterior.mode = HMM_POSTERIOR_CHECKPOINT;
+                opts.posterior.checkpoint = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                opts.threads = atoi(optarg);
+                break;
+            case 'o':
+                out_name = optarg;
+                break;
+            default:
+                errx(EX_USAGE, USAGE);
+        }
+    }
+    if (optind == argc)
+    {
+        errx(EX_USAGE, USAGE);
+    }
+
+    hmm_modelfile loaded;
+    if (hmm_modelfile_load(model_name, &loaded) != 0)
+    {
+        if (errno == EINVAL)
+        {
+            errx(EX_DATAERR, "%s: not a valid model file", model_name);
+        }
+        err(EX_NOINPUT, "Unknown model %s", model_name);
+    }
+
+    size_t count = argc - optind;
+    train_sequence *seqs = calloc(count, sizeof(train_sequence));
+    hmm_obs *obs = calloc(count, sizeof(hmm_obs));
+    if (!seqs || !obs)
+    {
+        errx(EX_OSERR, "Not enough memory.");
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        load_sequence(argv[optind + i], loaded.info.symbol_base, &seqs[i]);
+        obs[i] = seqs[i].obs;
+    }
+
+    hmm_train_result result;
+    if (hmm_train(loaded.model, obs, count, &opts, &result) != 0)
+    {
+        if (errno == EINVAL || errno == EDOM)
+        {
+            errx(EX_DATAERR, "training failed: a sequence holds symbols the model cannot emit");
+        }
+        err(EX_SOFTWARE, "hmm_train");
+    }
+    fprintf(stderr, "%d updates, log-likelihood %.6f\n", result.iterations, result.log_like);
+
+    int rc = out_name ? hmm_modelfile_write(out_name, loaded.model, &loaded.info)
+                      : hmm_modelfile_print(stdout, loaded.model, &loaded.info);
+    if (rc != 0)
+    {
+        err(EX_CANTCREAT, "%s", out_name ? out_name : "stdout");
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(seqs[i].seq);
+        hmm_seqfile_close(&seqs[i].file);
+    }
+    free(seqs);
+    free(obs);
+    hmm_modelfile_close(&loaded);
+    HMM_STATS_REPORT(getenv("HMM_STATS_FILE"));
+    return 0;
+}
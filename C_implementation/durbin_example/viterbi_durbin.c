@@ -10,7 +10,13 @@
  * Optional argument to read in file of known states for comparison with algorithm's output. 
  * Sequence file and state files are is assumed to be one entry per line (see .txt files for example).
  * 
- * Usage: ./viterbi my_sequence_file.txt [my_state_file.txt]
+ * The casino model is built in; -m replaces it with another built-in model or a model file (see ../hmm/model_file.c),
+ * including its start distribution, without a rebuild.
+ *
+ * Usage: ./viterbi [-m model] my_sequence_file.txt [my_state_file.txt]
+ *
+ * Decoding is done by the generic engine in ../hmm. Build by compiling viterbi_durbin.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o viterbi viterbi_durbin.c ../hmm/[a-z]*.c -lm -pthread
  *
 **/
 
@@ -19,71 +25,37 @@
 #include <math.h>
 #include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <limits.h>
 #include <sysexits.h>
+#include <unistd.h>
+
+#include "../hmm/hmm.h"
 
 int sequence_length = 0;
 int* sequence;
 int* states;
-
-
-static double max (double a, double b)
-{
-    if (a > b)
-    {
-        return a;
-    }
-    // if equal, returns arbitrary argument for specific use in this algorithm
-    else
-    {
-        return b;
-    }
-}
-
-static int argmax (double row0, double row1)
-{
-    if (row0 > row1)
-    {
-        return 0;
-    }
-    else
-    {
-        return 1;
-    }
-}
+hmm_modelfile loaded;
 
 
 static int* read_sequencefile(const char* sequence_file, int* out_n)
 {
-    FILE *seqf = fopen(sequence_file, "r");
-    if (!seqf)
-    {
-        err(EX_NOINPUT, "%s", sequence_file);
-    }
-    
-    int num;
-    int n = 0;
-    sequence = malloc(sizeof(int));
-    
-    while(fscanf(seqf, "%i", &num) == 1)
+    // die rolls 1 thru 6 become symbols 0 thru 5 (the model's symbol base)
+    size_t n;
+    if (hmm_read_sequence(sequence_file, loaded.info.symbol_base, &sequence, &n) != 0)
     {
-        sequence[n] = num - 1;
-        n++;
-        sequence = realloc(sequence, (n + 1) * sizeof(int));
-        
-        if(!sequence)
+        if (errno == ENOENT || errno == EACCES)
         {
-            goto SEQ_CLEANUP;
+            err(EX_NOINPUT, "%s", sequence_file);
         }
+        err(EX_DATAERR, "%s", sequence_file);
+    }
+    if (n > INT_MAX)
+    {
+        errx(EX_DATAERR, "%s: sequence too long", sequence_file);
     }
-    fclose(seqf);
     *out_n = n;
     return sequence;
-    
-    
-    SEQ_CLEANUP:
-        fclose(seqf);
-        free(sequence);
-        errx(EX_OSERR, "Not enough memory.");
 }
 
 
@@ -130,133 +102,66 @@ static void read_statefile(const char* state_file)
 
 static void run_viterbi(int* seq, int seq_length)
 {
-    // state transition matrix in log space
-    double a[2][2] = {
-        { log(0.95),  log(0.05) },
-        { log(0.1),  log(0.9) }
-    };
-    
-    // emission probabilities, corresponding to p of rolling 1 thru 6 on fair or loaded die
-    double e[6][2] = {
-        { log( ((double) 1)/6),  log(0.1) },
-        { log( ((double) 1)/6),  log(0.1) },
-        { log( ((double) 1)/6),  log(0.1) },
-        { log( ((double) 1)/6),  log(0.1) },
-        { log( ((double) 1)/6),  log(0.1) },
-        { log( ((double) 1)/6),  log(0.5) },
-    };
+    // transition and emission tables of the casino live in ../hmm/example_models.c, unless -m gave others
+    hmm_model *model = loaded.model;
     
-    // allocate rest of memory and error handle
-    int *path = malloc(seq_length * sizeof(path));
-    double **vprob = malloc(seq_length * sizeof(*vprob));
-    double **ptr = malloc(seq_length * sizeof(*ptr));
-    double **pi = malloc(seq_length * sizeof(*pi));
-    
-    if( !path || !vprob || !ptr || !pi )
-        {
-            goto VITERBI_CLEANUP_1;
-        }
-    
-    for (int i = 0; i < 2; i++)
+    hmm_state *path = malloc(seq_length * sizeof(*path));
+    if (!path)
     {
-        vprob[i] = malloc(seq_length * sizeof(double));
-        ptr[i] = malloc(seq_length * sizeof(double));
-        pi[i] = malloc(seq_length * sizeof(double));
-        
-        if( !vprob[i] || !ptr[i] || !pi[i] )
-        {
-            goto VITERBI_CLEANUP_2;
-        }
+        errx(EX_OSERR, "Not enough memory.");
     }
-
-    // initialize vprob array; assumed starting state is state F
-    vprob[0][0] = 1;
-    vprob[1][0] = 0;
-    double row0;
-    double row1;
     
     // viterbi algorithm in log space to avoid underflow
-    for (int i = 1; i < seq_length; i++)
+    if (hmm_viterbi(model, seq, seq_length, path, NULL, NULL) != 0)
     {
-        for (int j = 0; j < 2; j++)
-        {
-            row0 = (vprob[0][i - 1] + a[0][j]);
-            row1 = (vprob[1][i - 1] + a[1][j]);
-            
-            vprob[j][i] = e[seq[i]][j] + max( row0, row1 );
-            ptr[j][i] = argmax( row0, row1 );
-            pi[j][i] = max( row0 , row1 );
-        }
+        err(EX_DATAERR, "viterbi");
     }
     free(sequence);
-    
-    // traceback to find most likely path
-    path[seq_length - 1] = argmax( pi[0][seq_length - 1], pi[1][seq_length - 1] );
-    for (int i = seq_length - 2; i > 0; i--)
-    {
-        path[i] = ptr[path[i + 1]][i + 1];
-    }
-
-    // free remaining memory
-    for (int i = 0; i < 2; i++)
-    {
-        free(vprob[i]);
-        free(ptr[i]);
-        free(pi[i]);
-    }
-    free(vprob);
-    free(ptr);
-    free(pi);
 
     // print viterbi result
+    HMM_STATS_START(mark);
     printf("Viterbi output:\n");
-    for (int i = 0; i < seq_length; i++)
-    {   
-        if (i % 60 == 0 && i != 0)
-        {
-            printf("\n");
-        }
-        
-        if (path[i] == 0)
-        {
-            printf("F");
-        }
-        if (path[i] == 1)
-        {
-            printf("L");
-        }
+    
+    // F and L for the casino, 60 to a line
+    hmm_path_writer *out = hmm_path_writer_new(stdout, HMM_PATH_LABELS, loaded.info.labels, model->n_states, 60);
+    if (!out || hmm_path_write(out, path, seq_length) != 0 || hmm_path_end(out) != 0)
+    {
+        err(EX_IOERR, "stdout");
     }
-    printf("\n");
+    hmm_path_writer_free(out);
+    HMM_STATS_STOP(HMM_PHASE_OUTPUT, mark, seq_length + seq_length / 60, seq_length);
     free(path);
-    return;
-    
-    
-    VITERBI_CLEANUP_1:
-        free(vprob);
-        free(ptr);
-        free(pi);
-        errx(EX_OSERR, "Not enough memory.");
-        
-    VITERBI_CLEANUP_2:
-        for (int i = 0; i < 2; i++)
-        {
-            free(vprob[i]);
-            free(ptr[i]);
-            free(pi[i]);
-        }
-        free(vprob);
-        free(ptr);
-        free(pi);
-        errx(EX_OSERR, "Not enough memory.");
 }
 
 
 int main (int argc, char *argv[]) 
 {
+    const char *model_name = "durbin";
+    int opt;
+    while ((opt = getopt(argc, argv, "m:")) != -1)
+    {
+        if (opt != 'm')
+        {
+            errx(EX_USAGE, "Usage: ./viterbi [-m model] my_sequence_file.txt [my_state_file.txt]. Include at least sequence file.");
+        }
+        model_name = optarg;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     // check for correct number of command line args
     if (argc != 2 && argc != 3)
     {
-        errx(EX_USAGE, "Usage: ./viterbi my_sequence_file.txt [my_state_file.txt]. Include at least sequence file.");
+        errx(EX_USAGE, "Usage: ./viterbi [-m model] my_sequence_file.txt [my_state_file.txt]. Include at least sequence file.");
+    }
+
+    if (hmm_modelfile_load(model_name, &loaded) != 0)
+    {
+        err(errno == EINVAL ? EX_DATAERR : EX_NOINPUT, "%s", model_name);
+    }
+    if (!loaded.info.labels)
+    {
+        errx(EX_DATAERR, "%s: a model with more than 62 states needs a labels line", model_name);
     }
     
     read_sequencefile(argv[1], &sequence_length);
@@ -267,6 +172,8 @@ int main (int argc, char *argv[])
     }
     
     run_viterbi(sequence, sequence_length);
+    hmm_modelfile_close(&loaded);
 
+    HMM_STATS_REPORT(getenv("HMM_STATS_FILE"));
     return 0;
 }
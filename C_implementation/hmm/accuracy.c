@@ -0,0 +1,367 @@
+/**
+ * Accuracy of a decoded path against the true states, e.g. those of a simulated sequence.
+ *
+ * The comparison is accumulated position by position from aligned pieces of both paths, so neither has to be
+ * held in memory: hmm_decode reads the truth file in blocks next to the decoded path, or next to the states a
+ * stream decides. It counts
+ *
+ *   confusion[truth * n_states + decoded]   positions per (true state, decoded state) pair
+ *   boundaries                               positions where the state differs from the one before, on each
+ *                                            path; a boundary counts as matched when the other path has one at
+ *                                            most `tolerance` positions away
+ *
+ * Boundary matching needs no look-back beyond the tolerance: a boundary still unmatched once the comparison is
+ * `tolerance` positions past it can only be missed, so the unresolved ones fit in a ring of tolerance + 1.
+ *
+ * True states are read from state files with one state per line, given by the last field of the line: a label
+ * character, as in durbin_state.txt, or the second column of sample_states_1.txt. Models without labels use
+ * state numbers.
+**/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm.h"
+
+// longest field accepted in a state file
+#define STATE_FIELD_MAX 16
+
+
+// boundaries of one path whose match is not yet decided, oldest first
+typedef struct
+{
+    size_t *pos;
+    size_t head;
+    size_t count;
+    size_t cap;
+} boundary_ring;
+
+typedef struct
+{
+    uint64_t found;         // boundaries on this path
+    uint64_t matched;       // of those, with one on the other path within the tolerance
+    int seen;               // a boundary has been found, last holds its position
+    size_t last;
+    boundary_ring open;
+} boundary_side;
+
+struct hmm_accuracy
+{
+    int n_states;
+    size_t tolerance;
+    uint64_t positions;
+    uint64_t *confusion;
+    hmm_state prev_decoded;
+    hmm_state prev_truth;
+    boundary_side decoded;
+    boundary_side truth;
+};
+
+
+hmm_accuracy *hmm_accuracy_new(int n_states, size_t tolerance)
+{
+    if (n_states < 1 || n_states > HMM_MAX_STATES || tolerance > SIZE_MAX / sizeof(size_t) - 1)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    hmm_accuracy *acc = calloc(1, sizeof(*acc));
+    if (!acc)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    acc->n_states = n_states;
+    acc->tolerance = tolerance;
+    acc->confusion = calloc((size_t) n_states * n_states, sizeof(uint64_t));
+    acc->decoded.open.cap = tolerance + 1;
+    acc->truth.open.cap = tolerance + 1;
+    acc->decoded.open.pos = malloc((tolerance + 1) * sizeof(size_t));
+    acc->truth.open.pos = malloc((tolerance + 1) * sizeof(size_t));
+    if (!acc->confusion || !acc->decoded.open.pos || !acc->truth.open.pos)
+    {
+        hmm_accuracy_free(acc);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return acc;
+}
+
+void hmm_accuracy_free(hmm_accuracy *acc)
+{
+    if (!acc)
+    {
+        return;
+    }
+    free(acc->confusion);
+    free(acc->decoded.open.pos);
+    free(acc->truth.open.pos);
+    free(acc);
+}
+
+
+// drops the open boundaries more than tolerance positions before t, which nothing can match any more
+static void expire(boundary_side *side, size_t t, size_t tolerance)
+{
+    boundary_ring *r = &side->open;
+    while (r->count && r->pos[r->head] + tolerance < t)
+    {
+        r->head = (r->head + 1) % r->cap;
+        r->count--;
+    }
+}
+
+// a boundary at t on side: matched at once by a recent one on other, otherwise left open. Any open boundary of
+// other is within the tolerance of t after expire, so t matches all of them
+static void add_boundary(boundary_side *side, boundary_side *other, size_t t, size_t tolerance)
+{
+    side->found++;
+    if (other->seen && other->last + tolerance >= t)
+    {
+        side->matched++;
+    }
+    else
+    {
+        boundary_ring *r = &side->open;
+        r->pos[(r->head + r->count) % r->cap] = t;
+        r->count++;
+    }
+    other->matched += other->open.count;
+    other->open.count = 0;
+}
+
+int hmm_accuracy_add(hmm_accuracy *acc, const hmm_state *decoded, const hmm_state *truth, size_t count)
+{
+    if (!acc || (count && (!decoded || !truth)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (decoded[i] >= acc->n_states || truth[i] >= acc->n_states)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    int n = acc->n_states;
+    size_t w = acc->tolerance;
+    for (size_t i = 0; i < count; i++)
+    {
+        hmm_state d = decoded[i];
+        hmm_state s = truth[i];
+        size_t t = acc->positions++;
+        acc->confusion[(size_t) s * n + d]++;
+
+        int bd = t > 0 && d != acc->prev_decoded;
+        int bt = t > 0 && s != acc->prev_truth;
+        acc->prev_decoded = d;
+        acc->prev_truth = s;
+        if (!bd && !bt)
+        {
+            continue;
+        }
+
+        expire(&acc->decoded, t, w);
+        expire(&acc->truth, t, w);
+        // boundaries at the same position match each other
+        if (bd)
+        {
+            acc->decoded.seen = 1;
+            acc->decoded.last = t;
+        }
+        if (bt)
+        {
+            acc->truth.seen = 1;
+            acc->truth.last = t;
+        }
+        if (bd)
+        {
+            add_boundary(&acc->decoded, &acc->truth, t, w);
+        }
+        if (bt)
+        {
+            add_boundary(&acc->truth, &acc->decoded, t, w);
+        }
+    }
+    return 0;
+}
+
+
+static void print_ratio(FILE *f, uint64_t num, uint64_t den)
+{
+    if (den)
+    {
+        fprintf(f, "%.6f", (double) num / den);
+    }
+    else
+    {
+        fprintf(f, "null");
+    }
+}
+
+static void print_state(FILE *f, const char *labels, int j)
+{
+    if (labels)
+    {
+        fprintf(f, "\"%c\"", labels[j]);
+    }
+    else
+    {
+        fprintf(f, "\"%d\"", j);
+    }
+}
+
+int hmm_accuracy_report(FILE *f, const hmm_accuracy *acc, const char *labels)
+{
+    if (!f || !acc)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    int n = acc->n_states;
+    const uint64_t *c = acc->confusion;
+
+    uint64_t agree = 0;
+    for (int j = 0; j < n; j++)
+    {
+        agree += c[(size_t) j * n + j];
+    }
+    fprintf(f, "{\n  \"positions\": %llu,\n  \"agreement\": ", (unsigned long long) acc->positions);
+    print_ratio(f, agree, acc->positions);
+
+    // per state: precision over the positions decoded as j, recall over the positions truly in j
+    fprintf(f, ",\n  \"states\": {\n");
+    for (int j = 0; j < n; j++)
+    {
+        uint64_t decoded = 0;
+        uint64_t truth = 0;
+        for (int i = 0; i < n; i++)
+        {
+            decoded += c[(size_t) i * n + j];
+            truth += c[(size_t) j * n + i];
+        }
+        fprintf(f, "    ");
+        print_state(f, labels, j);
+        fprintf(f, ": { \"true\": %llu, \"decoded\": %llu, \"precision\": ", (unsigned long long) truth,
+                (unsigned long long) decoded);
+        print_ratio(f, c[(size_t) j * n + j], decoded);
+        fprintf(f, ", \"recall\": ");
+        print_ratio(f, c[(size_t) j * n + j], truth);
+        fprintf(f, " }%s\n", j + 1 < n ? "," : "");
+    }
+
+    // rows are true states, columns decoded states
+    fprintf(f, "  },\n  \"confusion\": [\n");
+    for (int i = 0; i < n; i++)
+    {
+        fprintf(f, "    [");
+        for (int j = 0; j < n; j++)
+        {
+            fprintf(f, "%s%llu", j ? ", " : "", (unsigned long long) c[(size_t) i * n + j]);
+        }
+        fprintf(f, "]%s\n", i + 1 < n ? "," : "");
+    }
+
+    // boundaries still open at the end have nothing left to match them
+    fprintf(f, "  ],\n  \"boundaries\": { \"tolerance\": %zu, \"true\": %llu, \"decoded\": %llu, \"precision\": ",
+            acc->tolerance, (unsigned long long) acc->truth.found, (unsigned long long) acc->decoded.found);
+    print_ratio(f, acc->decoded.matched, acc->decoded.found);
+    fprintf(f, ", \"recall\": ");
+    print_ratio(f, acc->truth.matched, acc->truth.found);
+    fprintf(f, " }\n}\n");
+    return ferror(f) ? -1 : 0;
+}
+
+
+// the state named by one state file field
+static int parse_state(const char *field, size_t len, const char *labels, int n_states)
+{
+    if (labels && len == 1)
+    {
+        const char *hit = memchr(labels, field[0], n_states);
+        return hit ? (int) (hit - labels) : -1;
+    }
+    if (labels || len == 0)
+    {
+        return -1;
+    }
+    int value = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isdigit((unsigned char) field[i]) || value >= n_states)
+        {
+            return -1;
+        }
+        value = value * 10 + (field[i] - '0');
+    }
+    return value < n_states ? value : -1;
+}
+
+int hmm_read_states(FILE *f, const char *labels, int n_states, hmm_state *states, size_t count, size_t *got)
+{
+    if (!f || (!states && count) || !got || n_states < 1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char field[STATE_FIELD_MAX];
+    size_t len = 0;
+    int in_field = 0;
+    size_t n = 0;
+    while (n < count)
+    {
+        int ch = getc(f);
+        if (ch == '\n' || ch == EOF)
+        {
+            if (len)
+            {
+                int state = parse_state(field, len, labels, n_states);
+                if (state < 0)
+                {
+                    errno = EINVAL;
+                    return -1;
+                }
+                states[n++] = state;
+            }
+            if (ch == EOF)
+            {
+                break;
+            }
+            len = 0;
+            in_field = 0;
+        }
+        else if (isspace(ch))
+        {
+            in_field = 0;
+        }
+        else
+        {
+            // a new field replaces the previous one of the line, only the last is the state
+            if (!in_field)
+            {
+                len = 0;
+                in_field = 1;
+            }
+            if (len == STATE_FIELD_MAX)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            field[len++] = ch;
+        }
+    }
+    if (ferror(f))
+    {
+        errno = EIO;
+        return -1;
+    }
+    *got = n;
+    return 0;
+}
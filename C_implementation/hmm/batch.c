@@ -0,0 +1,320 @@
+/**
+ * Parallel decoding of many independent sequences with one shared, read-only model.
+ *
+ * Items are dealt round robin, longest first, onto one queue per worker thread. A worker takes work from the
+ * front of its own queue and, once that is empty, steals from the back of the others, so a few long records
+ * cannot leave the remaining threads idle. Results are written into each item, so their order never depends on
+ * scheduling.
+ *
+ * Workers decode HMM_VITERBI_FULL in an hmm_decoder of their own (see decoder.c), so a batch of short records
+ * costs one allocation per thread rather than several per record. With a small model they take opts->lanes items
+ * at a time instead and decode them side by side in SIMD lanes (see batch_lanes.c); items that cannot join a
+ * group, being long or holding symbols without a table row, are decoded one at a time as before.
+ *
+ * The model is only read: Poisson emission tables must be cached (hmm_model_cache_obs) before the batch starts.
+ * Build with -pthread.
+ *
+ * HMM_BACKEND_CUDA hands the whole batch to batch_cuda.cu instead, which is only compiled into builds with
+ * -DHMM_CUDA; elsewhere the stand-ins below report it as unavailable.
+**/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hmm_internal.h"
+
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t *items;
+    size_t head;
+    size_t tail;
+} batch_queue;
+
+typedef struct
+{
+    const hmm_model *model;
+    const hmm_viterbi_opts *opts;
+    hmm_batch_item *items;
+    batch_queue *queues;
+    int n_queues;
+    int lanes;              // items per group, 0 to decode every item alone
+} batch_job;
+
+typedef struct
+{
+    batch_job *job;
+    int id;
+} batch_worker;
+
+
+// up to max items from the front of q, or from its back when stealing; returns how many
+static int take(batch_queue *q, int steal, size_t *items, int max)
+{
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    while (found < max && q->head < q->tail)
+    {
+        items[found++] = steal ? q->items[--q->tail] : q->items[q->head++];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static void decode_one(batch_job *job, hmm_decoder **dec, int *reuse, hmm_batch_item *it)
+{
+    if (*reuse && !*dec)
+    {
+        // without an arena every item falls back to allocating its own
+        *dec = hmm_decoder_new(job->model, it->obs.length, job->opts);
+        *reuse = *dec != NULL;
+    }
+    if (*dec)
+    {
+        it->status = hmm_decoder_viterbi(*dec, &it->obs, it->path, &it->log_prob);
+    }
+    else
+    {
+        it->status = hmm_viterbi_obs(job->model, &it->obs, it->path, &it->log_prob, job->opts);
+    }
+    it->error = it->status ? errno : 0;
+}
+
+static void *batch_thread(void *arg)
+{
+    batch_worker *worker = arg;
+    batch_job *job = worker->job;
+    size_t taken[LANES_MAX];
+    int want = job->lanes ? job->lanes : 1;
+    // full double precision decodes share one arena per worker, sized by the worker's first (longest) item
+    const hmm_viterbi_opts *opts = job->opts;
+    int reuse = !opts || (opts->mode == HMM_VITERBI_FULL && opts->score == HMM_SCORE_DOUBLE);
+    hmm_decoder *dec = NULL;
+    lanes_arena arena = { NULL, NULL, NULL, 0 };
+
+    for (;;)
+    {
+        int found = take(&job->queues[worker->id], 0, taken, want);
+        for (int k = 1; !found && k < job->n_queues; k++)
+        {
+            found = take(&job->queues[(worker->id + k) % job->n_queues], 1, taken, want);
+        }
+        // nothing is ever added to a queue, so once every queue is empty the batch is done
+        if (!found)
+        {
+            hmm_decoder_free(dec);
+            lanes_arena_free(&arena);
+            return NULL;
+        }
+
+        hmm_batch_item *group[LANES_MAX];
+        int grouped = 0;
+        for (int g = 0; g < found; g++)
+        {
+            hmm_batch_item *it = &job->items[taken[g]];
+            if (job->lanes && it->path && lanes_fit(&it->obs))
+            {
+                group[grouped++] = it;
+            }
+            else
+            {
+                decode_one(job, &dec, &reuse, it);
+            }
+        }
+        // a lone item is faster with the kernels for one sequence, and a group that cannot get its memory is
+        // decoded one item at a time
+        uint32_t left = ~0u;
+        if (grouped > 1 && lanes_decode(job->model, group, grouped, job->lanes, &arena, &left) != 0)
+        {
+            left = ~0u;
+        }
+        for (int g = 0; g < grouped; g++)
+        {
+            if (left & 1u << g)
+            {
+                decode_one(job, &dec, &reuse, group[g]);
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    size_t length;
+    size_t index;
+} batch_order;
+
+static int longer_first(const void *a, const void *b)
+{
+    const batch_order *x = a;
+    const batch_order *y = b;
+    if (x->length != y->length)
+    {
+        return x->length > y->length ? -1 : 1;
+    }
+    // equal lengths keep input order, so the schedule itself is reproducible
+    return x->index < y->index ? -1 : 1;
+}
+
+
+// every item failed with error, for batches a backend cannot take at all
+static int fail_all(hmm_batch_item *items, size_t count, int error)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        items[i].status = -1;
+        items[i].error = error;
+    }
+    errno = error;
+    return -1;
+}
+
+#ifndef HMM_CUDA
+int cuda_available(void)
+{
+    return 0;
+}
+
+int cuda_viterbi_batch(const hmm_model *model, hmm_batch_item *items, size_t count, const hmm_viterbi_opts *opts)
+{
+    (void) model;
+    (void) opts;
+    return fail_all(items, count, ENOTSUP);
+}
+#endif
+
+int hmm_backend_available(hmm_backend backend)
+{
+    switch (backend)
+    {
+        case HMM_BACKEND_CPU:
+            return 1;
+        case HMM_BACKEND_CUDA:
+            return cuda_available();
+        default:
+            return 0;
+    }
+}
+
+int hmm_viterbi_batch(const hmm_model *model, hmm_batch_item *items, size_t count, int threads,
+                      const hmm_viterbi_opts *opts)
+{
+    if (opts && opts->backend != HMM_BACKEND_CPU)
+    {
+        if (opts->backend == HMM_BACKEND_CUDA)
+        {
+            return cuda_viterbi_batch(model, items, count, opts);
+        }
+        return fail_all(items, count, ENOTSUP);
+    }
+
+    // lanes are used for the decodes hmm_decoder does, with the same results
+    int lanes = opts ? opts->lanes : 0;
+    if (lanes != 0 && lanes != 1 && lanes != 8 && lanes != 16)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    int full = !opts || (opts->mode == HMM_VITERBI_FULL && opts->score == HMM_SCORE_DOUBLE);
+    lanes = full && lanes != 1 && model && lanes_supported(model) ? (lanes ? lanes : 8) : 0;
+
+    threads = parallel_threads(threads);
+    if ((size_t) threads > count)
+    {
+        threads = count ? (int) count : 1;
+    }
+
+    batch_order *order = malloc((count ? count : 1) * sizeof(batch_order));
+    batch_queue *queues = calloc(threads, sizeof(batch_queue));
+    batch_worker *workers = calloc(threads, sizeof(batch_worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+
+    if (!order || !queues || !workers || !tids)
+    {
+        free(order);
+        free(queues);
+        free(workers);
+        free(tids);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        order[i].length = items[i].obs.length;
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(batch_order), longer_first);
+
+    // queue q gets every threads-th item of the sorted order, stored contiguously
+    size_t per_queue = count / threads + 1;
+    size_t *slots = malloc(per_queue * threads * sizeof(size_t));
+    if (!slots)
+    {
+        free(order);
+        free(queues);
+        free(workers);
+        free(tids);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int q = 0; q < threads; q++)
+    {
+        pthread_mutex_init(&queues[q].lock, NULL);
+        queues[q].items = slots + q * per_queue;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        batch_queue *q = &queues[i % threads];
+        q->items[q->tail++] = order[i].index;
+    }
+
+    // one hmm_viterbi_timing cannot take the times of several concurrent decodes
+    hmm_viterbi_opts untimed;
+    if (opts && opts->timing)
+    {
+        untimed = *opts;
+        untimed.timing = NULL;
+        opts = &untimed;
+    }
+    batch_job job = { model, opts, items, queues, threads, lanes };
+    int started = 0;
+    for (int w = 0; w < threads; w++)
+    {
+        workers[w].job = &job;
+        workers[w].id = w;
+        if (w > 0 && pthread_create(&tids[w], NULL, batch_thread, &workers[w]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    // the calling thread is worker 0; queues of workers that failed to start are emptied by stealing
+    batch_thread(&workers[0]);
+    for (int w = 1; w < started; w++)
+    {
+        pthread_join(tids[w], NULL);
+    }
+
+    for (int q = 0; q < threads; q++)
+    {
+        pthread_mutex_destroy(&queues[q].lock);
+    }
+    free(slots);
+    free(order);
+    free(queues);
+    free(workers);
+    free(tids);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (items[i].status != 0)
+        {
+            errno = items[i].error;
+            return -1;
+        }
+    }
+    return 0;
+}
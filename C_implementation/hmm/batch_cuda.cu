@@ -0,0 +1,603 @@
+/**
+ * hmm_viterbi_batch on a CUDA device (HMM_BACKEND_CUDA), for jobs of very many sequences with one model.
+ *
+ * The model tables are copied to the device once per batch and the sequences in chunks that fit in device
+ * memory. Scores and backpointers never leave the device: every sequence is traced back there and only its path
+ * and score are copied back. Two kernels share the work:
+ *
+ *   up to LANE_STATES states   one thread per sequence, a warp decoding 32 of them like the SIMD lanes of
+ *                              batch_lanes.c: sequences are sorted longest first and interleaved by warp, so the
+ *                              symbols, backpointers and path of the 32 lanes are adjacent and every access of a
+ *                              warp is coalesced
+ *   more states                one block per sequence, its threads sharing the destination states of a column
+ *                              held in shared memory, for up to BLOCK_MAX_STATES states
+ *
+ * Both add and compare (>=) in the order of viterbi_step, and double additions are exact IEEE operations on the
+ * device, so paths and scores are bit-identical to HMM_VITERBI_FULL on the CPU.
+ *
+ * Only categorical and cached Poisson tables are on the device. Empty items, and items with an observation that
+ * has no table row (an out-of-range symbol, or a Poisson count beyond the cache), are decoded on the CPU instead,
+ * with the same results and errors as there.
+ *
+ * Not part of the default build: compile this file with nvcc and the rest of the library with -DHMM_CUDA, e.g.
+ *   nvcc -O3 -c ../hmm/batch_cuda.cu -o batch_cuda.o
+ *   cc -O3 -std=gnu99 -DHMM_CUDA -o hmm_decode hmm_decode.c ../hmm/[a-z]*.c batch_cuda.o -lm -pthread \
+ *      -lcudart -lstdc++
+ * Without it hmm_backend_available(HMM_BACKEND_CUDA) is 0 and CUDA batches fail with ENOTSUP.
+**/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cuda_runtime.h>
+
+extern "C" {
+#include "hmm.h"
+}
+
+// states decoded one thread per sequence, and the most a block can decode with two columns in shared memory
+#define LANE_STATES 8
+#define BLOCK_MAX_STATES 3072
+// sequences interleaved per warp, threads per block of the lane kernel, and at most per block of the other
+#define WARP 32
+#define LANE_THREADS 128
+#define BLOCK_THREADS 256
+// device memory a chunk of sequences may use, at most half of what is free
+#define CHUNK_BYTES ((size_t) 2 << 30)
+
+
+extern "C" int cuda_available(void);
+extern "C" int cuda_viterbi_batch(const hmm_model *model, hmm_batch_item *items, size_t count,
+                                  const hmm_viterbi_opts *opts);
+
+
+// the layout of a chunk: groups of `width` sequences (WARP for the lane kernel, 1 for the block kernel), group g
+// holding positions base[g] .. base[g] + length[g] - 1 of every one of them, lanes innermost
+typedef struct
+{
+    int groups;
+    int width;
+    const int *length;          // per slot g * width + lane, 0 for padding
+    const size_t *base;         // per group, in positions
+    const int *obs;             // (base[g] + t) * width + lane
+    hmm_state *path;            // the same
+    double *log_prob;           // per slot
+} chunk_view;
+
+
+template <int N>
+__global__ void lane_kernel(chunk_view c, const double *__restrict__ init, const double *__restrict__ trans,
+                            const double *__restrict__ emit, uint8_t *__restrict__ trace)
+{
+    int g = (blockIdx.x * blockDim.x + threadIdx.x) / WARP;
+    int lane = threadIdx.x % WARP;
+    if (g >= c.groups)
+    {
+        return;
+    }
+    int slot = g * WARP + lane;
+    int length = c.length[slot];
+    if (length == 0)
+    {
+        return;
+    }
+    const int *obs = c.obs + c.base[g] * WARP + lane;
+    uint8_t *bp = trace + c.base[g] * N * WARP + lane;
+
+    double score[N];
+    double next[N];
+    int k = obs[0];
+    for (int j = 0; j < N; j++)
+    {
+        score[j] = __ldg(&emit[k * N + j]) + __ldg(&init[j]);
+    }
+    for (int t = 1; t < length; t++)
+    {
+        k = obs[(size_t) t * WARP];
+        for (int j = 0; j < N; j++)
+        {
+            double best = score[0] + __ldg(&trans[j]);
+            int arg = 0;
+            for (int i = 1; i < N; i++)
+            {
+                double cand = score[i] + __ldg(&trans[i * N + j]);
+                if (cand >= best)
+                {
+                    best = cand;
+                    arg = i;
+                }
+            }
+            next[j] = best + __ldg(&emit[k * N + j]);
+            bp[((size_t) t * N + j) * WARP] = (uint8_t) arg;
+        }
+        for (int j = 0; j < N; j++)
+        {
+            score[j] = next[j];
+        }
+    }
+
+    int state = 0;
+    for (int j = 1; j < N; j++)
+    {
+        if (score[j] >= score[state])
+        {
+            state = j;
+        }
+    }
+    c.log_prob[slot] = score[state];
+    hmm_state *path = c.path + c.base[g] * WARP + lane;
+    for (int t = length - 1; t > 0; t--)
+    {
+        path[(size_t) t * WARP] = (hmm_state) state;
+        state = bp[((size_t) t * N + state) * WARP];
+    }
+    path[0] = (hmm_state) state;
+}
+
+// one sequence per block; B holds a backpointer, uint8_t up to 256 states
+template <typename B>
+__global__ void block_kernel(chunk_view c, int n, const double *__restrict__ init,
+                             const double *__restrict__ trans, const double *__restrict__ emit, B *__restrict__ trace)
+{
+    extern __shared__ double column[];
+    double *prev = column;
+    double *cur = column + n;
+    int s = blockIdx.x;
+    int length = c.length[s];
+    if (length == 0)
+    {
+        return;
+    }
+    const int *obs = c.obs + c.base[s];
+    B *bp = trace + c.base[s] * n;
+
+    int k = obs[0];
+    for (int j = threadIdx.x; j < n; j += blockDim.x)
+    {
+        prev[j] = __ldg(&emit[(size_t) k * n + j]) + __ldg(&init[j]);
+    }
+    __syncthreads();
+    for (int t = 1; t < length; t++)
+    {
+        k = obs[t];
+        // threads take consecutive destination states, so the reads of a row of trans are coalesced
+        for (int j = threadIdx.x; j < n; j += blockDim.x)
+        {
+            double best = prev[0] + __ldg(&trans[j]);
+            int arg = 0;
+            for (int i = 1; i < n; i++)
+            {
+                double cand = prev[i] + __ldg(&trans[(size_t) i * n + j]);
+                if (cand >= best)
+                {
+                    best = cand;
+                    arg = i;
+                }
+            }
+            cur[j] = best + __ldg(&emit[(size_t) k * n + j]);
+            bp[(size_t) t * n + j] = (B) arg;
+        }
+        __syncthreads();
+        double *swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+
+    // the traceback is a chain of dependent loads, so one thread does it
+    if (threadIdx.x != 0)
+    {
+        return;
+    }
+    int state = 0;
+    for (int j = 1; j < n; j++)
+    {
+        if (prev[j] >= prev[state])
+        {
+            state = j;
+        }
+    }
+    c.log_prob[s] = prev[state];
+    hmm_state *path = c.path + c.base[s];
+    for (int t = length - 1; t > 0; t--)
+    {
+        path[t] = (hmm_state) state;
+        state = bp[(size_t) t * n + state];
+    }
+    path[0] = (hmm_state) state;
+}
+
+
+static int symbol_at(const hmm_obs *obs, size_t t)
+{
+    switch (obs->type)
+    {
+        case HMM_OBS_U8:
+            return ((const uint8_t *) obs->data)[t];
+        case HMM_OBS_U16:
+            return ((const uint16_t *) obs->data)[t];
+        default:
+            return ((const int *) obs->data)[t];
+    }
+}
+
+// whether the device can decode obs: symbols, every one with a table row
+static int device_fit(const hmm_obs *obs, int rows)
+{
+    if (obs->length == 0 || !obs->data || obs->type == HMM_OBS_F64 || obs->length > (size_t) 1 << 30)
+    {
+        return 0;
+    }
+    for (size_t t = 0; t < obs->length; t++)
+    {
+        int k = symbol_at(obs, t);
+        if (k < 0 || k >= rows)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+typedef struct
+{
+    size_t length;
+    size_t index;
+} cuda_order;
+
+static int longer_first(const void *a, const void *b)
+{
+    const cuda_order *x = (const cuda_order *) a;
+    const cuda_order *y = (const cuda_order *) b;
+    if (x->length != y->length)
+    {
+        return x->length > y->length ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : 1;
+}
+
+// every device allocation of a batch, released together
+typedef struct
+{
+    double *init;
+    double *trans;
+    double *emit;
+    int *length;
+    size_t *base;
+    int *obs;
+    hmm_state *path;
+    double *log_prob;
+    void *trace;
+} device_buffers;
+
+static void device_free(device_buffers *d)
+{
+    cudaFree(d->init);
+    cudaFree(d->trans);
+    cudaFree(d->emit);
+    cudaFree(d->length);
+    cudaFree(d->base);
+    cudaFree(d->obs);
+    cudaFree(d->path);
+    cudaFree(d->log_prob);
+    cudaFree(d->trace);
+    memset(d, 0, sizeof(*d));
+}
+
+// bytes of device memory per position of a chunk, and per slot
+static size_t position_bytes(int n, size_t trace_bytes)
+{
+    return sizeof(int) + sizeof(hmm_state) + (size_t) n * trace_bytes;
+}
+
+// decodes the sorted items order[0 .. count - 1] on the device, all of which fit; chunks of groups bounded by the
+// device memory they need are copied in, decoded and copied back in turn
+static int decode_sorted(const hmm_model *model, hmm_batch_item *items, const cuda_order *order, size_t count,
+                         device_buffers *d, size_t budget)
+{
+    int n = model->n_states;
+    int lanes = n <= LANE_STATES;
+    int width = lanes ? WARP : 1;
+    size_t trace_bytes = lanes || n <= 256 ? 1 : 2;
+    size_t groups = (count + width - 1) / width;
+    size_t per_position = position_bytes(n, trace_bytes) * width;
+
+    // host copies of one chunk, sized for the whole batch at most
+    int *length = (int *) calloc(groups * width, sizeof(int));
+    size_t *base = (size_t *) malloc((groups + 1) * sizeof(size_t));
+    double *log_prob = (double *) malloc(groups * width * sizeof(double));
+    int *obs = NULL;
+    hmm_state *path = NULL;
+    size_t host_positions = 0;
+    size_t device_positions = 0;
+    int rc = -1;
+    if (!length || !base || !log_prob)
+    {
+        errno = ENOMEM;
+        goto CLEANUP;
+    }
+    if (cudaMalloc(&d->length, groups * width * sizeof(int)) != cudaSuccess ||
+        cudaMalloc(&d->base, (groups + 1) * sizeof(size_t)) != cudaSuccess ||
+        cudaMalloc(&d->log_prob, groups * width * sizeof(double)) != cudaSuccess)
+    {
+        errno = ENOMEM;
+        goto CLEANUP;
+    }
+
+    for (size_t first = 0; first < groups; )
+    {
+        // the longest item of a group, its first, sets the positions of every lane
+        size_t last = first;
+        size_t positions = 0;
+        while (last < groups)
+        {
+            size_t group_length = order[last * width].length;
+            if (last > first && (positions + group_length) * per_position > budget)
+            {
+                break;
+            }
+            positions += group_length;
+            last++;
+        }
+        int chunk_groups = (int) (last - first);
+
+        if (positions > host_positions)
+        {
+            int *grown_obs = (int *) realloc(obs, positions * width * sizeof(int));
+            if (!grown_obs)
+            {
+                errno = ENOMEM;
+                goto CLEANUP;
+            }
+            obs = grown_obs;
+            hmm_state *grown_path = (hmm_state *) realloc(path, positions * width * sizeof(hmm_state));
+            if (!grown_path)
+            {
+                errno = ENOMEM;
+                goto CLEANUP;
+            }
+            path = grown_path;
+            host_positions = positions;
+        }
+
+        // interleave the symbols of every group, padding lanes past their end with symbol 0
+        memset(length, 0, chunk_groups * width * sizeof(int));
+        base[0] = 0;
+        for (int g = 0; g < chunk_groups; g++)
+        {
+            size_t group_length = order[(first + g) * width].length;
+            base[g + 1] = base[g] + group_length;
+            for (int lane = 0; lane < width; lane++)
+            {
+                size_t slot = (first + g) * width + lane;
+                const hmm_obs *o = slot < count ? &items[order[slot].index].obs : NULL;
+                length[g * width + lane] = o ? (int) o->length : 0;
+                for (size_t t = 0; t < group_length; t++)
+                {
+                    obs[(base[g] + t) * width + lane] = o && t < o->length ? symbol_at(o, t) : 0;
+                }
+            }
+        }
+
+        size_t slots = (size_t) chunk_groups * width;
+        if (positions > device_positions)
+        {
+            cudaFree(d->obs);
+            cudaFree(d->path);
+            cudaFree(d->trace);
+            d->obs = NULL;
+            d->path = NULL;
+            d->trace = NULL;
+            device_positions = 0;
+            if (cudaMalloc(&d->obs, positions * width * sizeof(int)) != cudaSuccess ||
+                cudaMalloc(&d->path, positions * width * sizeof(hmm_state)) != cudaSuccess ||
+                cudaMalloc(&d->trace, positions * width * n * trace_bytes) != cudaSuccess)
+            {
+                errno = ENOMEM;
+                goto CLEANUP;
+            }
+            device_positions = positions;
+        }
+        if (cudaMemcpy(d->length, length, slots * sizeof(int), cudaMemcpyHostToDevice) != cudaSuccess ||
+            cudaMemcpy(d->base, base, chunk_groups * sizeof(size_t), cudaMemcpyHostToDevice) != cudaSuccess ||
+            cudaMemcpy(d->obs, obs, positions * width * sizeof(int), cudaMemcpyHostToDevice) != cudaSuccess)
+        {
+            errno = EIO;
+            goto CLEANUP;
+        }
+
+        chunk_view c = { chunk_groups, width, d->length, d->base, d->obs, d->path, d->log_prob };
+        if (lanes)
+        {
+            int blocks = (int) ((slots + LANE_THREADS - 1) / LANE_THREADS);
+            uint8_t *trace = (uint8_t *) d->trace;
+            switch (n)
+            {
+                case 1: lane_kernel<1><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                case 2: lane_kernel<2><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                case 3: lane_kernel<3><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                case 4: lane_kernel<4><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                case 5: lane_kernel<5><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                case 6: lane_kernel<6><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                case 7: lane_kernel<7><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+                default: lane_kernel<8><<<blocks, LANE_THREADS>>>(c, d->init, d->trans, d->emit, trace); break;
+            }
+        }
+        else
+        {
+            int threads = n < BLOCK_THREADS ? (n + WARP - 1) / WARP * WARP : BLOCK_THREADS;
+            size_t shared = 2 * n * sizeof(double);
+            if (trace_bytes == 1)
+            {
+                block_kernel<uint8_t><<<chunk_groups, threads, shared>>>(c, n, d->init, d->trans, d->emit,
+                                                                        (uint8_t *) d->trace);
+            }
+            else
+            {
+                block_kernel<uint16_t><<<chunk_groups, threads, shared>>>(c, n, d->init, d->trans, d->emit,
+                                                                         (uint16_t *) d->trace);
+            }
+        }
+        if (cudaGetLastError() != cudaSuccess ||
+            cudaMemcpy(path, d->path, positions * width * sizeof(hmm_state), cudaMemcpyDeviceToHost) != cudaSuccess ||
+            cudaMemcpy(log_prob, d->log_prob, slots * sizeof(double), cudaMemcpyDeviceToHost) != cudaSuccess)
+        {
+            errno = EIO;
+            goto CLEANUP;
+        }
+
+        for (int g = 0; g < chunk_groups; g++)
+        {
+            for (int lane = 0; lane < width; lane++)
+            {
+                size_t slot = (first + g) * width + lane;
+                if (slot >= count)
+                {
+                    break;
+                }
+                hmm_batch_item *it = &items[order[slot].index];
+                for (size_t t = 0; t < it->obs.length; t++)
+                {
+                    it->path[t] = path[(base[g] + t) * width + lane];
+                }
+                it->log_prob = log_prob[g * width + lane];
+                it->status = 0;
+                it->error = 0;
+            }
+        }
+        first = last;
+    }
+    rc = 0;
+
+    CLEANUP:
+        free(length);
+        free(base);
+        free(log_prob);
+        free(obs);
+        free(path);
+        return rc;
+}
+
+
+int cuda_available(void)
+{
+    int devices = 0;
+    return cudaGetDeviceCount(&devices) == cudaSuccess && devices > 0;
+}
+
+int cuda_viterbi_batch(const hmm_model *model, hmm_batch_item *items, size_t count, const hmm_viterbi_opts *opts)
+{
+    if (!model || (!items && count))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    int n = model->n_states;
+    int rows = model->emission == HMM_EMIT_CATEGORICAL ? model->n_symbols : model->n_cached;
+    if ((opts && (opts->mode != HMM_VITERBI_FULL || opts->score != HMM_SCORE_DOUBLE)) || !model->log_emit ||
+        (model->emission != HMM_EMIT_CATEGORICAL && model->emission != HMM_EMIT_POISSON) ||
+        n > BLOCK_MAX_STATES || !cuda_available())
+    {
+        // every item fails, as when the library is built without CUDA
+        for (size_t i = 0; i < count; i++)
+        {
+            items[i].status = -1;
+            items[i].error = ENOTSUP;
+        }
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    // one hmm_viterbi_timing cannot take the times of several decodes
+    hmm_viterbi_opts untimed;
+    hmm_viterbi_opts_init(&untimed);
+    if (opts)
+    {
+        untimed = *opts;
+        untimed.timing = NULL;
+    }
+
+    cuda_order *order = (cuda_order *) malloc((count ? count : 1) * sizeof(cuda_order));
+    if (!order)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t fit = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        hmm_batch_item *it = &items[i];
+        if (it->path && device_fit(&it->obs, rows))
+        {
+            // failed until the device returns its path
+            it->status = -1;
+            it->error = EIO;
+            order[fit].length = it->obs.length;
+            order[fit].index = i;
+            fit++;
+        }
+        else
+        {
+            it->status = hmm_viterbi_obs(model, &it->obs, it->path, &it->log_prob, &untimed);
+            it->error = it->status ? errno : 0;
+        }
+    }
+    qsort(order, fit, sizeof(cuda_order), longer_first);
+
+    device_buffers d;
+    memset(&d, 0, sizeof(d));
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    size_t budget = CHUNK_BYTES;
+    if (cudaMemGetInfo(&free_bytes, &total_bytes) == cudaSuccess && free_bytes / 2 < budget)
+    {
+        budget = free_bytes / 2;
+    }
+
+    int rc = -1;
+    size_t table = (size_t) n * sizeof(double);
+    if (cudaMalloc(&d.init, table) != cudaSuccess || cudaMalloc(&d.trans, table * n) != cudaSuccess ||
+        cudaMalloc(&d.emit, table * (rows ? rows : 1)) != cudaSuccess)
+    {
+        errno = ENOMEM;
+        goto CLEANUP;
+    }
+    if (cudaMemcpy(d.init, model->log_init, table, cudaMemcpyHostToDevice) != cudaSuccess ||
+        cudaMemcpy(d.trans, model->log_trans, table * n, cudaMemcpyHostToDevice) != cudaSuccess ||
+        cudaMemcpy(d.emit, model->log_emit, table * rows, cudaMemcpyHostToDevice) != cudaSuccess)
+    {
+        errno = EIO;
+        goto CLEANUP;
+    }
+    if (fit && decode_sorted(model, items, order, fit, &d, budget) != 0)
+    {
+        goto CLEANUP;
+    }
+    rc = 0;
+
+    CLEANUP:
+        // items the device did not return are reported with the error that stopped it
+        if (rc != 0)
+        {
+            int error = errno;
+            for (size_t i = 0; i < fit; i++)
+            {
+                hmm_batch_item *it = &items[order[i].index];
+                it->error = it->status ? error : 0;
+            }
+        }
+        device_free(&d);
+        free(order);
+        if (rc == 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                if (items[i].status != 0)
+                {
+                    errno = items[i].error;
+                    return -1;
+                }
+            }
+        }
+        return rc;
+}
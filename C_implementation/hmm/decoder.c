@@ -0,0 +1,144 @@
+/**
+ * Reusable Viterbi decoder for many sequences with one model.
+ *
+ * hmm_viterbi_obs allocates its trace and score columns on every call, which for short sequences costs more than
+ * the decode. A decoder owns one arena instead, sized for the longest sequence it is meant for and laid out as
+ *
+ *   scores   n_states + viterbi_work_size doubles (score column, work column, emission rows of an emit_block)
+ *   bp       n_states int32_t
+ *   trace    backpointers of `capacity` positions, 64-byte aligned
+ *
+ * and every decode runs HMM_VITERBI_FULL in it, so decoding sequences no longer than the capacity makes no
+ * allocation at all, whatever the kind of emissions. A longer sequence replaces the arena with one sized for it;
+ * if that fails the old arena is kept, so an out-of-memory error leaves the decoder usable for the sequences it
+ * could already take.
+ *
+ * A decoder holds the state of one decode at a time: threads each need their own, sharing the model.
+**/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "hmm_internal.h"
+
+#define DECODER_ALIGN 64
+
+
+struct hmm_decoder
+{
+    const hmm_model *model;
+    hmm_viterbi_opts opts;
+    size_t capacity;        // positions the arena holds a trace for
+    void *arena;
+    double *scores;
+    int32_t *bp;
+    void *trace_data;
+};
+
+
+// allocates an arena for sequences of up to capacity positions and points the decoder into it
+static int reserve(hmm_decoder *dec, size_t capacity)
+{
+    int n = dec->model->n_states;
+    size_t scores = n + viterbi_work_size(n);
+    size_t head = (scores * sizeof(double) + n * sizeof(int32_t) + DECODER_ALIGN - 1) / DECODER_ALIGN * DECODER_ALIGN;
+    size_t trace = trace_size(dec->opts.trace, n, capacity);
+    if (trace == 0 || trace > SIZE_MAX - head - DECODER_ALIGN)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // over-allocated by DECODER_ALIGN so that the trace can start on an aligned address
+    char *arena = malloc(head + trace + DECODER_ALIGN);
+    if (!arena)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    free(dec->arena);
+    dec->arena = arena;
+    dec->capacity = capacity;
+
+    uintptr_t base = (uintptr_t) arena;
+    uintptr_t aligned = (base + DECODER_ALIGN - 1) / DECODER_ALIGN * DECODER_ALIGN;
+    dec->scores = (double *) (arena + (aligned - base));
+    dec->bp = (int32_t *) (dec->scores + scores);
+    dec->trace_data = (char *) dec->scores + head;
+    return 0;
+}
+
+
+hmm_decoder *hmm_decoder_new(const hmm_model *model, size_t max_length, const hmm_viterbi_opts *opts)
+{
+    if (!model || (opts && opts->trace != HMM_TRACE_BYTES && opts->trace != HMM_TRACE_PACKED))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (opts && (opts->mode != HMM_VITERBI_FULL || opts->score != HMM_SCORE_DOUBLE))
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    hmm_decoder *dec = calloc(1, sizeof(*dec));
+    if (!dec)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    dec->model = model;
+    if (opts)
+    {
+        dec->opts = *opts;
+    }
+    else
+    {
+        hmm_viterbi_opts_init(&dec->opts);
+    }
+
+    if (reserve(dec, max_length ? max_length : 1) != 0)
+    {
+        free(dec);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return dec;
+}
+
+void hmm_decoder_free(hmm_decoder *dec)
+{
+    if (!dec)
+    {
+        return;
+    }
+    free(dec->arena);
+    free(dec);
+}
+
+
+int hmm_decoder_viterbi(hmm_decoder *dec, const hmm_obs *obs, hmm_state *path, double *log_prob)
+{
+    if (!dec || !obs || (!obs->data && obs->length) || (!path && obs->length))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (obs->length == 0)
+    {
+        if (log_prob)
+        {
+            *log_prob = 0;
+        }
+        return 0;
+    }
+    if (obs->length > dec->capacity && reserve(dec, obs->length) != 0)
+    {
+        return -1;
+    }
+
+    trace_store trace;
+    trace_attach(&trace, dec->opts.trace, dec->model->n_states, obs->length, dec->trace_data);
+    return viterbi_full_run(dec->model, obs, path, log_prob, &dec->opts, &trace, dec->scores, dec->bp);
+}
@@ -0,0 +1,674 @@
+/**
+ * Compressed sequence files, read through their decompressed contents.
+ *
+ * hmm_input_open looks at the first bytes of a file. gzip and zstd files are decompressed by a thread of their
+ * own into a socket that the caller reads in place of the file, so parsing and decoding overlap decompression and
+ * nothing is written to disk. Other regular files are read directly; other pipes are copied through unchanged,
+ * their first bytes having been read to tell.
+ *
+ * Files made of many independent blocks with their decompressed sizes recorded are decompressed a window of
+ * blocks at a time on parallel threads, and written out in order: BGZF (gzip members carrying their size in a
+ * "BC" extra field, as written by bgzip and samtools) and zstd files of many frames, such as the seekable format
+ * and the output of pzstd. Everything else, a plain gzip member or a zstd frame without its size or larger than
+ * the window, is decompressed on the one thread as it is read. A file may mix the two, member by member.
+ *
+ * zlib and libzstd are optional: build with -DHMM_ZLIB (linking -lz) and/or -DHMM_ZSTD (linking -lzstd).
+ * Without them files in that format fail to open with ENOTSUP.
+**/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HMM_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HMM_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hmm_internal.h"
+
+// compressed bytes read ahead, the decompressed bytes of one window of blocks and of one streamed step
+#define INPUT_WINDOW (4 << 20)
+#define INPUT_ROUND (64 << 20)
+#define INPUT_STEP (256 << 10)
+// blocks decompressed together; a window of BGZF blocks compressed 2:1 holds about 130
+#define INPUT_MAX_BLOCKS 4096
+// bytes that tell the format, and the longest zstd frame header
+#define INPUT_MAGIC 4
+#define INPUT_ZSTD_HEADER 18
+
+#if defined(HMM_ZLIB) || defined(HMM_ZSTD)
+#define HAVE_DECOMPRESS 1
+#endif
+
+
+struct hmm_input_worker
+{
+    pthread_t thread;
+    int src;                // the file
+    int out;                // our end of the socket
+    hmm_compress format;
+    int threads;
+    unsigned char *buf;     // compressed bytes buf[start .. end - 1] read but not yet decompressed
+    size_t start;
+    size_t end;
+    int eof;
+    int error;              // errno of a failed decompression, 0 while all is well
+};
+
+// one block of a window, decompressed by one task
+typedef struct
+{
+    hmm_compress format;
+    const unsigned char *src;
+    size_t csize;
+    unsigned char *out;
+    size_t size;
+} input_block;
+
+
+static hmm_compress detect(const unsigned char *p, size_t avail)
+{
+    if (avail >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+    {
+        return HMM_COMPRESS_GZIP;
+    }
+    // a frame, or a skippable frame (magic 0x184D2A50 to 0x184D2A5F), little-endian
+    if (avail >= 4 && ((p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) ||
+                       ((p[0] & 0xf0) == 0x50 && p[1] == 0x2a && p[2] == 0x4d && p[3] == 0x18)))
+    {
+        return HMM_COMPRESS_ZSTD;
+    }
+    return HMM_COMPRESS_NONE;
+}
+
+static int supported(hmm_compress format)
+{
+    switch (format)
+    {
+#ifdef HMM_ZLIB
+        case HMM_COMPRESS_GZIP:
+            return 1;
+#endif
+#ifdef HMM_ZSTD
+        case HMM_COMPRESS_ZSTD:
+            return 1;
+#endif
+        case HMM_COMPRESS_NONE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+#ifdef HAVE_DECOMPRESS
+static uint32_t le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// whether p[0 .. avail - 1] starts with a block of known decompressed size: 1 with its sizes if it is all there,
+// -1 if only its start is, 0 for anything that has to be streamed
+static int block_at(const unsigned char *p, size_t avail, hmm_compress *format, size_t *csize, size_t *size)
+{
+    *format = detect(p, avail);
+#ifdef HMM_ZLIB
+    // BGZF: a gzip member whose "BC" extra subfield holds its size less one, ending in its decompressed size
+    if (*format == HMM_COMPRESS_GZIP)
+    {
+        if (avail < 12)
+        {
+            return -1;
+        }
+        size_t xlen = p[10] | p[11] << 8;
+        if (p[2] != 8 || !(p[3] & 4))
+        {
+            return 0;
+        }
+        for (size_t at = 12; at + 4 <= 12 + xlen; at += 4 + (p[at + 2] | p[at + 3] << 8))
+        {
+            if (at + 6 > avail)
+            {
+                return -1;
+            }
+            if (p[at] == 'B' && p[at + 1] == 'C' && (p[at + 2] | p[at + 3] << 8) == 2)
+            {
+                size_t total = (size_t) (p[at + 4] | p[at + 5] << 8) + 1;
+                if (total < 12 + xlen + 8)
+                {
+                    return 0;
+                }
+                if (total > avail)
+                {
+                    return -1;
+                }
+                *csize = total;
+                *size = le32(p + total - 4);
+                return 1;
+            }
+        }
+        return 0;
+    }
+#endif
+#ifdef HMM_ZSTD
+    if (*format == HMM_COMPRESS_ZSTD)
+    {
+        if (avail < 8)
+        {
+            return -1;
+        }
+        if (p[0] != 0x28)
+        {
+            // skippable, e.g. the seek table of the seekable format: nothing to decompress
+            size_t total = (size_t) le32(p + 4) + 8;
+            if (total > avail)
+            {
+                return total > INPUT_WINDOW ? 0 : -1;
+            }
+            *csize = total;
+            *size = 0;
+            return 1;
+        }
+        unsigned long long n = ZSTD_getFrameContentSize(p, avail);
+        if (n == ZSTD_CONTENTSIZE_ERROR)
+        {
+            return avail < INPUT_ZSTD_HEADER ? -1 : 0;
+        }
+        if (n == ZSTD_CONTENTSIZE_UNKNOWN || n > INPUT_ROUND)
+        {
+            return 0;
+        }
+        size_t total = ZSTD_findFrameCompressedSize(p, avail);
+        if (ZSTD_isError(total))
+        {
+            return -1;
+        }
+        *csize = total;
+        *size = n;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+static int block_task(void *ctx, size_t i)
+{
+    input_block *b = (input_block *) ctx + i;
+    int ok = 0;
+#ifdef HMM_ZLIB
+    if (b->format == HMM_COMPRESS_GZIP)
+    {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (inflateInit2(&z, 15 + 16) != Z_OK)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        z.next_in = (unsigned char *) b->src;
+        z.avail_in = b->csize;
+        z.next_out = b->out;
+        z.avail_out = b->size;
+        // the CRC and length in the trailer are checked too
+        ok = inflate(&z, Z_FINISH) == Z_STREAM_END && z.avail_out == 0;
+        inflateEnd(&z);
+    }
+#endif
+#ifdef HMM_ZSTD
+    if (b->format == HMM_COMPRESS_ZSTD)
+    {
+        size_t got = b->size ? ZSTD_decompress(b->out, b->size, b->src, b->csize) : 0;
+        ok = !ZSTD_isError(got) && got == b->size;
+    }
+#endif
+    if (!ok)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+
+// moves what is left to the front and reads more: as much as fits when full is set, otherwise what one read
+// returns, so that a live pipe is decompressed as it arrives
+static int refill(struct hmm_input_worker *w, int full)
+{
+    if (w->start > 0)
+    {
+        memmove(w->buf, w->buf + w->start, w->end - w->start);
+        w->end -= w->start;
+        w->start = 0;
+    }
+    while (!w->eof && w->end < INPUT_WINDOW)
+    {
+        ssize_t got = read(w->src, w->buf + w->end, INPUT_WINDOW - w->end);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        w->eof = got == 0;
+        w->end += got;
+        if (!full)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int emit(struct hmm_input_worker *w, const unsigned char *data, size_t n)
+{
+    while (n > 0)
+    {
+        // EPIPE rather than SIGPIPE once the reader has closed its end
+        ssize_t put = send(w->out, data, n, MSG_NOSIGNAL);
+        if (put < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += put;
+        n -= put;
+    }
+    return 0;
+}
+
+// more input for a streamed member, unless the last step stopped for room to write instead; EINVAL for a
+// member cut short
+static int stream_input(struct hmm_input_worker *w, int flushing)
+{
+    if (w->start < w->end || flushing)
+    {
+        return 0;
+    }
+    if (refill(w, 0) != 0)
+    {
+        return -1;
+    }
+    if (w->start == w->end)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef HMM_ZLIB
+static int stream_gzip(struct hmm_input_worker *w, unsigned char *out)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    int rc;
+    int flushing = 0;
+    do
+    {
+        if (stream_input(w, flushing) != 0)
+        {
+            goto STREAM_FAIL;
+        }
+        z.next_in = w->buf + w->start;
+        z.avail_in = w->end - w->start;
+        z.next_out = out;
+        z.avail_out = INPUT_STEP;
+        rc = inflate(&z, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+        {
+            errno = rc == Z_MEM_ERROR ? ENOMEM : EINVAL;
+            goto STREAM_FAIL;
+        }
+        w->start = w->end - z.avail_in;
+        flushing = z.avail_out == 0;
+        if (emit(w, out, INPUT_STEP - z.avail_out) != 0)
+        {
+            goto STREAM_FAIL;
+        }
+    }
+    while (rc != Z_STREAM_END);
+    inflateEnd(&z);
+    return 0;
+
+
+    STREAM_FAIL:
+        inflateEnd(&z);
+        return -1;
+}
+#endif
+
+#ifdef HMM_ZSTD
+static int stream_zstd(struct hmm_input_worker *w, unsigned char *out)
+{
+    ZSTD_DStream *z = ZSTD_createDStream();
+    if (!z)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    // 0 once the frame is complete and all of it written out
+    size_t left;
+    int flushing = 0;
+    do
+    {
+        if (stream_input(w, flushing) != 0)
+        {
+            goto STREAM_FAIL;
+        }
+        ZSTD_inBuffer in = { w->buf + w->start, w->end - w->start, 0 };
+        ZSTD_outBuffer put = { out, INPUT_STEP, 0 };
+        left = ZSTD_decompressStream(z, &put, &in);
+        if (ZSTD_isError(left))
+        {
+            errno = EINVAL;
+            goto STREAM_FAIL;
+        }
+        w->start += in.pos;
+        flushing = put.pos == put.size;
+        if (emit(w, out, put.pos) != 0)
+        {
+            goto STREAM_FAIL;
+        }
+    }
+    while (left != 0);
+    ZSTD_freeDStream(z);
+    return 0;
+
+
+    STREAM_FAIL:
+        ZSTD_freeDStream(z);
+        return -1;
+}
+#endif
+
+// the one member or frame at the front, decompressed as it is read
+static int stream_unit(struct hmm_input_worker *w, unsigned char *out)
+{
+    switch (detect(w->buf + w->start, w->end - w->start))
+    {
+#ifdef HMM_ZLIB
+        case HMM_COMPRESS_GZIP:
+            return stream_gzip(w, out);
+#endif
+#ifdef HMM_ZSTD
+        case HMM_COMPRESS_ZSTD:
+            return stream_zstd(w, out);
+#endif
+        default:
+            // trailing data that is not another member, or a format this build cannot read
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+// the whole window of blocks at the front, on parallel threads; 0 blocks if the front has to be streamed
+static int decompress_window(struct hmm_input_worker *w, input_block *blocks, unsigned char **round,
+                             size_t *round_cap, size_t *count)
+{
+    size_t total = 0;
+    size_t at = w->start;
+    input_block b;
+    *count = 0;
+    while (*count < INPUT_MAX_BLOCKS &&
+           block_at(w->buf + at, w->end - at, &b.format, &b.csize, &b.size) > 0 && total + b.size <= INPUT_ROUND)
+    {
+        b.src = w->buf + at;
+        blocks[(*count)++] = b;
+        at += b.csize;
+        total += b.size;
+    }
+    if (*count == 0)
+    {
+        return 0;
+    }
+
+    if (total + 1 > *round_cap)
+    {
+        unsigned char *grown = realloc(*round, total + 1);
+        if (!grown)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        *round = grown;
+        *round_cap = total + 1;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < *count; i++)
+    {
+        blocks[i].out = *round + offset;
+        offset += blocks[i].size;
+    }
+    if (parallel_for(w->threads, *count, block_task, blocks) != 0 || emit(w, *round, total) != 0)
+    {
+        return -1;
+    }
+    w->start = at;
+    return 0;
+}
+
+static void *input_thread(void *arg)
+{
+    struct hmm_input_worker *w = arg;
+    unsigned char *step = malloc(INPUT_STEP);
+    input_block *blocks = malloc(INPUT_MAX_BLOCKS * sizeof(input_block));
+    unsigned char *round = NULL;
+    size_t round_cap = 0;
+    if (!step || !blocks)
+    {
+        errno = ENOMEM;
+        goto INPUT_FAIL;
+    }
+
+    for (;;)
+    {
+        if (w->start == w->end && refill(w, 0) != 0)
+        {
+            goto INPUT_FAIL;
+        }
+        if (w->start == w->end)
+        {
+            break;
+        }
+        if (w->format == HMM_COMPRESS_NONE)
+        {
+            if (emit(w, w->buf + w->start, w->end - w->start) != 0)
+            {
+                goto INPUT_FAIL;
+            }
+            w->start = w->end;
+            continue;
+        }
+
+        // blocks at the front: read the window full of them
+        hmm_compress format;
+        size_t csize, size;
+        if (block_at(w->buf + w->start, w->end - w->start, &format, &csize, &size) != 0 && refill(w, 1) != 0)
+        {
+            goto INPUT_FAIL;
+        }
+        size_t count;
+        if (decompress_window(w, blocks, &round, &round_cap, &count) != 0 ||
+            (count == 0 && stream_unit(w, step) != 0))
+        {
+            goto INPUT_FAIL;
+        }
+    }
+
+    free(step);
+    free(blocks);
+    free(round);
+    // end of file for the reader
+    shutdown(w->out, SHUT_WR);
+    return NULL;
+
+
+    INPUT_FAIL:
+        w->error = errno ? errno : EIO;
+        free(step);
+        free(blocks);
+        free(round);
+        shutdown(w->out, SHUT_WR);
+        return NULL;
+}
+#endif
+
+
+#ifdef HAVE_DECOMPRESS
+// decompresses fd into a socket; magic holds the got bytes already read from it when it is a pipe
+static int start_worker(int fd, int threads, int regular, const unsigned char *magic, size_t got, hmm_input *in)
+{
+    struct hmm_input_worker *w = calloc(1, sizeof(*w));
+    int pair[2] = { -1, -1 };
+    if (!w || !(w->buf = malloc(INPUT_WINDOW)))
+    {
+        errno = ENOMEM;
+        goto OPEN_FAIL;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+    {
+        goto OPEN_FAIL;
+    }
+    w->src = fd;
+    w->out = pair[1];
+    w->format = in->format;
+    w->threads = parallel_threads(threads);
+    // the bytes already read from a pipe come first
+    if (!regular)
+    {
+        memcpy(w->buf, magic, got);
+        w->end = got;
+        w->eof = got < INPUT_MAGIC;
+    }
+    if (pthread_create(&w->thread, NULL, input_thread, w) != 0)
+    {
+        errno = EAGAIN;
+        goto OPEN_FAIL;
+    }
+    in->fd = pair[0];
+    in->worker = w;
+    return 0;
+
+
+    OPEN_FAIL:
+        if (pair[0] >= 0)
+        {
+            close(pair[0]);
+            close(pair[1]);
+        }
+        if (w)
+        {
+            free(w->buf);
+        }
+        free(w);
+        return -1;
+}
+#endif
+
+int hmm_input_open(int fd, int threads, hmm_input *in)
+{
+    unsigned char magic[INPUT_MAGIC];
+    size_t got = 0;
+    struct stat st;
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+#ifndef HAVE_DECOMPRESS
+    // nothing to decompress a pipe with, so its first bytes are left unread
+    if (!regular)
+    {
+        return 0;
+    }
+#endif
+    if (regular)
+    {
+        // peeked at, leaving the offset where it is
+        off_t at = lseek(fd, 0, SEEK_CUR);
+        ssize_t peeked = at < 0 ? -1 : pread(fd, magic, sizeof(magic), at);
+        if (peeked < 0)
+        {
+            return -1;
+        }
+        got = peeked;
+    }
+    else
+    {
+        while (got < sizeof(magic))
+        {
+            ssize_t r = read(fd, magic + got, sizeof(magic) - got);
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (r < 0)
+            {
+                return -1;
+            }
+            if (r == 0)
+            {
+                break;
+            }
+            got += r;
+        }
+    }
+    in->format = detect(magic, got);
+    if (!supported(in->format))
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (regular && in->format == HMM_COMPRESS_NONE)
+    {
+        return 0;
+    }
+#ifdef HAVE_DECOMPRESS
+    return start_worker(fd, threads, regular, magic, got, in);
+#else
+    // not reached: a pipe is left unread and compressed files are not supported
+    (void) threads;
+    return 0;
+#endif
+}
+
+int hmm_input_close(hmm_input *in)
+{
+    struct hmm_input_worker *w = in->worker;
+    if (!w)
+    {
+        return 0;
+    }
+    // a worker still writing gets EPIPE once our end is closed
+    close(in->fd);
+    pthread_join(w->thread, NULL);
+    close(w->out);
+    // a reader that stopped early is not a decompression failure
+    int error = w->error == EPIPE ? 0 : w->error;
+    free(w->buf);
+    free(w);
+    in->fd = -1;
+    in->worker = NULL;
+    if (error)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,254 @@
+/**
+ * Emission models: log P(observation | state) for every state, a block of observations at a time.
+ *
+ * Each kind of emissions is an hmm_emission_ops whose block function fills the rows of consecutive positions,
+ * states innermost, so its loops run over all states with unit stride and vectorise:
+ *
+ *   categorical   copies of the log_emit rows of the symbols
+ *   Poisson       k log(lambda) - lambda - lgamma(k + 1), rows of cached counts copied from log_emit
+ *   Gaussian      the log-sum over components of mix_norm + mix_scale * (x - mix_mean)^2
+ *   custom        whatever the caller plugs in with hmm_model_set_ops
+ *
+ * Decoders do not call these per position. Symbols and counts with a table row are looked up in log_emit as
+ * before, which is free; every other position goes through an emit_block, which evaluates the next
+ * EMIT_BLOCK_BYTES worth of rows in one call and serves the following positions from them. Its buffer belongs to
+ * the decoder, which sets it aside with its other scratch, so that no decode allocates for its emissions.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+// size of the rows an emit_block evaluates at a time, and a bound on its positions for models with few states
+#define EMIT_BLOCK_BYTES 65536
+#define EMIT_BLOCK_MAX 256
+
+
+static int is_symbols(const hmm_obs *obs)
+{
+    return obs->type != HMM_OBS_F64;
+}
+
+static int categorical_block(const hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out)
+{
+    size_t n = model->n_states;
+    if (!is_symbols(obs))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t t = 0; t < count; t++)
+    {
+        int k = obs_at(obs, from + t);
+        if (k < 0 || k >= model->n_symbols)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(out + t * n, model->log_emit + (size_t) k * n, n * sizeof(double));
+    }
+    return 0;
+}
+
+void poisson_row(const hmm_model *model, int k, double *row)
+{
+    double log_kfact = lgamma((double) k + 1);
+    for (int j = 0; j < model->n_states; j++)
+    {
+        row[j] = k * log(model->lambda[j]) - model->lambda[j] - log_kfact;
+    }
+}
+
+static int poisson_block(const hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out)
+{
+    size_t n = model->n_states;
+    if (!is_symbols(obs))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t t = 0; t < count; t++)
+    {
+        int k = obs_at(obs, from + t);
+        if (k < 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        if (k < model->n_cached)
+        {
+            memcpy(out + t * n, model->log_emit + (size_t) k * n, n * sizeof(double));
+        }
+        else
+        {
+            poisson_row(model, k, out + t * n);
+        }
+    }
+    return 0;
+}
+
+static int gaussian_block(const hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out)
+{
+    size_t n = model->n_states;
+    if (model->n_mix < 1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t t = 0; t < count; t++)
+    {
+        double x = obs_value(obs, from + t);
+        if (!isfinite(x))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        double *restrict row = out + t * n;
+        const double *restrict mean = model->mix_mean;
+        const double *restrict scale = model->mix_scale;
+        const double *restrict norm = model->mix_norm;
+        for (size_t j = 0; j < n; j++)
+        {
+            double d = x - mean[j];
+            row[j] = norm[j] + scale[j] * d * d;
+        }
+        // further components are added in log space; a zero-weight one (norm -INFINITY) leaves the row alone
+        for (int c = 1; c < model->n_mix; c++)
+        {
+            mean += n;
+            scale += n;
+            norm += n;
+            for (size_t j = 0; j < n; j++)
+            {
+                double d = x - mean[j];
+                double v = norm[j] + scale[j] * d * d;
+                double hi = v > row[j] ? v : row[j];
+                double lo = v > row[j] ? row[j] : v;
+                row[j] = lo > -INFINITY ? hi + log1p(exp(lo - hi)) : hi;
+            }
+        }
+    }
+    return 0;
+}
+
+// HMM_EMIT_CUSTOM before hmm_model_set_ops
+static int unset_block(const hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out)
+{
+    (void) model;
+    (void) obs;
+    (void) from;
+    (void) count;
+    (void) out;
+    errno = EINVAL;
+    return -1;
+}
+
+const hmm_emission_ops emission_categorical = { "categorical", categorical_block };
+const hmm_emission_ops emission_poisson = { "poisson", poisson_block };
+const hmm_emission_ops emission_gaussian = { "gaussian", gaussian_block };
+const hmm_emission_ops emission_unset = { "custom", unset_block };
+
+
+const double *emission_lookup(const hmm_model *model, int obs, double *scratch)
+{
+    hmm_obs one = { HMM_OBS_INT, 1, &obs };
+    return emission_at(model, &one, 0, scratch);
+}
+
+const double *emission_at(const hmm_model *model, const hmm_obs *obs, size_t t, double *scratch)
+{
+    if (model->log_emit)
+    {
+        int k = obs_at(obs, t);
+        int rows = model->emission == HMM_EMIT_CATEGORICAL ? model->n_symbols : model->n_cached;
+        if (k >= 0 && k < rows)
+        {
+            return model->log_emit + (size_t) k * model->n_states;
+        }
+    }
+    if (model->ops->block(model, obs, t, 1, scratch) != 0)
+    {
+        return NULL;
+    }
+    return scratch;
+}
+
+int hmm_emission_row(const hmm_model *model, int obs, double *row)
+{
+    const double *found = emission_lookup(model, obs, row);
+    if (!found)
+    {
+        return -1;
+    }
+    if (found != row)
+    {
+        memcpy(row, found, model->n_states * sizeof(double));
+    }
+    return 0;
+}
+
+int hmm_emission_block(const hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out)
+{
+    if (!model || !obs || (!obs->data && obs->length) || from > obs->length || count > obs->length - from ||
+        (!out && count))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return count ? model->ops->block(model, obs, from, count, out) : 0;
+}
+
+
+// positions of the rows of one block
+static size_t block_positions(int n_states)
+{
+    size_t cap = EMIT_BLOCK_BYTES / sizeof(double) / n_states;
+    return cap < 1 ? 1 : cap > EMIT_BLOCK_MAX ? EMIT_BLOCK_MAX : cap;
+}
+
+size_t emit_block_size(int n_states)
+{
+    return block_positions(n_states) * n_states;
+}
+
+void emit_block_init(emit_block *b, const hmm_model *model, const hmm_obs *obs, double *buf)
+{
+    b->model = model;
+    b->obs = obs;
+    b->table = model->log_emit;
+    b->rows = model->emission == HMM_EMIT_CATEGORICAL ? model->n_symbols : model->n_cached;
+    b->from = 0;
+    b->count = 0;
+    b->cap = block_positions(model->n_states);
+    b->buf = buf;
+}
+
+const double *emit_block_fill(emit_block *b, size_t t)
+{
+    size_t n = b->model->n_states;
+
+    // forwards from t, or backwards from it when the previous block lay after it
+    size_t length = b->obs->length;
+    size_t from = t;
+    size_t count = length - t < b->cap ? length - t : b->cap;
+    if (b->count && t < b->from)
+    {
+        from = t + 1 > b->cap ? t + 1 - b->cap : 0;
+        count = t + 1 - from;
+    }
+
+    HMM_STATS_START(mark);
+    b->count = 0;
+    if (b->model->ops->block(b->model, b->obs, from, count, b->buf) != 0)
+    {
+        return NULL;
+    }
+    HMM_STATS_STOP(HMM_PHASE_EMISSION, mark, 0, count);
+    b->from = from;
+    b->count = count;
+    return b->buf + (t - from) * n;
+}
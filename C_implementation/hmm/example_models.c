@@ -0,0 +1,96 @@
+/**
+ * The models of the two example programs, so that every decoder built on this library uses the same tables.
+ *
+ *   durbin    the occasionally dishonest casino of Durbin et al., p. 54: states F (fair) and L (loaded),
+ *             symbols are die rolls 1 - 6
+ *   poisson   two states emitting Poisson counts with lambdas fitted in ../MATLAB_implementation
+ *
+ * Both assume the sequence starts in their first state.
+**/
+
+#include <errno.h>
+#include <string.h>
+
+#include "hmm.h"
+
+
+static hmm_model *durbin_model(void)
+{
+    // state transition matrix, row = current state, column = next state
+    double a[2][2] = {
+        { 0.95,  0.05 },
+        { 0.1,  0.9 }
+    };
+
+    // emission probabilities, corresponding to p of rolling 1 thru 6 on fair or loaded die
+    double e[6][2] = {
+        { ((double) 1)/6,  0.1 },
+        { ((double) 1)/6,  0.1 },
+        { ((double) 1)/6,  0.1 },
+        { ((double) 1)/6,  0.1 },
+        { ((double) 1)/6,  0.1 },
+        { ((double) 1)/6,  0.5 },
+    };
+
+    double start[2] = { 1, 0 };
+
+    hmm_model *model = hmm_model_new(2, 6, HMM_EMIT_CATEGORICAL);
+    if (model)
+    {
+        hmm_model_set_init(model, start);
+        hmm_model_set_trans(model, &a[0][0]);
+        hmm_model_set_emit(model, &e[0][0]);
+    }
+    return model;
+}
+
+static hmm_model *poisson_model(void)
+{
+    // state transition matrix, row = current state, column = next state
+    double a[2][2] = {
+        { 0.9551,  0.0449 },
+        { 0.0880,  0.9120 }
+    };
+
+    // emission lambdas for sampling from poisson distribution
+    double e[2] = { 1.8234, 5.7812 };
+
+    double start[2] = { 1, 0 };
+
+    hmm_model *model = hmm_model_new(2, 0, HMM_EMIT_POISSON);
+    if (model)
+    {
+        hmm_model_set_init(model, start);
+        hmm_model_set_trans(model, &a[0][0]);
+        hmm_model_set_lambda(model, e);
+    }
+    return model;
+}
+
+
+static const struct
+{
+    hmm_example info;
+    hmm_model *(*build)(void);
+} examples[] = {
+    { { "durbin", 1, "FL" }, durbin_model },
+    { { "poisson", 0, "12" }, poisson_model },
+};
+
+
+hmm_model *hmm_example_model(const char *name, const hmm_example **info)
+{
+    for (size_t i = 0; i < sizeof(examples) / sizeof(examples[0]); i++)
+    {
+        if (strcmp(name, examples[i].info.name) == 0)
+        {
+            if (info)
+            {
+                *info = &examples[i].info;
+            }
+            return examples[i].build();
+        }
+    }
+    errno = EINVAL;
+    return NULL;
+}
@@ -0,0 +1,559 @@
+/**
+ * Generic N-state / M-symbol Hidden Markov Model library.
+ *
+ * A model is stored in log space in contiguous row-major arrays:
+ *
+ *   log_init[j]                   log P(state j at the first position)
+ *   log_trans[i * n_states + j]   log P(state j | previous state i)
+ *   log_emit[k * n_states + j]    log P(symbol k | state j)          (categorical emissions)
+ *   lambda[j]                     mean of the Poisson count emitted by state j  (Poisson emissions)
+ *   mix_*[c * n_states + j]       component c of the normal mixture emitted by state j  (Gaussian emissions)
+ *
+ * For Poisson emissions log_emit caches the log pmf of counts 0 .. n_cached - 1 in the categorical layout,
+ * so that decoding looks counts up like symbols and only evaluates lgamma for counts beyond the table.
+ * Every emission kind is evaluated through an hmm_emission_ops (see emission.c), which computes the rows of a
+ * whole block of observations at once; decoders only call it for observations no table row covers.
+ *
+ * Destination states are the innermost, unit-stride dimension of every table, so the Viterbi recurrence
+ * for one position is a dense max-plus loop over all states at once rather than a call per (state, state) pair.
+ *
+ * Functions returning int give 0 on success and -1 on failure with errno set (EINVAL for bad arguments or
+ * observations, ENOMEM when out of memory), so callers can report errors with err(3).
+ *
+ * Build by compiling every .c file in this directory together with the program using it and linking with -lm -pthread.
+ *
+**/
+
+#ifndef HMM_H
+#define HMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// states are reported as hmm_state, which bounds the number of states a model can have
+typedef uint16_t hmm_state;
+#define HMM_MAX_STATES 65535
+
+typedef enum
+{
+    HMM_EMIT_CATEGORICAL,   // symbols 0 .. n_symbols - 1, table in log_emit
+    HMM_EMIT_POISSON,       // non-negative counts, one lambda per state
+    HMM_EMIT_GAUSSIAN,      // real values, a mixture of n_mix normal densities per state
+    HMM_EMIT_CUSTOM         // evaluated by caller-supplied hmm_emission_ops
+} hmm_emission;
+
+// read-only view of an observation sequence in one of the supported storage widths
+typedef enum
+{
+    HMM_OBS_INT,
+    HMM_OBS_U8,
+    HMM_OBS_U16,
+    HMM_OBS_F64             // real values, for Gaussian and custom emissions
+} hmm_obs_type;
+
+typedef struct
+{
+    hmm_obs_type type;
+    size_t length;
+    const void *data;
+} hmm_obs;
+
+struct hmm_model;
+
+// evaluation of one kind of emissions
+typedef struct
+{
+    const char *name;
+    // out[(t - from) * n_states + j] = log P(obs[t] | state j) for positions from .. from + count - 1, which are
+    // within obs. -1 with errno EINVAL for observations of the wrong type or that no state can emit
+    int (*block)(const struct hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out);
+} hmm_emission_ops;
+
+typedef struct hmm_model
+{
+    int n_states;
+    int n_symbols;          // 0 for Poisson, Gaussian and custom emissions
+    hmm_emission emission;
+    const hmm_emission_ops *ops;
+    void *ops_ctx;          // HMM_EMIT_CUSTOM: the caller's parameters, see hmm_model_set_ops
+    double *log_init;
+    double *log_trans;
+    double *log_emit;
+    double *lambda;
+    int n_cached;           // Poisson counts with a row in log_emit
+
+    // Gaussian mixtures, n_mix components per state stored as the terms of
+    // log(w N(x; mean, var)) = mix_norm + mix_scale * (x - mix_mean)^2
+    int n_mix;
+    double *mix_mean;
+    double *mix_scale;      // -1 / (2 var)
+    double *mix_norm;       // log w - log(2 pi var) / 2
+
+    // the finite entries of log_trans as predecessor lists (compressed rows by destination state), kept by
+    // hmm_model_update_sparse for large models with few transitions; NULL when decoding uses the dense table
+    int32_t *pred_start;    // n_states + 1 offsets: the predecessors of j are entries pred_start[j] .. [j + 1] - 1
+    int32_t *pred_state;    // predecessor i, increasing within each list
+    double *pred_log;       // log_trans[i * n_states + j]
+} hmm_model;
+
+
+/* hmm_model.c */
+
+// allocates a model with every probability set to zero (log value -INFINITY)
+hmm_model *hmm_model_new(int n_states, int n_symbols, hmm_emission emission);
+void hmm_model_free(hmm_model *model);
+
+// each setter takes plain probabilities laid out like the corresponding log table and stores their logs
+int hmm_model_set_init(hmm_model *model, const double *p);
+int hmm_model_set_trans(hmm_model *model, const double *p);
+int hmm_model_set_emit(hmm_model *model, const double *p);
+int hmm_model_set_lambda(hmm_model *model, const double *lambda);
+// Gaussian mixtures of n_mix components; weight, mean and var are laid out [c * n_states + j] and every
+// state's weights sum to 1
+int hmm_model_set_gaussian(hmm_model *model, int n_mix, const double *weight, const double *mean,
+                           const double *var);
+// HMM_EMIT_CUSTOM: emissions evaluated by ops, which can find its parameters in model->ops_ctx. Both must
+// outlive the model
+int hmm_model_set_ops(hmm_model *model, const hmm_emission_ops *ops, void *ctx);
+
+// rebuilds the predecessor lists from log_trans, or drops them when the matrix is too dense for them to pay off.
+// set_trans calls it; call it again after writing log_trans directly
+int hmm_model_update_sparse(hmm_model *model);
+
+// extends the Poisson log pmf table to cover counts 0 .. max_count. set_lambda already covers counts up to
+// well past the largest lambda; decoders call this with the largest count of their input
+int hmm_model_cache_counts(hmm_model *model, int max_count);
+
+// the same for the largest count in obs (at most 65535, larger counts are evaluated directly); no-op for
+// categorical models
+int hmm_model_cache_obs(hmm_model *model, const hmm_obs *obs);
+
+
+
+/* emission.c */
+
+// fills row[0 .. n_states - 1] with the log emission probabilities of one observation
+int hmm_emission_row(const hmm_model *model, int obs, double *row);
+
+// out[(t - from) * n_states + j] = log P(obs[t] | state j) for positions from .. from + count - 1 of obs
+int hmm_emission_block(const hmm_model *model, const hmm_obs *obs, size_t from, size_t count, double *out);
+
+
+/* example_models.c */
+
+// how the sequence and output files of an example model are written
+typedef struct
+{
+    const char *name;
+    int symbol_base;        // value in sequence files that stands for symbol 0, e.g. 1 for die rolls
+    const char *labels;     // output character of each state
+} hmm_example;
+
+// builds the model of an example program ("durbin" or "poisson"); info (optional) receives its file conventions
+hmm_model *hmm_example_model(const char *name, const hmm_example **info);
+
+
+/* seqio.c */
+
+// reads a whole sequence file of whitespace separated integers, subtracting base from each, into a malloc'ed
+// array (NULL for an empty file). EINVAL for anything but digits and whitespace. Files named by path may be gzip
+// or zstd compressed (see decompress.c); the _fd variants read fd as it is
+int hmm_read_sequence(const char *path, int base, int **out, size_t *length);
+int hmm_read_sequence_fd(int fd, int base, int **out, size_t *length);
+
+// the same for whitespace separated real numbers, the observations of Gaussian models. EINVAL for anything
+// that is not a finite number
+int hmm_read_values(const char *path, double **out, size_t *length);
+int hmm_read_values_fd(int fd, double **out, size_t *length);
+
+
+/* decompress.c */
+
+typedef enum
+{
+    HMM_COMPRESS_NONE,
+    HMM_COMPRESS_GZIP,      // including BGZF
+    HMM_COMPRESS_ZSTD
+} hmm_compress;
+
+// a file read through its decompressed contents
+typedef struct
+{
+    int fd;                 // read this to end of file in place of the file itself
+    hmm_compress format;
+    struct hmm_input_worker *worker;    // NULL when fd is the file itself
+} hmm_input;
+
+// looks at the start of the file open on fd and, for gzip or zstd, decompresses it on a thread of its own and up
+// to threads more (0 for one per online CPU). fd stays the caller's, to close after hmm_input_close. ENOTSUP
+// for a format this build cannot read (see decompress.c)
+int hmm_input_open(int fd, int threads, hmm_input *in);
+// stops decompressing; -1 with errno EINVAL if the data read through fd was corrupt or cut short
+int hmm_input_close(hmm_input *in);
+
+
+/* pathio.c */
+
+// output formats of a decoded path, see pathio.c
+typedef enum
+{
+    HMM_PATH_LABELS,        // one label character per position
+    HMM_PATH_BINARY,        // one byte per position (two, little-endian, above 256 states)
+    HMM_PATH_SEGMENTS       // one "start end label" line per run of a single state
+} hmm_path_format;
+
+typedef struct hmm_path_writer hmm_path_writer;
+
+// buffered writer of paths to f. labels (optional, NULL prints state numbers) must outlive the writer; wrap,
+// when nonzero, breaks HMM_PATH_LABELS lines after that many positions
+hmm_path_writer *hmm_path_writer_new(FILE *f, hmm_path_format format, const char *labels, int n_states, size_t wrap);
+void hmm_path_writer_free(hmm_path_writer *w);
+
+// appends the next count states of the current path, which may be written in any number of pieces
+int hmm_path_write(hmm_path_writer *w, const hmm_state *states, size_t count);
+// finishes the current path (the final newline or segment) and hands everything buffered to f; the next write
+// starts a new path at position 0
+int hmm_path_end(hmm_path_writer *w);
+// hands everything buffered to f and flushes f, e.g. to pass decided states on while a path is still open
+int hmm_path_flush(hmm_path_writer *w);
+
+
+/* accuracy.c */
+
+typedef struct hmm_accuracy hmm_accuracy;
+
+// comparison of decoded paths with the true states: confusion matrix, agreement and segment boundaries, where a
+// boundary counts as matched when the other path has one at most tolerance positions away (see accuracy.c)
+hmm_accuracy *hmm_accuracy_new(int n_states, size_t tolerance);
+void hmm_accuracy_free(hmm_accuracy *acc);
+
+// compares the next count positions; a path may be added in any number of pieces
+int hmm_accuracy_add(hmm_accuracy *acc, const hmm_state *decoded, const hmm_state *truth, size_t count);
+// writes the counts so far as one JSON object; labels (optional) name the states
+int hmm_accuracy_report(FILE *f, const hmm_accuracy *acc, const char *labels);
+
+// reads up to count states from a state file (the last field of each line, a label or, without labels, a state
+// number) into states; *got is less than count only at the end of the file. EINVAL for an unknown state
+int hmm_read_states(FILE *f, const char *labels, int n_states, hmm_state *states, size_t count, size_t *got);
+
+
+/* sample.c */
+
+// draws obs[0 .. length - 1] from model, and the states that emitted them into states when it is not NULL.
+// The same seed always gives the same sequence. EDOM if the chain reaches a state it cannot leave or emit from,
+// ENOTSUP for models that emit real values
+int hmm_sample(const hmm_model *model, size_t length, uint64_t seed, int *obs, hmm_state *states);
+
+
+/* stats.c */
+
+// Optional instrumentation of the hot paths, compiled in when the library and the program are both built with
+// -DHMM_STATS. Without it the macros below expand to nothing and stats.c is empty, so there is no cost at all.
+// Each phase accumulates its calls, wall and CPU seconds, bytes and symbols; see stats.c for what is counted.
+typedef enum
+{
+    HMM_PHASE_READ,         // loading sequence files
+    HMM_PHASE_FORWARD,      // the Viterbi score recurrence
+    HMM_PHASE_TRACEBACK,    // recovering Viterbi paths
+    HMM_PHASE_POSTERIOR,    // Forward-Backward
+    HMM_PHASE_EMISSION,     // evaluating emission densities without a table row, within the phases above
+    HMM_PHASE_OUTPUT,       // printing results, timed by the programs
+    HMM_N_PHASES
+} hmm_phase;
+
+#ifdef HMM_STATS
+typedef struct
+{
+    double wall;
+    double cpu;
+} hmm_stats_mark;
+
+void hmm_stats_start(hmm_stats_mark *mark);
+// adds the time since mark, bytes and symbols to phase
+void hmm_stats_stop(hmm_phase phase, const hmm_stats_mark *mark, uint64_t bytes, uint64_t symbols);
+// writes the totals so far as one JSON object to path, or to stderr when path is NULL
+int hmm_stats_report(const char *path);
+
+#define HMM_STATS_START(mark) hmm_stats_mark mark; hmm_stats_start(&mark)
+#define HMM_STATS_STOP(phase, mark, bytes, symbols) hmm_stats_stop((phase), &(mark), (bytes), (symbols))
+#define HMM_STATS_REPORT(path) hmm_stats_report(path)
+#else
+#define HMM_STATS_START(mark)
+#define HMM_STATS_STOP(phase, mark, bytes, symbols)
+#define HMM_STATS_REPORT(path)
+#endif
+
+
+/* seqfile.c */
+
+// binary sequence file mapped into memory
+typedef struct
+{
+    hmm_obs obs;            // symbols, pointing into the mapping
+    int n_symbols;          // alphabet size recorded in the header
+    void *map;
+    size_t map_length;
+} hmm_seqfile;
+
+// 1 if path starts with the binary sequence file magic, 0 if not, -1 if it cannot be read
+int hmm_seqfile_is_binary(const char *path);
+int hmm_seqfile_open(const char *path, hmm_seqfile *file);
+// reads the whole mapping into memory now, for readers running ahead of the decoders, so that decoding the file
+// later does not wait on storage
+int hmm_seqfile_prefetch(const hmm_seqfile *file);
+void hmm_seqfile_close(hmm_seqfile *file);
+// writes seq[0 .. length - 1] with the narrowest symbol width that holds its largest value
+int hmm_seqfile_write(const char *path, const int *seq, size_t length);
+
+
+/* model_file.c */
+
+// model loaded from a file, with the file conventions of hmm_example
+typedef struct
+{
+    hmm_model *model;
+    hmm_example info;       // name is the path; labels default to 0-9A-Za-z when the file has none and the
+                            // model has at most 62 states, NULL otherwise
+    char *storage;          // owns the labels
+} hmm_modelfile;
+
+// reads a text or binary model file (formats in model_file.c); EINVAL for a malformed file
+int hmm_modelfile_open(const char *path, hmm_modelfile *file);
+// the example model of that name (see hmm_example_model) if there is one, otherwise hmm_modelfile_open
+int hmm_modelfile_load(const char *name, hmm_modelfile *file);
+void hmm_modelfile_close(hmm_modelfile *file);
+
+// writes model in the text format; info (optional) supplies the base and labels
+int hmm_modelfile_print(FILE *f, const hmm_model *model, const hmm_example *info);
+int hmm_modelfile_write(const char *path, const hmm_model *model, const hmm_example *info);
+// the same in the binary format, which loads without any parsing or recomputation
+int hmm_modelfile_write_binary(const char *path, const hmm_model *model, const hmm_example *info);
+
+
+/* kernel.c */
+
+// name of the max-plus kernel in use: "avx512", "avx2", "neon" or "scalar". Chosen for the CPU on first use,
+// or from the HMM_KERNEL environment variable when it names a supported kernel
+const char *hmm_kernel_name(void);
+// switches every later decode to the named kernel; -1 with errno ENOTSUP if it is unknown or not supported here
+int hmm_kernel_select(const char *name);
+
+
+/* viterbi.c */
+
+// how backpointers are kept for the traceback, see trace.c
+typedef enum
+{
+    HMM_TRACE_BYTES,        // uint8_t per state and position (uint16_t above 256 states)
+    HMM_TRACE_PACKED        // ceil(log2 n_states) bits per state and position
+} hmm_trace;
+
+typedef enum
+{
+    HMM_VITERBI_FULL,       // backpointers for every position, O(T * N) trace memory
+    HMM_VITERBI_CHECKPOINT, // score columns every `checkpoint` positions, segments recomputed during traceback
+    HMM_VITERBI_PARALLEL,   // chunks of `chunk` positions on `threads` threads, see viterbi_parallel.c
+    HMM_VITERBI_BEAM        // approximate: only the best states of every position, see viterbi_beam.c
+} hmm_viterbi_mode;
+
+// type of the path scores, see viterbi_narrow.c. Every type breaks ties alike (the higher-numbered
+// predecessor), so narrow scores change the path only where candidates differ by less than their rounding
+typedef enum
+{
+    HMM_SCORE_DOUBLE,       // double log scores
+    HMM_SCORE_FLOAT,        // float log scores, HMM_VITERBI_FULL only
+    HMM_SCORE_FIXED         // int32_t log scores in steps of 2^-16 nats, HMM_VITERBI_FULL only
+} hmm_score;
+
+// where hmm_viterbi_batch decodes; every backend gives the same paths and scores
+typedef enum
+{
+    HMM_BACKEND_CPU,        // worker threads, see batch.c
+    HMM_BACKEND_CUDA        // a CUDA device, in a build with batch_cuda.cu; HMM_VITERBI_FULL in doubles only
+} hmm_backend;
+
+// seconds spent in the phases of one decode, see hmm_viterbi_opts.timing
+typedef struct
+{
+    double forward;         // the score recurrence over every position (HMM_VITERBI_PARALLEL: phases 1 to 3)
+    double traceback;       // recovering the path, including any recomputed segments
+} hmm_viterbi_timing;
+
+typedef struct
+{
+    hmm_viterbi_mode mode;
+    hmm_trace trace;
+    size_t checkpoint;      // HMM_VITERBI_CHECKPOINT interval, 0 for sqrt(length)
+    size_t chunk;           // HMM_VITERBI_PARALLEL chunk length, 0 for 65536
+    int threads;            // HMM_VITERBI_PARALLEL threads, 0 for one per online CPU
+    size_t beam_width;      // HMM_VITERBI_BEAM states kept per position, 0 for no limit
+    double beam_threshold;  // HMM_VITERBI_BEAM log score margin below the best state, 0 for no margin
+    int lanes;              // hmm_viterbi_batch: small-model sequences decoded together, 8 or 16; 0 for 8, 1 for none
+    hmm_backend backend;    // hmm_viterbi_batch, default HMM_BACKEND_CPU
+    hmm_score score;        // default HMM_SCORE_DOUBLE
+    hmm_viterbi_timing *timing;     // filled in by every decode when not NULL; ignored by hmm_viterbi_batch
+} hmm_viterbi_opts;
+
+// defaults used when a decoder is passed NULL options
+void hmm_viterbi_opts_init(hmm_viterbi_opts *opts);
+
+// decodes the most likely state path for obs[0 .. length - 1] into path; log_prob (optional) receives its score
+int hmm_viterbi(const hmm_model *model, const int *obs, size_t length, hmm_state *path, double *log_prob,
+                const hmm_viterbi_opts *opts);
+
+// the same for observations in any hmm_obs layout, e.g. a mapped binary sequence file
+int hmm_viterbi_obs(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                    const hmm_viterbi_opts *opts);
+
+// Ties between equal candidates always go to the highest-numbered state, both for the predecessor at every step
+// and for the final state of a path. Every kernel, SIMD lanes, predecessor lists, checkpointing, hmm_decoder and
+// hmm_viterbi_batch at any thread count on any backend therefore give bit-identical HMM_VITERBI_FULL paths and
+// scores in doubles. HMM_VITERBI_PARALLEL adds in another order and gives one result for any thread count at a
+// given chunk length; narrow scores and beams apply the rule to the candidates they have. hmm_bench -V checks all
+// of these against each other.
+
+// index of the largest of v[0 .. n - 1] under that rule: the highest index among equal values
+int hmm_argmax(const double *v, int n);
+
+
+/* decoder.c */
+
+typedef struct hmm_decoder hmm_decoder;
+
+// context for repeated HMM_VITERBI_FULL decodes with model, which must outlive it: one arena sized for sequences
+// of up to max_length positions, reused by every decode. opts (NULL for defaults) selects the trace and timing;
+// ENOTSUP for other modes or narrow scores. Poisson tables must be cached for the counts to come, as for batches
+hmm_decoder *hmm_decoder_new(const hmm_model *model, size_t max_length, const hmm_viterbi_opts *opts);
+void hmm_decoder_free(hmm_decoder *dec);
+
+// hmm_viterbi_obs in the decoder's arena: no allocation unless obs is longer than any sequence before it, when the
+// arena grows to fit (and stays as it was if that fails)
+int hmm_decoder_viterbi(hmm_decoder *dec, const hmm_obs *obs, hmm_state *path, double *log_prob);
+
+
+/* posterior.c */
+
+typedef enum
+{
+    HMM_POSTERIOR_FULL,         // two passes, a backward column for every position
+    HMM_POSTERIOR_CHECKPOINT    // three passes, backward columns every `checkpoint` positions plus one segment
+} hmm_posterior_mode;
+
+typedef struct
+{
+    hmm_posterior_mode mode;
+    size_t checkpoint;          // HMM_POSTERIOR_CHECKPOINT segment length, 0 for sqrt(length)
+} hmm_posterior_opts;
+
+// defaults used when passed NULL options
+void hmm_posterior_opts_init(hmm_posterior_opts *opts);
+
+// receives P(state j at position | all observations) for j = 0 .. n_states - 1; positions arrive in increasing
+// order and nonzero aborts the decode
+typedef int (*hmm_posterior_sink)(void *ctx, size_t position, const double *posterior);
+
+// Forward-Backward over obs, handing each position's posteriors to sink; log_like (optional) receives
+// log P(obs). -1 with errno EDOM if the observations are impossible under the model
+int hmm_posterior_each(const hmm_model *model, const hmm_obs *obs, double *log_like, const hmm_posterior_opts *opts,
+                       hmm_posterior_sink sink, void *ctx);
+
+// the same into posterior[t * n_states + j], obs->length * n_states doubles
+int hmm_posterior_obs(const hmm_model *model, const hmm_obs *obs, double *posterior, double *log_like,
+                      const hmm_posterior_opts *opts);
+int hmm_posterior(const hmm_model *model, const int *obs, size_t length, double *posterior, double *log_like,
+                  const hmm_posterior_opts *opts);
+
+
+/* train.c */
+
+typedef enum
+{
+    HMM_TRAIN_BAUM_WELCH,   // expected counts from Forward-Backward
+    HMM_TRAIN_VITERBI       // counts along the Viterbi path
+} hmm_train_method;
+
+typedef struct
+{
+    hmm_train_method method;
+    int max_iterations;     // parameter updates, default 100
+    double tolerance;       // stop once an update improves the log-likelihood by less than tolerance * |log-likelihood|
+    double pseudocount;     // added to every count before normalising, default 0
+    int threads;            // E-step threads, 0 for one per online CPU
+    hmm_posterior_opts posterior;   // memory mode of the Baum-Welch E-step
+} hmm_train_opts;
+
+typedef struct
+{
+    int iterations;         // parameter updates made
+    double log_like;        // log-likelihood of all sequences under the returned model (Viterbi: total path score)
+} hmm_train_result;
+
+// defaults used when passed NULL options
+void hmm_train_opts_init(hmm_train_opts *opts);
+
+// re-estimates every parameter of model in place from seqs[0 .. count - 1]; result is optional. -1 with errno
+// EDOM if a sequence is impossible under the model, ENOTSUP for Gaussian and custom emissions
+int hmm_train(hmm_model *model, const hmm_obs *seqs, size_t count, const hmm_train_opts *opts,
+              hmm_train_result *result);
+
+
+/* batch.c */
+
+// one sequence of a batch: obs and path (obs.length entries) are supplied, the rest is filled in
+typedef struct
+{
+    hmm_obs obs;
+    hmm_state *path;
+    double log_prob;
+    int status;             // hmm_viterbi_obs result
+    int error;              // its errno when status is -1
+} hmm_batch_item;
+
+// decodes every item on a pool of threads (0 for one per online CPU) sharing model read-only, or on the device
+// of opts->backend. Returns -1 with the errno of the first failed item if any failed; the other items are still
+// decoded. ENOTSUP if the backend is not available or cannot decode with model and opts
+int hmm_viterbi_batch(const hmm_model *model, hmm_batch_item *items, size_t count, int threads,
+                      const hmm_viterbi_opts *opts);
+
+// whether this build and machine have backend: always for HMM_BACKEND_CPU, and for HMM_BACKEND_CUDA when the
+// library was built with -DHMM_CUDA and batch_cuda.cu and a device is present
+int hmm_backend_available(hmm_backend backend);
+
+
+/* stream.c */
+
+typedef struct hmm_stream hmm_stream;
+
+// receives decided states for positions position .. position + count - 1, in order; nonzero aborts the push
+typedef int (*hmm_stream_sink)(void *ctx, size_t position, const hmm_state *states, size_t count);
+
+// online decoder for model, which must outlive it. max_lag 0 waits for the survivor paths to coalesce,
+// otherwise a position is decided at the latest once max_lag newer observations have been pushed
+hmm_stream *hmm_stream_new(const hmm_model *model, size_t max_lag, hmm_stream_sink sink, void *ctx);
+void hmm_stream_free(hmm_stream *stream);
+
+int hmm_stream_push(hmm_stream *stream, int obs);
+
+// decides the remaining positions from the best final state and resets the stream for a new sequence
+int hmm_stream_finish(hmm_stream *stream);
+
+
+/* incremental.c */
+
+typedef struct hmm_incremental hmm_incremental;
+
+// decodes obs (not empty) with model and keeps what it takes to follow edits of the observations: a score column
+// every interval positions (0 for 1024) and the path. model and the data of obs must outlive the decoder; the
+// observations may be changed in place between updates, the length may not
+hmm_incremental *hmm_incremental_new(const hmm_model *model, const hmm_obs *obs, size_t interval);
+void hmm_incremental_free(hmm_incremental *inc);
+
+// re-decodes after observations from .. from + count - 1 were changed, recomputing only the positions they can
+// influence. After a failure the path is undefined until an update of the whole sequence succeeds
+int hmm_incremental_update(hmm_incremental *inc, size_t from, size_t count);
+
+// the current path of obs->length states, valid until the next update, and its score in log_prob (optional)
+const hmm_state *hmm_incremental_path(const hmm_incremental *inc, double *log_prob);
+
+#endif
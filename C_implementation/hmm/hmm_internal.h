@@ -0,0 +1,268 @@
+/**
+ * Interfaces shared between the decoders in this directory. Not part of the public API in hmm.h.
+**/
+
+#ifndef HMM_INTERNAL_H
+#define HMM_INTERNAL_H
+
+#include <time.h>
+
+#include "hmm.h"
+
+
+// symbol t of an observation view; -1, which no table covers, for real values
+static inline int obs_at(const hmm_obs *obs, size_t t)
+{
+    switch (obs->type)
+    {
+        case HMM_OBS_U8:
+            return ((const uint8_t *) obs->data)[t];
+        case HMM_OBS_U16:
+            return ((const uint16_t *) obs->data)[t];
+        case HMM_OBS_F64:
+            return -1;
+        default:
+            return ((const int *) obs->data)[t];
+    }
+}
+
+// observation t as a real value, whatever the layout
+static inline double obs_value(const hmm_obs *obs, size_t t)
+{
+    return obs->type == HMM_OBS_F64 ? ((const double *) obs->data)[t] : obs_at(obs, t);
+}
+
+
+// monotonic clock in seconds when a decode is timed (see hmm_viterbi_timing), 0 otherwise
+static inline double timing_mark(const hmm_viterbi_opts *opts)
+{
+    struct timespec now;
+    if (!opts->timing)
+    {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// records the phases of one decode from the marks taken at its start, after its forward pass and at its end
+static inline void timing_record(const hmm_viterbi_opts *opts, double start, double forward_done, double done)
+{
+    if (opts->timing)
+    {
+        opts->timing->forward = forward_done - start;
+        opts->timing->traceback = done - forward_done;
+    }
+}
+
+
+/* emission.c */
+
+// the built-in emission kinds; emission_unset fails every evaluation, for custom models without their ops
+extern const hmm_emission_ops emission_categorical;
+extern const hmm_emission_ops emission_poisson;
+extern const hmm_emission_ops emission_gaussian;
+extern const hmm_emission_ops emission_unset;
+
+// the log pmf of count k for every state of a Poisson model
+void poisson_row(const hmm_model *model, int k, double *row);
+
+// log emission row of one symbol or count: a pointer into the model's tables, or into scratch (n_states doubles)
+// when no table row covers it. NULL with errno EINVAL for impossible observations
+const double *emission_lookup(const hmm_model *model, int obs, double *scratch);
+
+// the same for position t of obs, in any layout
+const double *emission_at(const hmm_model *model, const hmm_obs *obs, size_t t, double *scratch);
+
+// emission rows of the positions of one observation sequence, for a decoder visiting them in either direction.
+// Symbols with a table row are looked up; all other positions are evaluated by the model's hmm_emission_ops a
+// block at a time, starting at the position asked for and running in the direction of travel, into a buffer the
+// decoder provides
+typedef struct
+{
+    const hmm_model *model;
+    const hmm_obs *obs;
+    const double *table;    // log_emit, NULL for emissions without a table
+    int rows;               // symbols or counts with a row in table
+    size_t from;            // first position held in buf
+    size_t count;           // positions held in buf
+    size_t cap;             // positions buf has room for
+    double *buf;            // the caller's, emit_block_size doubles
+} emit_block;
+
+// doubles of the buffer of an emit_block for a model of n_states
+size_t emit_block_size(int n_states);
+void emit_block_init(emit_block *b, const hmm_model *model, const hmm_obs *obs, double *buf);
+// evaluates the block around position t; NULL with errno set when the model fails on it
+const double *emit_block_fill(emit_block *b, size_t t);
+
+// log emission row of position t, valid until the next call
+static inline const double *emit_row(emit_block *b, size_t t)
+{
+    size_t n = b->model->n_states;
+    if (b->table)
+    {
+        int k = obs_at(b->obs, t);
+        if (k >= 0 && k < b->rows)
+        {
+            return b->table + (size_t) k * n;
+        }
+    }
+    if (t - b->from < b->count)
+    {
+        return b->buf + (t - b->from) * n;
+    }
+    return emit_block_fill(b, t);
+}
+
+
+/* trace.c */
+
+// backpointer columns for positions 0 .. length - 1 of one decode; column 0 is never written
+typedef struct
+{
+    hmm_trace kind;
+    int n_states;
+    int bits;           // bits per backpointer, HMM_TRACE_PACKED only
+    size_t length;
+    void *data;
+} trace_store;
+
+int trace_init(trace_store *trace, hmm_trace kind, int n_states, size_t length);
+void trace_free(trace_store *trace);
+// bytes of data a trace of length columns needs, 0 if that is more than can be addressed
+size_t trace_size(hmm_trace kind, int n_states, size_t length);
+// sets up a trace on caller-owned data of trace_size bytes, e.g. in an arena; trace_free must not be called on it
+void trace_attach(trace_store *trace, hmm_trace kind, int n_states, size_t length, void *data);
+void trace_put(trace_store *trace, size_t t, const int32_t *bp);
+int trace_get(const trace_store *trace, size_t t, int state);
+
+
+/* kernel.c */
+
+// one column of the recurrence: cur[j] = emit[j] + max_i (prev[i] + trans[i][j]), bp[j] = argmax_i, using the
+// kernel chosen for this CPU. Every kernel gives bit-identical results
+void viterbi_step(int n, const double *restrict prev, const double *restrict trans,
+                  const double *restrict emit, double *restrict cur, int32_t *restrict bp);
+
+
+/* kernel_sparse.c */
+
+// viterbi_step over the predecessor lists of model, which must have them; the same results in O(edges)
+void viterbi_step_sparse(const hmm_model *model, const double *restrict prev, const double *restrict emit,
+                         double *restrict cur, int32_t *restrict bp);
+
+
+/* kernel_small.c */
+
+// viterbi_advance for one fixed small state count, with the same results; rows is the buffer of its emit_block
+typedef int (*small_advance_fn)(const hmm_model *model, const hmm_obs *obs, size_t from, size_t to, double *col,
+                                double *rows, trace_store *trace, size_t trace_offset);
+
+// the specialisation for n_states (2, 3, 4 or 8), NULL for every other state count
+small_advance_fn small_advance(int n_states);
+
+
+/* viterbi.c */
+
+// one column of the recurrence with the transitions of model: its predecessor lists when it has them, otherwise
+// viterbi_step on the dense table
+void viterbi_column(const hmm_model *model, const double *restrict prev, const double *restrict emit,
+                    double *restrict cur, int32_t *restrict bp);
+
+// scores of the first position of obs: start distribution plus emission
+int viterbi_first_column(const hmm_model *model, const hmm_obs *obs, double *col);
+
+// doubles of the work buffer of viterbi_advance: a second score column and the rows of an emit_block
+size_t viterbi_work_size(int n_states);
+
+// advances the score column col from position from to position to, recording the backpointers of position t
+// as column t - trace_offset of trace when trace is not NULL. work holds viterbi_work_size doubles, bp n_states
+// entries; nothing is allocated
+int viterbi_advance(const hmm_model *model, const hmm_obs *obs, size_t from, size_t to, double *col,
+                    double *work, int32_t *bp, trace_store *trace, size_t trace_offset);
+
+// HMM_VITERBI_FULL into caller-owned buffers: trace for obs->length positions, scores of n_states +
+// viterbi_work_size doubles and bp of n_states entries. obs is not empty
+int viterbi_full_run(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                     const hmm_viterbi_opts *opts, trace_store *trace, double *scores, int32_t *bp);
+
+
+/* batch_cuda.cu */
+
+// hmm_viterbi_batch on a CUDA device, and whether there is one. Defined in batch.c, failing with ENOTSUP, in
+// builds without -DHMM_CUDA
+int cuda_available(void);
+int cuda_viterbi_batch(const hmm_model *model, hmm_batch_item *items, size_t count, const hmm_viterbi_opts *opts);
+
+
+/* batch_lanes.c */
+
+// sequences per group and the largest model and sequence decoded in lanes
+#define LANES_MAX 16
+#define LANES_MAX_STATES 8
+#define LANES_MAX_LENGTH 65536
+
+// emission rows and terms and backpointers of a group, kept by a batch worker from group to group
+typedef struct
+{
+    int32_t *rows;
+    double *emits;
+    uint8_t *trace;
+    size_t cap;             // positions the trace has room for
+} lanes_arena;
+
+// whether model can be decoded in lanes: dense, at most LANES_MAX_STATES states and emissions in a table
+int lanes_supported(const hmm_model *model);
+// whether obs can join a group: symbols, 1 .. LANES_MAX_LENGTH of them
+int lanes_fit(const hmm_obs *obs);
+// decodes items[0 .. count - 1] (count <= lanes, 8 or 16, each fitting) side by side, with the results of
+// HMM_VITERBI_FULL. Items with an observation that has no table row, e.g. an uncached Poisson count, are left
+// to be decoded alone: bit l of left is set for items[l]. -1 with errno ENOMEM, leaving every item untouched
+int lanes_decode(const hmm_model *model, hmm_batch_item *const *items, int count, int lanes, lanes_arena *arena,
+                 uint32_t *left);
+void lanes_arena_free(lanes_arena *arena);
+
+
+/* parallel.c */
+
+// threads to use for a request of threads, 0 meaning one per online CPU
+int parallel_threads(int threads);
+
+// runs task(ctx, 0 .. count - 1) on up to threads threads; -1 with the errno of a failed task if any failed
+int parallel_for(int threads, size_t count, int (*task)(void *ctx, size_t i), void *ctx);
+
+
+/* posterior.c */
+
+// hmm_posterior_each, also adding the expected transition counts sum_t P(s[t - 1] = i, s[t] = j | obs) into
+// trans_counts[i * n_states + j] when it is not NULL
+int posterior_expect(const hmm_model *model, const hmm_obs *obs, double *log_like, const hmm_posterior_opts *opts,
+                     hmm_posterior_sink sink, void *ctx, double *trans_counts);
+
+
+/* viterbi_beam.c */
+
+int viterbi_beam(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                 const hmm_viterbi_opts *opts);
+
+
+/* viterbi_checkpoint.c */
+
+int viterbi_checkpoint(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                       const hmm_viterbi_opts *opts);
+
+
+/* viterbi_narrow.c */
+
+// HMM_VITERBI_FULL with the float or fixed-point scores of opts->score; -1 with errno ENOTSUP for other modes
+int viterbi_narrow(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                   const hmm_viterbi_opts *opts);
+
+
+/* viterbi_parallel.c */
+
+int viterbi_parallel(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                     const hmm_viterbi_opts *opts);
+
+#endif
@@ -0,0 +1,359 @@
+/**
+ * Allocation and parameter setup for hmm_model. See hmm.h for the table layout.
+ *
+ * Poisson emissions are evaluated as k log(lambda) - lambda - lgamma(k + 1), which stays finite for any count
+ * (unlike a factorial in an int, which overflows past 12). Rows for the counts a decode will meet are computed
+ * once into log_emit, so the recurrence only does a table lookup.
+ *
+ * Gaussian mixtures keep each component as the two terms of its log density that do not depend on the
+ * observation, so evaluating one (see emission.c) is a multiply-add per state and component.
+**/
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+// upper bounds on the counts set_lambda caches by itself and on what hmm_model_cache_obs asks for
+#define POISSON_DEFAULT_CACHE 4096
+#define POISSON_MAX_CACHE 65535
+
+// predecessor lists are kept for models of at least SPARSE_MIN_STATES states with at most one finite transition
+// in SPARSE_DENSITY: below that the dense SIMD kernels and the unrolled small-model loops are faster
+#define SPARSE_MIN_STATES 16
+#define SPARSE_DENSITY 8
+
+
+static double *log_table_new(size_t n)
+{
+    double *table = malloc(n * sizeof(double));
+    if (!table)
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        table[i] = -INFINITY;
+    }
+    return table;
+}
+
+static int set_log_table(double *table, const double *p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!(p[i] >= 0 && p[i] <= 1))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        table[i] = log(p[i]);
+    }
+    return 0;
+}
+
+
+hmm_model *hmm_model_new(int n_states, int n_symbols, hmm_emission emission)
+{
+    if (n_states < 1 || n_states > HMM_MAX_STATES ||
+        (emission == HMM_EMIT_CATEGORICAL && n_symbols < 1) ||
+        (emission != HMM_EMIT_CATEGORICAL && n_symbols != 0) || emission < HMM_EMIT_CATEGORICAL ||
+        emission > HMM_EMIT_CUSTOM)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    hmm_model *model = calloc(1, sizeof(*model));
+    if (!model)
+    {
+        return NULL;
+    }
+    model->n_states = n_states;
+    model->n_symbols = n_symbols;
+    model->emission = emission;
+
+    size_t n = n_states;
+    model->log_init = log_table_new(n);
+    model->log_trans = log_table_new(n * n);
+    int have_emit = 1;
+    if (emission == HMM_EMIT_CATEGORICAL)
+    {
+        model->ops = &emission_categorical;
+        model->log_emit = log_table_new((size_t) n_symbols * n);
+        have_emit = model->log_emit != NULL;
+    }
+    else if (emission == HMM_EMIT_POISSON)
+    {
+        model->ops = &emission_poisson;
+        model->lambda = calloc(n, sizeof(double));
+        have_emit = model->lambda != NULL;
+    }
+    else
+    {
+        // mixtures are allocated by hmm_model_set_gaussian once their size is known
+        model->ops = emission == HMM_EMIT_GAUSSIAN ? &emission_gaussian : &emission_unset;
+    }
+
+    if (!model->log_init || !model->log_trans || !have_emit)
+    {
+        hmm_model_free(model);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return model;
+}
+
+void hmm_model_free(hmm_model *model)
+{
+    if (!model)
+    {
+        return;
+    }
+    free(model->log_init);
+    free(model->log_trans);
+    free(model->log_emit);
+    free(model->lambda);
+    free(model->mix_mean);
+    free(model->mix_scale);
+    free(model->mix_norm);
+    free(model->pred_start);
+    free(model->pred_state);
+    free(model->pred_log);
+    free(model);
+}
+
+
+int hmm_model_set_init(hmm_model *model, const double *p)
+{
+    return set_log_table(model->log_init, p, model->n_states);
+}
+
+int hmm_model_set_trans(hmm_model *model, const double *p)
+{
+    size_t n = model->n_states;
+    if (set_log_table(model->log_trans, p, n * n) != 0)
+    {
+        return -1;
+    }
+    return hmm_model_update_sparse(model);
+}
+
+int hmm_model_update_sparse(hmm_model *model)
+{
+    size_t n = model->n_states;
+    size_t edges = 0;
+    for (size_t k = 0; k < n * n; k++)
+    {
+        edges += model->log_trans[k] > -INFINITY;
+    }
+
+    free(model->pred_start);
+    free(model->pred_state);
+    free(model->pred_log);
+    model->pred_start = NULL;
+    model->pred_state = NULL;
+    model->pred_log = NULL;
+    if (n < SPARSE_MIN_STATES || edges * SPARSE_DENSITY > n * n || edges > INT32_MAX)
+    {
+        return 0;
+    }
+
+    int32_t *start = malloc((n + 1) * sizeof(int32_t));
+    int32_t *state = malloc((edges ? edges : 1) * sizeof(int32_t));
+    double *logp = malloc((edges ? edges : 1) * sizeof(double));
+    if (!start || !state || !logp)
+    {
+        free(start);
+        free(state);
+        free(logp);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // column j of log_trans, top to bottom, so predecessors come in increasing order
+    size_t e = 0;
+    for (size_t j = 0; j < n; j++)
+    {
+        start[j] = (int32_t) e;
+        for (size_t i = 0; i < n; i++)
+        {
+            double a = model->log_trans[i * n + j];
+            if (a > -INFINITY)
+            {
+                state[e] = (int32_t) i;
+                logp[e] = a;
+                e++;
+            }
+        }
+    }
+    start[n] = (int32_t) e;
+    model->pred_start = start;
+    model->pred_state = state;
+    model->pred_log = logp;
+    return 0;
+}
+
+int hmm_model_set_emit(hmm_model *model, const double *p)
+{
+    if (model->emission != HMM_EMIT_CATEGORICAL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return set_log_table(model->log_emit, p, (size_t) model->n_symbols * model->n_states);
+}
+
+int hmm_model_set_lambda(hmm_model *model, const double *lambda)
+{
+    if (model->emission != HMM_EMIT_POISSON)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int j = 0; j < model->n_states; j++)
+    {
+        if (!(lambda[j] > 0 && isfinite(lambda[j])))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    memcpy(model->lambda, lambda, model->n_states * sizeof(double));
+
+    // counts more than 10 standard deviations above the largest mean should essentially never be observed
+    double top = 0;
+    for (int j = 0; j < model->n_states; j++)
+    {
+        top = lambda[j] > top ? lambda[j] : top;
+    }
+    int cover = (int) ceil(top + 10 * sqrt(top)) + 16;
+    if (cover > POISSON_DEFAULT_CACHE)
+    {
+        cover = POISSON_DEFAULT_CACHE;
+    }
+
+    // the lambdas changed, so every cached row is stale
+    model->n_cached = 0;
+    return hmm_model_cache_counts(model, cover);
+}
+
+int hmm_model_set_gaussian(hmm_model *model, int n_mix, const double *weight, const double *mean,
+                           const double *var)
+{
+    size_t n = model->n_states;
+    if (model->emission != HMM_EMIT_GAUSSIAN || n_mix < 1 || (size_t) n_mix > SIZE_MAX / sizeof(double) / n)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t count = (size_t) n_mix * n;
+    for (size_t j = 0; j < n; j++)
+    {
+        double total = 0;
+        for (size_t k = j; k < count; k += n)
+        {
+            if (!(weight[k] >= 0 && weight[k] <= 1) || !isfinite(mean[k]) || !(var[k] > 0 && isfinite(var[k])))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            total += weight[k];
+        }
+        // the same slack as for probabilities typed into a model file with a few digits
+        if (fabs(total - 1) > 1e-6)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    double *m = malloc(count * sizeof(double));
+    double *scale = malloc(count * sizeof(double));
+    double *norm = malloc(count * sizeof(double));
+    if (!m || !scale || !norm)
+    {
+        free(m);
+        free(scale);
+        free(norm);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t k = 0; k < count; k++)
+    {
+        m[k] = mean[k];
+        scale[k] = -0.5 / var[k];
+        norm[k] = log(weight[k]) - 0.5 * log(2 * M_PI * var[k]);
+    }
+
+    free(model->mix_mean);
+    free(model->mix_scale);
+    free(model->mix_norm);
+    model->n_mix = n_mix;
+    model->mix_mean = m;
+    model->mix_scale = scale;
+    model->mix_norm = norm;
+    return 0;
+}
+
+int hmm_model_set_ops(hmm_model *model, const hmm_emission_ops *ops, void *ctx)
+{
+    if (model->emission != HMM_EMIT_CUSTOM || !ops || !ops->block)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    model->ops = ops;
+    model->ops_ctx = ctx;
+    return 0;
+}
+
+int hmm_model_cache_counts(hmm_model *model, int max_count)
+{
+    if (model->emission != HMM_EMIT_POISSON || max_count < 0 || max_count == INT_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (max_count < model->n_cached)
+    {
+        return 0;
+    }
+
+    size_t n = model->n_states;
+    double *table = realloc(model->log_emit, ((size_t) max_count + 1) * n * sizeof(double));
+    if (!table)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int k = model->n_cached; k <= max_count; k++)
+    {
+        poisson_row(model, k, table + (size_t) k * n);
+    }
+    model->log_emit = table;
+    model->n_cached = max_count + 1;
+    return 0;
+}
+
+int hmm_model_cache_obs(hmm_model *model, const hmm_obs *obs)
+{
+    if (model->emission != HMM_EMIT_POISSON)
+    {
+        return 0;
+    }
+    int largest = 0;
+    for (size_t t = 0; t < obs->length; t++)
+    {
+        int k = obs_at(obs, t);
+        largest = k > largest ? k : largest;
+    }
+    return hmm_model_cache_counts(model, largest < POISSON_MAX_CACHE ? largest : POISSON_MAX_CACHE);
+}
+
@@ -0,0 +1,282 @@
+/**
+ * Viterbi decoding that follows local edits of the observations without decoding the whole sequence again.
+ *
+ * The decoder keeps the path of every position and, like viterbi_checkpoint.c, the score column of every k-th
+ * position only. Each column is renormalised to a maximum of exactly zero as it is computed, the maxima taken
+ * out being summed per segment of k positions for the path score. Once the survivor paths of all states pass
+ * through the best state of some position, the columns after it no longer depend on anything before it, so two
+ * sequences that differ in a few positions soon give bit-identical normalised columns again.
+ *
+ * An update for positions from .. from + count - 1 therefore recomputes the columns from the checkpoint before
+ * from, overwriting the saved ones, until a checkpoint at or after the edit comes out exactly as it was saved.
+ * Every later column, backpointer and the final state are then unchanged, and so is the path after that
+ * checkpoint. The traceback is patched from there segment by segment, each recomputed from its saved column as
+ * in viterbi_checkpoint.c, until it reaches a position before the edit where it meets the old path. An edit
+ * costs O(N * (k + d)) for d positions of influence, typically tens to hundreds, instead of O(N * T).
+ *
+ * The result of any series of updates is bit for bit that of a new decoder on the edited sequence. The per
+ * position renormalisation rounds differently from HMM_VITERBI_FULL, so paths can differ from hmm_viterbi_obs
+ * only where candidates tie to within rounding; the score is the same up to rounding.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+#define INCREMENTAL_INTERVAL 1024
+
+
+struct hmm_incremental
+{
+    const hmm_model *model;
+    hmm_obs obs;            // the caller's view; the observations themselves change between updates
+    size_t k;               // positions between saved columns
+    size_t n_segments;      // segments c * k .. min((c + 1) * k, length - 1), 0 for a single position
+    double *saved;          // normalised column at position c * k of every segment (at 0 if there are none)
+    double *offset;         // per segment: the sum of the maxima taken out of its columns after the first
+    double first_offset;    // the maximum taken out of column 0
+    int final_state;
+    double log_prob;
+    hmm_state *path;
+    double *scores;         // col and work, n_states doubles each, then the rows of an emit_block
+    int32_t *bp;
+    trace_store trace;      // backpointers of one segment
+};
+
+
+// shifts col to a maximum of zero, returning the maximum; columns without a finite maximum stay as they are
+static double normalise(double *col, int n)
+{
+    double top = col[hmm_argmax(col, n)];
+    if (isfinite(top))
+    {
+        for (int j = 0; j < n; j++)
+        {
+            col[j] -= top;
+        }
+    }
+    return top;
+}
+
+// advances the normalised column inc->scores from position from to position to, adding up the maxima taken out
+// into *offset when it is not NULL and recording backpointers in the trace when trace is set
+static int advance(hmm_incremental *inc, size_t from, size_t to, double *offset, int trace)
+{
+    const hmm_model *model = inc->model;
+    int n = model->n_states;
+    double *prev = inc->scores;
+    double *cur = inc->scores + n;
+    double sum = 0;
+    emit_block rows;
+    emit_block_init(&rows, model, &inc->obs, inc->scores + 2 * n);
+
+    for (size_t t = from + 1; t <= to; t++)
+    {
+        const double *emit = emit_row(&rows, t);
+        if (!emit)
+        {
+            return -1;
+        }
+        viterbi_column(model, prev, emit, cur, inc->bp);
+        if (trace)
+        {
+            trace_put(&inc->trace, t - from, inc->bp);
+        }
+        sum += normalise(cur, n);
+
+        double *swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+    if (prev != inc->scores)
+    {
+        memcpy(inc->scores, prev, n * sizeof(double));
+    }
+    if (offset)
+    {
+        *offset = sum;
+    }
+    return 0;
+}
+
+// re-decodes after a change of positions from .. end - 1, relying on the saved columns and path of the positions
+// before from; from 0 to the length rebuilds everything
+static int redecode(hmm_incremental *inc, size_t from, size_t end)
+{
+    int n = inc->model->n_states;
+    size_t k = inc->k;
+    size_t last = inc->obs.length - 1;
+    double *col = inc->scores;
+
+    // forward from the last checkpoint the edit leaves valid until the columns converge or the sequence ends
+    size_t c = from == 0 ? 0 : (from - 1) / k;
+    if (from == 0)
+    {
+        if (viterbi_first_column(inc->model, &inc->obs, col) != 0)
+        {
+            return -1;
+        }
+        inc->first_offset = normalise(col, n);
+        memcpy(inc->saved, col, n * sizeof(double));
+    }
+    else
+    {
+        memcpy(col, inc->saved + c * n, n * sizeof(double));
+    }
+    size_t stop = last;
+    for (; c < inc->n_segments; c++)
+    {
+        size_t to = c * k + k < last ? c * k + k : last;
+        if (advance(inc, c * k, to, &inc->offset[c], 0) != 0)
+        {
+            return -1;
+        }
+        if (to < last)
+        {
+            double *next = inc->saved + (c + 1) * n;
+            if (to + 1 >= end && memcmp(next, col, n * sizeof(double)) == 0)
+            {
+                stop = to;
+                break;
+            }
+            memcpy(next, col, n * sizeof(double));
+        }
+    }
+
+    // with normalised columns the score of the path is the sum of every maximum taken out
+    inc->log_prob = inc->first_offset;
+    for (size_t s = 0; s < inc->n_segments; s++)
+    {
+        inc->log_prob += inc->offset[s];
+    }
+    if (stop == last)
+    {
+        inc->final_state = hmm_argmax(col, n);
+    }
+    if (last == 0)
+    {
+        inc->path[0] = inc->final_state;
+        return 0;
+    }
+
+    // traceback from the unchanged state at stop until the new path rejoins the old one before the edit: the
+    // backpointers of positions up to from only depend on observations before it
+    int state = stop == last ? inc->final_state : inc->path[stop];
+    for (size_t s = (stop - 1) / k + 1; s-- > 0; )
+    {
+        size_t to = s * k + k < last ? s * k + k : last;
+        memcpy(col, inc->saved + s * n, n * sizeof(double));
+        if (advance(inc, s * k, to, NULL, 1) != 0)
+        {
+            return -1;
+        }
+        for (size_t t = to; t > s * k; t--)
+        {
+            inc->path[t] = state;
+            state = trace_get(&inc->trace, t - s * k, state);
+            if (t <= from && inc->path[t - 1] == state)
+            {
+                return 0;
+            }
+        }
+    }
+    inc->path[0] = state;
+    return 0;
+}
+
+
+hmm_incremental *hmm_incremental_new(const hmm_model *model, const hmm_obs *obs, size_t interval)
+{
+    if (!model || !obs || !obs->data || obs->length == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    hmm_incremental *inc = calloc(1, sizeof(*inc));
+    if (!inc)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    int n = model->n_states;
+    size_t last = obs->length - 1;
+    inc->model = model;
+    inc->obs = *obs;
+    inc->k = interval ? interval : INCREMENTAL_INTERVAL;
+    if (inc->k > last)
+    {
+        inc->k = last ? last : 1;
+    }
+    inc->n_segments = (last + inc->k - 1) / inc->k;
+    size_t n_saved = inc->n_segments ? inc->n_segments : 1;
+
+    if (n_saved > SIZE_MAX / sizeof(double) / n || trace_init(&inc->trace, HMM_TRACE_BYTES, n, inc->k + 1) != 0)
+    {
+        free(inc);
+        errno = ENOMEM;
+        return NULL;
+    }
+    inc->saved = malloc(n_saved * n * sizeof(double));
+    inc->offset = malloc(n_saved * sizeof(double));
+    inc->path = malloc(obs->length * sizeof(hmm_state));
+    inc->scores = malloc((2 * n + emit_block_size(n)) * sizeof(double));
+    inc->bp = malloc(n * sizeof(int32_t));
+    if (!inc->saved || !inc->offset || !inc->path || !inc->scores || !inc->bp)
+    {
+        hmm_incremental_free(inc);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (redecode(inc, 0, obs->length) != 0)
+    {
+        int saved_errno = errno;
+        hmm_incremental_free(inc);
+        errno = saved_errno;
+        return NULL;
+    }
+    return inc;
+}
+
+void hmm_incremental_free(hmm_incremental *inc)
+{
+    if (!inc)
+    {
+        return;
+    }
+    free(inc->saved);
+    free(inc->offset);
+    free(inc->path);
+    free(inc->scores);
+    free(inc->bp);
+    trace_free(&inc->trace);
+    free(inc);
+}
+
+
+int hmm_incremental_update(hmm_incremental *inc, size_t from, size_t count)
+{
+    if (!inc || from > inc->obs.length || count > inc->obs.length - from)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    return redecode(inc, from, from + count);
+}
+
+const hmm_state *hmm_incremental_path(const hmm_incremental *inc, double *log_prob)
+{
+    if (log_prob)
+    {
+        *log_prob = inc->log_prob;
+    }
+    return inc->path;
+}
@@ -0,0 +1,254 @@
+/**
+ * Max-plus step kernels, one per instruction set, selected once at run time.
+ *
+ * Every kernel computes, for each destination state j,
+ *
+ *   cur[j] = emit[j] + max_i (prev[i] + trans[i][j]),   bp[j] = the largest i reaching that maximum
+ *
+ * The SIMD kernels hold a block of destination states (4 doubles for AVX2, 8 for AVX-512, 2 for NEON) and their
+ * backpointers in registers while looping over predecessors, and pick with a compare (>=) and blend instead of
+ * branches. They perform the same additions and comparisons in the same order as the scalar kernel, so all of
+ * them return bit-identical scores and backpointers. States left over after the last full block use the scalar
+ * loop.
+ *
+ * x86 kernels are compiled with target attributes and chosen with __builtin_cpu_supports, so the library needs no
+ * special compiler flags. HMM_KERNEL=scalar|avx2|avx512|neon in the environment overrides the choice.
+**/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+#include "hmm_internal.h"
+
+
+typedef void (*step_fn)(int n, const double *restrict prev, const double *restrict trans,
+                        const double *restrict emit, double *restrict cur, int32_t *restrict bp);
+
+
+// destination states j0 .. n - 1, also the whole kernel when no SIMD is available. Sweeping a row at a time
+// keeps the accesses to trans sequential; ties go to the higher-numbered predecessor, as in the original argmax
+static void step_scalar_from(int j0, int n, const double *restrict prev, const double *restrict trans,
+                             const double *restrict emit, double *restrict cur, int32_t *restrict bp)
+{
+    for (int j = j0; j < n; j++)
+    {
+        cur[j] = prev[0] + trans[j];
+        bp[j] = 0;
+    }
+    for (int i = 1; i < n; i++)
+    {
+        const double *restrict row = trans + (size_t) i * n;
+        double p = prev[i];
+        for (int j = j0; j < n; j++)
+        {
+            double cand = p + row[j];
+            if (cand >= cur[j])
+            {
+                cur[j] = cand;
+                bp[j] = i;
+            }
+        }
+    }
+    for (int j = j0; j < n; j++)
+    {
+        cur[j] += emit[j];
+    }
+}
+
+static void step_scalar(int n, const double *restrict prev, const double *restrict trans,
+                        const double *restrict emit, double *restrict cur, int32_t *restrict bp)
+{
+    step_scalar_from(0, n, prev, trans, emit, cur, bp);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static void step_avx2(int n, const double *restrict prev, const double *restrict trans,
+                      const double *restrict emit, double *restrict cur, int32_t *restrict bp)
+{
+    int j0 = 0;
+    for (; j0 + 4 <= n; j0 += 4)
+    {
+        __m256d best = _mm256_add_pd(_mm256_set1_pd(prev[0]), _mm256_loadu_pd(trans + j0));
+        __m256d arg = _mm256_setzero_pd();
+
+        for (int i = 1; i < n; i++)
+        {
+            __m256d cand = _mm256_add_pd(_mm256_set1_pd(prev[i]), _mm256_loadu_pd(trans + (size_t) i * n + j0));
+            __m256d take = _mm256_cmp_pd(cand, best, _CMP_GE_OQ);
+            best = _mm256_blendv_pd(best, cand, take);
+            arg = _mm256_blendv_pd(arg, _mm256_set1_pd(i), take);
+        }
+        _mm256_storeu_pd(cur + j0, _mm256_add_pd(best, _mm256_loadu_pd(emit + j0)));
+        _mm_storeu_si128((__m128i *) (bp + j0), _mm256_cvttpd_epi32(arg));
+    }
+    step_scalar_from(j0, n, prev, trans, emit, cur, bp);
+}
+
+__attribute__((target("avx512f")))
+static void step_avx512(int n, const double *restrict prev, const double *restrict trans,
+                        const double *restrict emit, double *restrict cur, int32_t *restrict bp)
+{
+    int j0 = 0;
+    for (; j0 + 8 <= n; j0 += 8)
+    {
+        __m512d best = _mm512_add_pd(_mm512_set1_pd(prev[0]), _mm512_loadu_pd(trans + j0));
+        __m256i arg = _mm256_setzero_si256();
+
+        for (int i = 1; i < n; i++)
+        {
+            __m512d cand = _mm512_add_pd(_mm512_set1_pd(prev[i]), _mm512_loadu_pd(trans + (size_t) i * n + j0));
+            __mmask8 take = _mm512_cmp_pd_mask(cand, best, _CMP_GE_OQ);
+            best = _mm512_mask_blend_pd(take, best, cand);
+            // 32-bit lanes 0 .. 7 of a 512-bit register carry the backpointers; the upper half stays zero
+            __m512i wide = _mm512_castsi256_si512(arg);
+            wide = _mm512_mask_blend_epi32((__mmask16) take, wide, _mm512_set1_epi32(i));
+            arg = _mm512_castsi512_si256(wide);
+        }
+        _mm512_storeu_pd(cur + j0, _mm512_add_pd(best, _mm512_loadu_pd(emit + j0)));
+        _mm256_storeu_si256((__m256i *) (bp + j0), arg);
+    }
+    step_scalar_from(j0, n, prev, trans, emit, cur, bp);
+}
+
+#endif
+
+
+#ifdef HAVE_NEON_KERNEL
+
+static void step_neon(int n, const double *restrict prev, const double *restrict trans,
+                      const double *restrict emit, double *restrict cur, int32_t *restrict bp)
+{
+    int j0 = 0;
+    for (; j0 + 2 <= n; j0 += 2)
+    {
+        float64x2_t best = vaddq_f64(vdupq_n_f64(prev[0]), vld1q_f64(trans + j0));
+        uint64x2_t arg = vdupq_n_u64(0);
+
+        for (int i = 1; i < n; i++)
+        {
+            float64x2_t cand = vaddq_f64(vdupq_n_f64(prev[i]), vld1q_f64(trans + (size_t) i * n + j0));
+            uint64x2_t take = vcgeq_f64(cand, best);
+            best = vbslq_f64(take, cand, best);
+            arg = vbslq_u64(take, vdupq_n_u64(i), arg);
+        }
+        vst1q_f64(cur + j0, vaddq_f64(best, vld1q_f64(emit + j0)));
+        bp[j0] = (int32_t) vgetq_lane_u64(arg, 0);
+        bp[j0 + 1] = (int32_t) vgetq_lane_u64(arg, 1);
+    }
+    step_scalar_from(j0, n, prev, trans, emit, cur, bp);
+}
+
+#endif
+
+
+static const struct
+{
+    const char *name;
+    step_fn step;
+} kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    { "avx512", step_avx512 },
+    { "avx2", step_avx2 },
+#endif
+#ifdef HAVE_NEON_KERNEL
+    { "neon", step_neon },
+#endif
+    { "scalar", step_scalar },
+};
+
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static size_t selected = N_KERNELS - 1;
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+
+
+static int kernel_supported(size_t k)
+{
+    const char *name = kernels[k].name;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (strcmp(name, "avx512") == 0)
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (strcmp(name, "avx2") == 0)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    (void) name;
+    return 1;
+}
+
+static int find_kernel(const char *name, size_t *k)
+{
+    for (size_t i = 0; i < N_KERNELS; i++)
+    {
+        if (strcmp(name, kernels[i].name) == 0 && kernel_supported(i))
+        {
+            *k = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void select_default(void)
+{
+    const char *forced = getenv("HMM_KERNEL");
+    if (forced && find_kernel(forced, &selected) == 0)
+    {
+        return;
+    }
+    // kernels[] lists the widest instruction set first
+    for (size_t k = 0; k < N_KERNELS; k++)
+    {
+        if (kernel_supported(k))
+        {
+            selected = k;
+            return;
+        }
+    }
+}
+
+
+const char *hmm_kernel_name(void)
+{
+    pthread_once(&selected_once, select_default);
+    return kernels[selected].name;
+}
+
+int hmm_kernel_select(const char *name)
+{
+    size_t k;
+    pthread_once(&selected_once, select_default);
+    if (find_kernel(name, &k) != 0)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    selected = k;
+    return 0;
+}
+
+void viterbi_step(int n, const double *restrict prev, const double *restrict trans,
+                  const double *restrict emit, double *restrict cur, int32_t *restrict bp)
+{
+    pthread_once(&selected_once, select_default);
+    kernels[selected].step(n, prev, trans, emit, cur, bp);
+}
@@ -0,0 +1,97 @@
+/**
+ * viterbi_advance specialised for models with 2, 3, 4 or 8 states.
+ *
+ * For these the per-position overhead of the generic path (a kernel call, loop control for tiny loops, a
+ * trace_put call) costs more than the arithmetic. Each specialisation is stamped out from one macro with the
+ * state count a compile-time constant: the transition matrix is copied into locals the compiler keeps in
+ * registers, every loop over states is fully unrolled, and BYTES backpointers are stored inline.
+ *
+ * The additions and >= comparisons are those of viterbi_step in the same order, so scores and paths are
+ * bit-identical to the generic kernels.
+**/
+
+#include <string.h>
+
+#include "hmm_internal.h"
+
+
+#define DEFINE_SMALL_ADVANCE(N)                                                                                     \
+static int advance_##N(const hmm_model *model, const hmm_obs *obs, size_t from, size_t to, double *col,             \
+                       double *buf, trace_store *trace, size_t trace_offset)                                        \
+{                                                                                                                  \
+    double a[N][N];                                                                                                \
+    double v[N];                                                                                                   \
+    int32_t bp[N];                                                                                                 \
+    memcpy(a, model->log_trans, sizeof(a));                                                                        \
+    memcpy(v, col, sizeof(v));                                                                                     \
+                                                                                                                   \
+    uint8_t *bytes = trace && trace->kind == HMM_TRACE_BYTES ? trace->data : NULL;                                 \
+    emit_block rows;                                                                                               \
+    emit_block_init(&rows, model, obs, buf);                                                                       \
+                                                                                                                   \
+    for (size_t t = from + 1; t <= to; t++)                                                                        \
+    {                                                                                                              \
+        const double *emit = emit_row(&rows, t);                                                                   \
+        if (!emit)                                                                                                 \
+        {                                                                                                          \
+            return -1;                                                                                             \
+        }                                                                                                          \
+                                                                                                                   \
+        double next[N];                                                                                            \
+        for (int j = 0; j < N; j++)                                                                                \
+        {                                                                                                          \
+            double best = v[0] + a[0][j];                                                                          \
+            int32_t arg = 0;                                                                                       \
+            for (int i = 1; i < N; i++)                                                                            \
+            {                                                                                                      \
+                double cand = v[i] + a[i][j];                                                                      \
+                if (cand >= best)                                                                                  \
+                {                                                                                                  \
+                    best = cand;                                                                                   \
+                    arg = i;                                                                                       \
+                }                                                                                                  \
+            }                                                                                                      \
+            next[j] = best + emit[j];                                                                              \
+            bp[j] = arg;                                                                                           \
+        }                                                                                                          \
+        memcpy(v, next, sizeof(v));                                                                                \
+                                                                                                                   \
+        if (bytes)                                                                                                 \
+        {                                                                                                          \
+            uint8_t *dst = bytes + (t - trace_offset) * N;                                                         \
+            for (int j = 0; j < N; j++)                                                                            \
+            {                                                                                                      \
+                dst[j] = (uint8_t) bp[j];                                                                          \
+            }                                                                                                      \
+        }                                                                                                          \
+        else if (trace)                                                                                            \
+        {                                                                                                          \
+            trace_put(trace, t - trace_offset, bp);                                                                \
+        }                                                                                                          \
+    }                                                                                                              \
+    memcpy(col, v, sizeof(v));                                                                                     \
+    return 0;                                                                                                      \
+}
+
+DEFINE_SMALL_ADVANCE(2)
+DEFINE_SMALL_ADVANCE(3)
+DEFINE_SMALL_ADVANCE(4)
+DEFINE_SMALL_ADVANCE(8)
+
+
+small_advance_fn small_advance(int n_states)
+{
+    switch (n_states)
+    {
+        case 2:
+            return advance_2;
+        case 3:
+            return advance_3;
+        case 4:
+            return advance_4;
+        case 8:
+            return advance_8;
+        default:
+            return NULL;
+    }
+}
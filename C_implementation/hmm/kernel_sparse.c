@@ -0,0 +1,43 @@
+/**
+ * Max-plus step over the predecessor lists of a sparse transition matrix (see hmm_model_update_sparse).
+ *
+ * Profile and gene-structure models have hundreds of states but only a handful of allowed transitions out of
+ * each, so the dense kernels spend nearly all their time adding -INFINITY. Here only the finite entries are
+ * visited: destination j takes the maximum over its list pred_start[j] .. pred_start[j + 1] - 1, so one step
+ * costs O(edges) instead of O(n_states^2).
+ *
+ * Lists are in increasing predecessor order and compared with >=, and a destination that nothing reaches keeps
+ * backpointer n_states - 1, which is what the dense kernels pick when every candidate is -INFINITY. Scores and
+ * backpointers are therefore bit-identical to viterbi_step on the full table.
+**/
+
+#include <math.h>
+
+#include "hmm_internal.h"
+
+
+void viterbi_step_sparse(const hmm_model *model, const double *restrict prev, const double *restrict emit,
+                         double *restrict cur, int32_t *restrict bp)
+{
+    int n = model->n_states;
+    const int32_t *restrict start = model->pred_start;
+    const int32_t *restrict state = model->pred_state;
+    const double *restrict logp = model->pred_log;
+
+    for (int j = 0; j < n; j++)
+    {
+        double best = -INFINITY;
+        int32_t arg = n - 1;
+        for (int32_t e = start[j]; e < start[j + 1]; e++)
+        {
+            double cand = prev[state[e]] + logp[e];
+            // a -INFINITY candidate only wins in the dense order when all of them are, and then n - 1 does.
+            // Selects rather than branches, the winner is rarely predictable
+            int take = cand >= best && cand > -INFINITY;
+            best = take ? cand : best;
+            arg = take ? state[e] : arg;
+        }
+        cur[j] = best + emit[j];
+        bp[j] = arg;
+    }
+}
@@ -0,0 +1,804 @@
+/**
+ * Model files, so that parameters can change without a rebuild. The text form is meant for editing:
+ *
+ *   # occasionally dishonest casino
+ *   hmm 1
+ *   states 2
+ *   symbols 6           # or "poisson" for Poisson counts, or "gaussian 2" for mixtures of 2 normals
+ *   base 1              # optional: value in sequence files that stands for symbol 0, default 0
+ *   labels FL           # optional: output character of each state
+ *   init 1 0            # optional: start distribution, default uniform
+ *   trans               # row = current state, column = next state
+ *     0.95 0.05
+ *     0.1  0.9
+ *   emit                # symbols models: row = symbol, column = state
+ *     0.1667 0.1
+ *     ...
+ *   lambda 1.8234 5.7812    # poisson models: one mean per state
+ *   weight              # gaussian models: row = component, column = state; optional for one component
+ *     0.7 0.5
+ *     0.3 0.5
+ *   mean                # gaussian models, laid out like weight
+ *     ...
+ *   var                 # gaussian models: variances, laid out like weight
+ *     ...
+ *
+ * Tokens are separated by any whitespace and '#' starts a comment running to the end of the line. "hmm",
+ * "states" and "symbols", "poisson" or "gaussian" come first; the other sections follow in any order. Values
+ * are plain probabilities, stored as logs by the hmm_model setters.
+ *
+ * The binary form holds the model's tables exactly as they are kept in memory, already in log space, so loading
+ * is a few read(2) calls into the model's arrays with no parsing, no logarithms and, for Poisson models, no
+ * lgamma: the cached count rows are stored too. All fields are in the byte order of the host that wrote it:
+ *
+ *   offset  0   char[8]    magic "HMMMOD\0" followed by format version 1
+ *   offset  8   uint32_t   0x01020304, to reject files written with the other byte order
+ *   offset 12   uint32_t   states n
+ *   offset 16   uint32_t   symbols m, 0 for Poisson, mixture components c for Gaussian
+ *   offset 20   uint32_t   hmm_emission
+ *   offset 24   int32_t    symbol base
+ *   offset 28   uint32_t   Poisson counts r with a cached row, 0 for categorical
+ *   offset 32   uint32_t   label bytes, n or 0
+ *   offset 36   uint32_t   reserved, 0
+ *   offset 40              labels, padded with zeros to a multiple of 8 bytes
+ *   then                   double log_init[n], log_trans[n * n], log_emit[m * n] or [r * n], lambda[n] (Poisson)
+ *                          or mix_mean, mix_scale and mix_norm, [c * n] each (Gaussian)
+ *
+ * Models with custom emissions have no file form.
+ *
+ * hmm_modelfile_open tells the two forms apart by the magic number.
+**/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hmm.h"
+
+#define MODELFILE_VERSION 1
+#define MODELFILE_ORDER 0x01020304u
+// most cached Poisson rows a binary file may carry, as for hmm_model_cache_obs
+#define POISSON_FILE_ROWS 65536
+
+static const char modelfile_magic[8] = { 'H', 'M', 'M', 'M', 'O', 'D', '\0', MODELFILE_VERSION };
+
+typedef struct
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t n_states;
+    uint32_t n_symbols;
+    uint32_t emission;
+    int32_t symbol_base;
+    uint32_t n_cached;
+    uint32_t label_bytes;
+    uint32_t reserved;
+} modelfile_header;
+
+// default labels of files without a "labels" line
+static const char default_labels[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+
+typedef struct
+{
+    char *pos;
+    char *end;
+} tokens;
+
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// blanks out every comment, so that tokens are simply separated by whitespace
+static void strip_comments(char *text, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] == '#')
+        {
+            for (; i < length && text[i] != '\n'; i++)
+            {
+                text[i] = ' ';
+            }
+        }
+    }
+}
+
+// next token, NUL-terminated in place (the buffer has a spare byte past the end); NULL at the end of the text
+static char *next_token(tokens *tok)
+{
+    while (tok->pos < tok->end && is_space(*tok->pos))
+    {
+        tok->pos++;
+    }
+    if (tok->pos == tok->end)
+    {
+        return NULL;
+    }
+
+    char *start = tok->pos;
+    while (tok->pos < tok->end && !is_space(*tok->pos))
+    {
+        tok->pos++;
+    }
+    *tok->pos = '\0';
+    if (tok->pos < tok->end)
+    {
+        tok->pos++;
+    }
+    return start;
+}
+
+static int next_long(tokens *tok, long min, long max, long *out)
+{
+    char *word = next_token(tok);
+    char *stop;
+    if (!word)
+    {
+        return -1;
+    }
+    errno = 0;
+    long value = strtol(word, &stop, 10);
+    if (*stop != '\0' || errno || value < min || value > max)
+    {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static int next_doubles(tokens *tok, double *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        char *word = next_token(tok);
+        char *stop;
+        if (!word)
+        {
+            return -1;
+        }
+        out[i] = strtod(word, &stop);
+        if (*stop != '\0' || stop == word)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int parse_model(tokens *tok, hmm_modelfile *file)
+{
+    long version, n_states, n_symbols = 0;
+    char *word;
+
+    if (!(word = next_token(tok)) || strcmp(word, "hmm") != 0 ||
+        next_long(tok, MODELFILE_VERSION, MODELFILE_VERSION, &version) != 0)
+    {
+        return -1;
+    }
+    if (!(word = next_token(tok)) || strcmp(word, "states") != 0 ||
+        next_long(tok, 1, HMM_MAX_STATES, &n_states) != 0)
+    {
+        return -1;
+    }
+    if (!(word = next_token(tok)))
+    {
+        return -1;
+    }
+    hmm_emission emission = HMM_EMIT_POISSON;
+    long n_mix = 0;
+    if (strcmp(word, "symbols") == 0)
+    {
+        emission = HMM_EMIT_CATEGORICAL;
+        if (next_long(tok, 1, 0x7fffffff, &n_symbols) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (strcmp(word, "gaussian") == 0)
+    {
+        emission = HMM_EMIT_GAUSSIAN;
+        if (next_long(tok, 1, 0x7fffffff, &n_mix) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (strcmp(word, "poisson") != 0)
+    {
+        return -1;
+    }
+
+    size_t n = n_states;
+    size_t table = emission == HMM_EMIT_CATEGORICAL ? (size_t) n_symbols * n : n;
+    size_t mix = (size_t) n_mix * n;
+    if (table < n * n)
+    {
+        table = n * n;
+    }
+    double *values = malloc(table * sizeof(double));
+    // weight, mean and var of a Gaussian model, set together once all are read
+    double *mixture = n_mix ? malloc(3 * mix * sizeof(double)) : NULL;
+    file->model = hmm_model_new(n_states, n_symbols, emission);
+    if (!values || (n_mix && !mixture) || !file->model)
+    {
+        free(values);
+        free(mixture);
+        return -1;
+    }
+
+    int have_init = 0, have_trans = 0, have_emit = 0;
+    int have_weight = 0, have_mean = 0, have_var = 0;
+    int rc = -1;
+    file->info.symbol_base = 0;
+    file->info.labels = NULL;
+
+    while ((word = next_token(tok)))
+    {
+        if (strcmp(word, "base") == 0)
+        {
+            long base;
+            if (next_long(tok, 0, 0x7fffffff, &base) != 0)
+            {
+                goto PARSE_DONE;
+            }
+            file->info.symbol_base = (int) base;
+        }
+        else if (strcmp(word, "labels") == 0)
+        {
+            char *labels = next_token(tok);
+            if (!labels || strlen(labels) != n || file->info.labels)
+            {
+                goto PARSE_DONE;
+            }
+            file->info.labels = labels;
+        }
+        else if (strcmp(word, "init") == 0)
+        {
+            if (have_init++ || next_doubles(tok, values, n) != 0 || hmm_model_set_init(file->model, values) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else if (strcmp(word, "trans") == 0)
+        {
+            if (have_trans++ || next_doubles(tok, values, n * n) != 0 ||
+                hmm_model_set_trans(file->model, values) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else if (strcmp(word, "emit") == 0 && emission == HMM_EMIT_CATEGORICAL)
+        {
+            if (have_emit++ || next_doubles(tok, values, (size_t) n_symbols * n) != 0 ||
+                hmm_model_set_emit(file->model, values) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else if (strcmp(word, "lambda") == 0 && emission == HMM_EMIT_POISSON)
+        {
+            if (have_emit++ || next_doubles(tok, values, n) != 0 || hmm_model_set_lambda(file->model, values) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else if (strcmp(word, "weight") == 0 && emission == HMM_EMIT_GAUSSIAN)
+        {
+            if (have_weight++ || next_doubles(tok, mixture, mix) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else if (strcmp(word, "mean") == 0 && emission == HMM_EMIT_GAUSSIAN)
+        {
+            if (have_mean++ || next_doubles(tok, mixture + mix, mix) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else if (strcmp(word, "var") == 0 && emission == HMM_EMIT_GAUSSIAN)
+        {
+            if (have_var++ || next_doubles(tok, mixture + 2 * mix, mix) != 0)
+            {
+                goto PARSE_DONE;
+            }
+        }
+        else
+        {
+            goto PARSE_DONE;
+        }
+    }
+    if (emission == HMM_EMIT_GAUSSIAN)
+    {
+        if (!have_weight && n_mix == 1)
+        {
+            for (size_t j = 0; j < n; j++)
+            {
+                mixture[j] = 1;
+            }
+            have_weight = 1;
+        }
+        if (!have_weight || !have_mean || !have_var ||
+            hmm_model_set_gaussian(file->model, n_mix, mixture, mixture + mix, mixture + 2 * mix) != 0)
+        {
+            goto PARSE_DONE;
+        }
+        have_emit = 1;
+    }
+    if (!have_trans || !have_emit)
+    {
+        goto PARSE_DONE;
+    }
+    if (!have_init)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            values[i] = 1.0 / n;
+        }
+        hmm_model_set_init(file->model, values);
+    }
+    rc = 0;
+
+    PARSE_DONE:
+        free(values);
+        free(mixture);
+        return rc;
+}
+
+
+// reads exactly size bytes unless the file ends first; -1 on a read error
+static int read_full(int fd, void *buf, size_t size, size_t *got)
+{
+    *got = 0;
+    while (*got < size)
+    {
+        ssize_t r = read(fd, (char *) buf + *got, size - *got);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r < 0)
+        {
+            return -1;
+        }
+        if (r == 0)
+        {
+            break;
+        }
+        *got += r;
+    }
+    return 0;
+}
+
+// copies labels (n_states characters, or NULL for the defaults) into storage owned by file
+static int keep_labels(hmm_modelfile *file, const char *labels)
+{
+    size_t n = file->model->n_states;
+    file->storage = malloc(n + 1);
+    if (!file->storage)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (labels)
+    {
+        memcpy(file->storage, labels, n);
+    }
+    else if (n < sizeof(default_labels))
+    {
+        memcpy(file->storage, default_labels, n);
+    }
+    file->storage[n] = '\0';
+    file->info.labels = labels || n < sizeof(default_labels) ? file->storage : NULL;
+    return 0;
+}
+
+static int open_text(int fd, size_t size, hmm_modelfile *file)
+{
+    char *text = malloc(size + 1);
+    size_t got;
+    if (!text)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (read_full(fd, text, size, &got) != 0)
+    {
+        free(text);
+        return -1;
+    }
+
+    strip_comments(text, got);
+    tokens tok = { text, text + got };
+    int rc = parse_model(&tok, file);
+    if (rc != 0)
+    {
+        errno = errno == ENOMEM ? ENOMEM : EINVAL;
+    }
+    else
+    {
+        // the labels point into the text
+        rc = keep_labels(file, file->info.labels);
+    }
+    free(text);
+    return rc;
+}
+
+// tables of a binary file, read straight into the model's arrays
+static int read_table(int fd, double *table, size_t count, int log_values)
+{
+    size_t got;
+    if (read_full(fd, table, count * sizeof(double), &got) != 0)
+    {
+        return -1;
+    }
+    if (got != count * sizeof(double))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        // log probabilities are at most 0, lambdas positive; this also rejects NaN
+        if (log_values ? !(table[i] <= 0) : !(table[i] > 0 && isfinite(table[i])))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// the mixture tables of a Gaussian model: finite means, negative scales and norms below +INFINITY
+static int read_mixture(int fd, hmm_model *model, size_t count)
+{
+    size_t bytes = count * sizeof(double);
+    size_t got_mean, got_scale, got_norm;
+    if (read_full(fd, model->mix_mean, bytes, &got_mean) != 0 ||
+        read_full(fd, model->mix_scale, bytes, &got_scale) != 0 ||
+        read_full(fd, model->mix_norm, bytes, &got_norm) != 0)
+    {
+        return -1;
+    }
+    if (got_mean != bytes || got_scale != bytes || got_norm != bytes)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t k = 0; k < count; k++)
+    {
+        if (!isfinite(model->mix_mean[k]) || !(model->mix_scale[k] < 0 && isfinite(model->mix_scale[k])) ||
+            !(model->mix_norm[k] < INFINITY))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int open_binary(int fd, size_t size, hmm_modelfile *file)
+{
+    modelfile_header header;
+    size_t got;
+    if (read_full(fd, &header, sizeof(header), &got) != 0)
+    {
+        return -1;
+    }
+
+    int poisson = header.emission == HMM_EMIT_POISSON;
+    int gaussian = header.emission == HMM_EMIT_GAUSSIAN;
+    size_t n = header.n_states;
+    size_t rows = poisson ? header.n_cached : gaussian ? 0 : header.n_symbols;
+    // the three mixture tables of a Gaussian model take the place of log_emit
+    size_t mix = gaussian ? (size_t) header.n_symbols * n : 0;
+    size_t label_space = (header.label_bytes + 7) / 8 * 8;
+    if (got != sizeof(header) || header.byte_order != MODELFILE_ORDER ||
+        n < 1 || n > HMM_MAX_STATES ||
+        (header.emission != HMM_EMIT_CATEGORICAL && !poisson && !gaussian) ||
+        (poisson ? header.n_symbols != 0 || header.n_cached > POISSON_FILE_ROWS : header.n_symbols < 1) ||
+        (!poisson && header.n_cached != 0) ||
+        (header.label_bytes != 0 && header.label_bytes != n) ||
+        rows + 3 * (size_t) header.n_symbols > (SIZE_MAX / sizeof(double) - n * n - 2 * n) / n ||
+        size != sizeof(header) + label_space + (n + n * n + rows * n + (poisson ? n : 0) + 3 * mix) * sizeof(double))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    file->model = hmm_model_new(n, poisson || gaussian ? 0 : (int) header.n_symbols, header.emission);
+    char *labels = malloc(label_space + 1);
+    if (!file->model || !labels)
+    {
+        free(labels);
+        errno = ENOMEM;
+        return -1;
+    }
+    hmm_model *model = file->model;
+    int rc = -1;
+
+    if (read_full(fd, labels, label_space, &got) != 0)
+    {
+        goto BINARY_DONE;
+    }
+    if (got != label_space)
+    {
+        errno = EINVAL;
+        goto BINARY_DONE;
+    }
+    if (poisson)
+    {
+        model->log_emit = malloc((rows ? rows : 1) * n * sizeof(double));
+        if (!model->log_emit)
+        {
+            errno = ENOMEM;
+            goto BINARY_DONE;
+        }
+        model->n_cached = rows;
+    }
+    if (gaussian)
+    {
+        model->mix_mean = malloc(mix * sizeof(double));
+        model->mix_scale = malloc(mix * sizeof(double));
+        model->mix_norm = malloc(mix * sizeof(double));
+        if (!model->mix_mean || !model->mix_scale || !model->mix_norm)
+        {
+            errno = ENOMEM;
+            goto BINARY_DONE;
+        }
+        model->n_mix = header.n_symbols;
+    }
+    if (read_table(fd, model->log_init, n, 1) != 0 ||
+        read_table(fd, model->log_trans, n * n, 1) != 0 ||
+        read_table(fd, model->log_emit, rows * n, 1) != 0 ||
+        (poisson && read_table(fd, model->lambda, n, 0) != 0) ||
+        (gaussian && read_mixture(fd, model, mix) != 0) ||
+        hmm_model_update_sparse(model) != 0)
+    {
+        goto BINARY_DONE;
+    }
+
+    file->info.symbol_base = header.symbol_base;
+    rc = keep_labels(file, header.label_bytes ? labels : NULL);
+
+    BINARY_DONE:
+        free(labels);
+        return rc;
+}
+
+
+int hmm_modelfile_open(const char *path, hmm_modelfile *file)
+{
+    memset(file, 0, sizeof(*file));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    char magic[sizeof(modelfile_magic)];
+    if (fstat(fd, &st) != 0 || pread(fd, magic, sizeof(magic), 0) < 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    int binary = st.st_size >= (off_t) sizeof(magic) && memcmp(magic, modelfile_magic, sizeof(magic)) == 0;
+    int rc = binary ? open_binary(fd, st.st_size, file) : open_text(fd, st.st_size, file);
+    int error = errno;
+    close(fd);
+    if (rc != 0)
+    {
+        hmm_modelfile_close(file);
+        errno = error;
+        return -1;
+    }
+    file->info.name = path;
+    return 0;
+}
+
+int hmm_modelfile_load(const char *name, hmm_modelfile *file)
+{
+    const hmm_example *info;
+    memset(file, 0, sizeof(*file));
+    file->model = hmm_example_model(name, &info);
+    if (file->model)
+    {
+        file->info = *info;
+        return 0;
+    }
+    return hmm_modelfile_open(name, file);
+}
+
+void hmm_modelfile_close(hmm_modelfile *file)
+{
+    hmm_model_free(file->model);
+    free(file->storage);
+    memset(file, 0, sizeof(*file));
+}
+
+
+static void print_row(FILE *f, const double *log_p, size_t count)
+{
+    fprintf(f, "   ");
+    for (size_t i = 0; i < count; i++)
+    {
+        fprintf(f, " %.17g", exp(log_p[i]));
+    }
+    fprintf(f, "\n");
+}
+
+// weight, mean and var recovered from the stored terms of each component's log density
+static void print_mixture(FILE *f, const hmm_model *model)
+{
+    size_t n = model->n_states;
+    static const char *sections[] = { "weight", "mean", "var" };
+    for (int s = 0; s < 3; s++)
+    {
+        fprintf(f, "%s\n", sections[s]);
+        for (int c = 0; c < model->n_mix; c++)
+        {
+            fprintf(f, "   ");
+            for (size_t j = 0; j < n; j++)
+            {
+                size_t k = (size_t) c * n + j;
+                double var = -0.5 / model->mix_scale[k];
+                double value = s == 0 ? exp(model->mix_norm[k] + 0.5 * log(2 * M_PI * var))
+                                      : s == 1 ? model->mix_mean[k] : var;
+                fprintf(f, " %.17g", value);
+            }
+            fprintf(f, "\n");
+        }
+    }
+}
+
+int hmm_modelfile_print(FILE *f, const hmm_model *model, const hmm_example *info)
+{
+    size_t n = model->n_states;
+
+    fprintf(f, "hmm %d\n", MODELFILE_VERSION);
+    fprintf(f, "states %zu\n", n);
+    if (model->emission == HMM_EMIT_CUSTOM)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (model->emission == HMM_EMIT_CATEGORICAL)
+    {
+        fprintf(f, "symbols %d\n", model->n_symbols);
+    }
+    else if (model->emission == HMM_EMIT_GAUSSIAN)
+    {
+        fprintf(f, "gaussian %d\n", model->n_mix);
+    }
+    else
+    {
+        fprintf(f, "poisson\n");
+    }
+    if (info && info->symbol_base)
+    {
+        fprintf(f, "base %d\n", info->symbol_base);
+    }
+    if (info && info->labels)
+    {
+        fprintf(f, "labels %s\n", info->labels);
+    }
+
+    fprintf(f, "init\n");
+    print_row(f, model->log_init, n);
+    fprintf(f, "trans\n");
+    for (size_t i = 0; i < n; i++)
+    {
+        print_row(f, model->log_trans + i * n, n);
+    }
+    if (model->emission == HMM_EMIT_CATEGORICAL)
+    {
+        fprintf(f, "emit\n");
+        for (int k = 0; k < model->n_symbols; k++)
+        {
+            print_row(f, model->log_emit + k * n, n);
+        }
+    }
+    else if (model->emission == HMM_EMIT_POISSON)
+    {
+        fprintf(f, "lambda\n   ");
+        for (size_t j = 0; j < n; j++)
+        {
+            fprintf(f, " %.17g", model->lambda[j]);
+        }
+        fprintf(f, "\n");
+    }
+    else
+    {
+        print_mixture(f, model);
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+int hmm_modelfile_write(const char *path, const hmm_model *model, const hmm_example *info)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        return -1;
+    }
+    int rc = hmm_modelfile_print(f, model, info);
+    if (fclose(f) != 0)
+    {
+        rc = -1;
+    }
+    return rc;
+}
+
+int hmm_modelfile_write_binary(const char *path, const hmm_model *model, const hmm_example *info)
+{
+    size_t n = model->n_states;
+    int poisson = model->emission == HMM_EMIT_POISSON;
+    int gaussian = model->emission == HMM_EMIT_GAUSSIAN;
+    size_t rows = poisson ? (size_t) model->n_cached : (size_t) model->n_symbols;
+    if (model->emission == HMM_EMIT_CUSTOM)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    modelfile_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, modelfile_magic, sizeof(modelfile_magic));
+    header.byte_order = MODELFILE_ORDER;
+    header.n_states = n;
+    header.n_symbols = poisson ? 0 : gaussian ? model->n_mix : model->n_symbols;
+    header.emission = model->emission;
+    header.symbol_base = info ? info->symbol_base : 0;
+    header.n_cached = poisson ? model->n_cached : 0;
+    header.label_bytes = info && info->labels && strlen(info->labels) == n ? n : 0;
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    if (header.label_bytes)
+    {
+        static const char pad[8];
+        fwrite(info->labels, 1, n, f);
+        fwrite(pad, 1, (8 - n % 8) % 8, f);
+    }
+    fwrite(model->log_init, sizeof(double), n, f);
+    fwrite(model->log_trans, sizeof(double), n * n, f);
+    if (rows)
+    {
+        fwrite(model->log_emit, sizeof(double), rows * n, f);
+    }
+    if (poisson)
+    {
+        fwrite(model->lambda, sizeof(double), n, f);
+    }
+    if (gaussian)
+    {
+        size_t mix = (size_t) model->n_mix * n;
+        fwrite(model->mix_mean, sizeof(double), mix, f);
+        fwrite(model->mix_scale, sizeof(double), mix, f);
+        fwrite(model->mix_norm, sizeof(double), mix, f);
+    }
+
+    if (ferror(f))
+    {
+        int saved = errno;
+        fclose(f);
+        errno = saved;
+        return -1;
+    }
+    return fclose(f);
+}
@@ -0,0 +1,102 @@
+/**
+ * Minimal parallel for loop over independent tasks, used by the decoders that split one sequence into chunks.
+ *
+ * Threads take task indices from a shared counter in increasing order; the calling thread takes part, so one
+ * thread runs everything inline. Tasks must not depend on which thread runs them.
+**/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hmm_internal.h"
+
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t next;
+    size_t count;
+    int (*task)(void *ctx, size_t i);
+    void *ctx;
+    int error;              // errno of the first failed task, 0 while all succeed
+} parallel_loop;
+
+
+static void *parallel_thread(void *arg)
+{
+    parallel_loop *loop = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&loop->lock);
+        size_t i = loop->next;
+        int stop = i >= loop->count || loop->error;
+        if (!stop)
+        {
+            loop->next++;
+        }
+        pthread_mutex_unlock(&loop->lock);
+
+        if (stop)
+        {
+            return NULL;
+        }
+        if (loop->task(loop->ctx, i) != 0)
+        {
+            int error = errno ? errno : EINVAL;
+            pthread_mutex_lock(&loop->lock);
+            if (!loop->error)
+            {
+                loop->error = error;
+            }
+            pthread_mutex_unlock(&loop->lock);
+        }
+    }
+}
+
+int parallel_threads(int threads)
+{
+    if (threads > 0)
+    {
+        return threads;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int) online : 1;
+}
+
+int parallel_for(int threads, size_t count, int (*task)(void *ctx, size_t i), void *ctx)
+{
+    parallel_loop loop = { PTHREAD_MUTEX_INITIALIZER, 0, count, task, ctx, 0 };
+
+    threads = parallel_threads(threads);
+    if ((size_t) threads > count)
+    {
+        threads = count ? (int) count : 1;
+    }
+
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    if (tids)
+    {
+        while (started < threads - 1 && pthread_create(&tids[started], NULL, parallel_thread, &loop) == 0)
+        {
+            started++;
+        }
+    }
+    parallel_thread(&loop);
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(tids[w], NULL);
+    }
+    free(tids);
+    pthread_mutex_destroy(&loop.lock);
+
+    if (loop.error)
+    {
+        errno = loop.error;
+        return -1;
+    }
+    return 0;
+}
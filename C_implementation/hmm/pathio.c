@@ -0,0 +1,297 @@
+/**
+ * Buffered output of decoded state paths.
+ *
+ * Positions are formatted a block at a time into the writer's buffer, which goes to the FILE with one fwrite per
+ * PATH_BUFFER bytes, so printing a path costs a few instructions per position instead of a stdio call. A path may
+ * be handed over in pieces (e.g. by a stream sink); runs are carried across the pieces.
+ *
+ * Formats:
+ *
+ *   HMM_PATH_LABELS     one label character per position, a newline every `wrap` positions when wrap is set
+ *                       and one at the end of the path. Without labels, one state number per line instead
+ *   HMM_PATH_BINARY     one byte per position holding the state number, two bytes (little-endian) for models
+ *                       with more than 256 states; no header, separators or terminator
+ *   HMM_PATH_SEGMENTS   one line "start<TAB>end<TAB>label" per maximal run of one state, zero-based positions with
+ *                       end exclusive, so end - start is the length of the run. Without labels the state number
+ *                       stands in for the label
+**/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "hmm.h"
+
+#define PATH_BUFFER 65536
+// longest formatted entry: a segment line of two 20-digit positions and a 5-digit state number
+#define PATH_ENTRY_MAX 64
+
+
+struct hmm_path_writer
+{
+    FILE *f;
+    hmm_path_format format;
+    const char *labels;
+    int wide;               // HMM_PATH_BINARY: two bytes per state
+    size_t wrap;
+
+    size_t position;        // positions of the current path written so far
+    size_t run_start;       // HMM_PATH_SEGMENTS: first position of the open run
+    hmm_state run_state;
+    size_t used;
+    char buf[PATH_BUFFER];
+};
+
+
+hmm_path_writer *hmm_path_writer_new(FILE *f, hmm_path_format format, const char *labels, int n_states, size_t wrap)
+{
+    if (!f || n_states < 1 || n_states > HMM_MAX_STATES || format < HMM_PATH_LABELS || format > HMM_PATH_SEGMENTS)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    hmm_path_writer *w = malloc(sizeof(*w));
+    if (!w)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    w->f = f;
+    w->format = format;
+    w->labels = labels;
+    w->wide = n_states > 256;
+    w->wrap = wrap;
+    w->position = 0;
+    w->run_start = 0;
+    w->run_state = 0;
+    w->used = 0;
+    return w;
+}
+
+void hmm_path_writer_free(hmm_path_writer *w)
+{
+    free(w);
+}
+
+
+static int drain(hmm_path_writer *w)
+{
+    if (w->used && fwrite(w->buf, 1, w->used, w->f) != w->used)
+    {
+        if (!errno)
+        {
+            errno = EIO;
+        }
+        return -1;
+    }
+    w->used = 0;
+    return 0;
+}
+
+// formats value in decimal at the end of the buffer; the caller has made room for it
+static void put_number(hmm_path_writer *w, size_t value)
+{
+    char digits[24];
+    int len = 0;
+    do
+    {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    }
+    while (value);
+
+    while (len)
+    {
+        w->buf[w->used++] = digits[--len];
+    }
+}
+
+static void put_segment(hmm_path_writer *w, size_t end)
+{
+    put_number(w, w->run_start);
+    w->buf[w->used++] = '\t';
+    put_number(w, end);
+    w->buf[w->used++] = '\t';
+    if (w->labels)
+    {
+        w->buf[w->used++] = w->labels[w->run_state];
+    }
+    else
+    {
+        put_number(w, w->run_state);
+    }
+    w->buf[w->used++] = '\n';
+}
+
+
+static int write_labels(hmm_path_writer *w, const hmm_state *states, size_t count)
+{
+    size_t t = 0;
+    while (t < count)
+    {
+        if (PATH_BUFFER - w->used < PATH_ENTRY_MAX && drain(w) != 0)
+        {
+            return -1;
+        }
+
+        if (!w->labels)
+        {
+            put_number(w, states[t++]);
+            w->buf[w->used++] = '\n';
+            w->position++;
+            continue;
+        }
+
+        if (w->wrap && w->position && w->position % w->wrap == 0)
+        {
+            w->buf[w->used++] = '\n';
+        }
+        // up to the next line break, or as much as fits
+        size_t block = count - t;
+        size_t room = PATH_BUFFER - w->used;
+        block = block < room ? block : room;
+        if (w->wrap)
+        {
+            size_t to_break = w->wrap - w->position % w->wrap;
+            block = block < to_break ? block : to_break;
+        }
+
+        const char *labels = w->labels;
+        char *dst = w->buf + w->used;
+        for (size_t i = 0; i < block; i++)
+        {
+            dst[i] = labels[states[t + i]];
+        }
+        w->used += block;
+        w->position += block;
+        t += block;
+    }
+    return 0;
+}
+
+static int write_binary(hmm_path_writer *w, const hmm_state *states, size_t count)
+{
+    size_t width = w->wide ? 2 : 1;
+    size_t t = 0;
+    while (t < count)
+    {
+        if (w->used == PATH_BUFFER && drain(w) != 0)
+        {
+            return -1;
+        }
+        size_t block = (PATH_BUFFER - w->used) / width;
+        block = block < count - t ? block : count - t;
+
+        unsigned char *dst = (unsigned char *) w->buf + w->used;
+        if (w->wide)
+        {
+            for (size_t i = 0; i < block; i++)
+            {
+                dst[2 * i] = states[t + i] & 0xff;
+                dst[2 * i + 1] = states[t + i] >> 8;
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < block; i++)
+            {
+                dst[i] = (unsigned char) states[t + i];
+            }
+        }
+        w->used += block * width;
+        t += block;
+    }
+    w->position += count;
+    return 0;
+}
+
+static int write_segments(hmm_path_writer *w, const hmm_state *states, size_t count)
+{
+    size_t t = 0;
+    if (count && w->position == 0)
+    {
+        w->run_start = 0;
+        w->run_state = states[0];
+    }
+    while (t < count)
+    {
+        // the open run continues as long as the state does
+        hmm_state state = w->run_state;
+        while (t < count && states[t] == state)
+        {
+            t++;
+        }
+        if (t == count)
+        {
+            break;
+        }
+
+        if (PATH_BUFFER - w->used < PATH_ENTRY_MAX && drain(w) != 0)
+        {
+            return -1;
+        }
+        put_segment(w, w->position + t);
+        w->run_start = w->position + t;
+        w->run_state = states[t];
+    }
+    w->position += count;
+    return 0;
+}
+
+
+int hmm_path_write(hmm_path_writer *w, const hmm_state *states, size_t count)
+{
+    if (!w || (!states && count))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (w->format)
+    {
+        case HMM_PATH_LABELS:
+            return write_labels(w, states, count);
+        case HMM_PATH_BINARY:
+            return write_binary(w, states, count);
+        default:
+            return write_segments(w, states, count);
+    }
+}
+
+int hmm_path_end(hmm_path_writer *w)
+{
+    if (!w)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (PATH_BUFFER - w->used < PATH_ENTRY_MAX && drain(w) != 0)
+    {
+        return -1;
+    }
+    if (w->format == HMM_PATH_LABELS && w->labels)
+    {
+        w->buf[w->used++] = '\n';
+    }
+    else if (w->format == HMM_PATH_SEGMENTS && w->position)
+    {
+        put_segment(w, w->position);
+    }
+    w->position = 0;
+    return drain(w);
+}
+
+int hmm_path_flush(hmm_path_writer *w)
+{
+    if (!w)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (drain(w) != 0 || fflush(w->f) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,462 @@
+/**
+ * Forward-Backward posterior decoding: P(state j at position t | all observations) for every position.
+ *
+ * The recursions run in probability space with every column rescaled, so they need neither a logarithm nor
+ * an exponential per cell:
+ *
+ *   alpha[t][j] = e[t][j] * sum_i alpha[t - 1][i] * A[i][j]     (scaled by 1 / c[t], c[t] its sum)
+ *   beta[t][i] = sum_j A[i][j] * e[t + 1][j] * beta[t + 1][j]   (scaled by 1 / sum_j e[t + 1][j] * beta[t + 1][j])
+ *
+ * and the posterior of position t is alpha[t] * beta[t], renormalised. The log-likelihood is the sum of log c[t].
+ * Emission rows are taken from the model's log tables with their largest entry subtracted before exponentiating
+ * (the shift of a log-sum-exp), so even Poisson rows for huge counts cannot underflow; the shift is added back
+ * to the log-likelihood. Each row is converted once, on first use. Both inner loops are unit-stride
+ * multiply-adds over destination states (beta uses the transposed matrix), which the compiler vectorizes.
+ *
+ * The backward pass runs first and keeps the beta column at the end of every segment of k positions. The
+ * forward pass then, segment by segment, recomputes that segment's betas from the saved column and delivers
+ * posteriors in increasing position order. With HMM_POSTERIOR_FULL the one segment is the whole sequence: two
+ * passes, T beta columns. With HMM_POSTERIOR_CHECKPOINT (k = sqrt(T) by default) three passes in
+ * T / k + k columns.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+
+typedef struct
+{
+    const hmm_model *model;
+    const hmm_obs *obs;
+    int n;
+    double *init;           // start probabilities
+    double *trans;          // A[i][j], row-major
+    double *trans_t;        // A[j][i], for the backward pass
+    size_t n_rows;          // emission rows of the model's table
+    double *emit;           // n_rows rows of exp(log_emit - shift), filled on first use
+    double *shift;          // per row, NAN until the row is filled
+    double *scratch;        // n, for rows without a table entry
+    emit_block rows;        // log rows of those, evaluated a block at a time in the direction of the pass
+    double *rows_buf;
+} fb_tables;
+
+
+static void fb_free(fb_tables *fb)
+{
+    free(fb->init);
+    free(fb->trans);
+    free(fb->trans_t);
+    free(fb->emit);
+    free(fb->shift);
+    free(fb->scratch);
+    free(fb->rows_buf);
+}
+
+static int fb_init(fb_tables *fb, const hmm_model *model, const hmm_obs *obs)
+{
+    size_t n = model->n_states;
+    memset(fb, 0, sizeof(*fb));
+    fb->model = model;
+    fb->obs = obs;
+    fb->n = model->n_states;
+    fb->n_rows = model->emission == HMM_EMIT_CATEGORICAL ? (size_t) model->n_symbols : (size_t) model->n_cached;
+
+    fb->init = malloc(n * sizeof(double));
+    fb->trans = malloc(n * n * sizeof(double));
+    fb->trans_t = malloc(n * n * sizeof(double));
+    fb->emit = malloc((fb->n_rows ? fb->n_rows : 1) * n * sizeof(double));
+    fb->shift = malloc((fb->n_rows ? fb->n_rows : 1) * sizeof(double));
+    fb->scratch = malloc(n * sizeof(double));
+    fb->rows_buf = malloc(emit_block_size(n) * sizeof(double));
+    if (!fb->init || !fb->trans || !fb->trans_t || !fb->emit || !fb->shift || !fb->scratch || !fb->rows_buf)
+    {
+        fb_free(fb);
+        errno = ENOMEM;
+        return -1;
+    }
+    emit_block_init(&fb->rows, model, obs, fb->rows_buf);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        fb->init[i] = exp(model->log_init[i]);
+        for (size_t j = 0; j < n; j++)
+        {
+            double a = exp(model->log_trans[i * n + j]);
+            fb->trans[i * n + j] = a;
+            fb->trans_t[j * n + i] = a;
+        }
+    }
+    for (size_t k = 0; k < fb->n_rows; k++)
+    {
+        fb->shift[k] = NAN;
+    }
+    return 0;
+}
+
+static void shifted_exp(int n, const double *log_row, double *row, double *shift)
+{
+    double top = -INFINITY;
+    for (int j = 0; j < n; j++)
+    {
+        top = log_row[j] > top ? log_row[j] : top;
+    }
+    // a symbol no state can emit leaves a zero row, which the caller reports
+    double s = isfinite(top) ? top : 0;
+    for (int j = 0; j < n; j++)
+    {
+        row[j] = exp(log_row[j] - s);
+    }
+    *shift = s;
+}
+
+// emission probabilities of position t divided by exp(*shift); NULL with errno EINVAL for impossible symbols
+static const double *fb_emission(fb_tables *fb, size_t t, double *shift)
+{
+    int obs = obs_at(fb->obs, t);
+    if (obs < 0 || (size_t) obs >= fb->n_rows)
+    {
+        const double *log_row = emit_row(&fb->rows, t);
+        if (!log_row)
+        {
+            return NULL;
+        }
+        shifted_exp(fb->n, log_row, fb->scratch, shift);
+        return fb->scratch;
+    }
+
+    const double *log_row = fb->model->log_emit + (size_t) obs * fb->n;
+    double *row = fb->emit + (size_t) obs * fb->n;
+    if (isnan(fb->shift[obs]))
+    {
+        shifted_exp(fb->n, log_row, row, &fb->shift[obs]);
+    }
+    *shift = fb->shift[obs];
+    return row;
+}
+
+// divides col by its sum and returns the sum; 0 means every state has become impossible
+static double normalise(int n, double *col)
+{
+    double sum = 0;
+    for (int j = 0; j < n; j++)
+    {
+        sum += col[j];
+    }
+    if (sum > 0)
+    {
+        double inv = 1 / sum;
+        for (int j = 0; j < n; j++)
+        {
+            col[j] *= inv;
+        }
+    }
+    return sum;
+}
+
+// beta of position t from beta of position t + 1 (next), into cur; weighted holds n doubles of workspace.
+// Scaling by the sum of the weighted column inside the accumulation keeps beta within a factor n of sum 1
+// without a separate normalising pass
+static int backward_step(fb_tables *fb, size_t t, const double *next, double *cur, double *weighted)
+{
+    int n = fb->n;
+    double shift;
+    const double *e = fb_emission(fb, t + 1, &shift);
+    if (!e)
+    {
+        return -1;
+    }
+    double sum = 0;
+    for (int j = 0; j < n; j++)
+    {
+        weighted[j] = e[j] * next[j];
+        sum += weighted[j];
+        cur[j] = 0;
+    }
+    if (!(sum > 0))
+    {
+        errno = EDOM;
+        return -1;
+    }
+    double inv = 1 / sum;
+    for (int j = 0; j < n; j++)
+    {
+        const double *col = fb->trans_t + (size_t) j * n;
+        double w = weighted[j] * inv;
+        for (int i = 0; i < n; i++)
+        {
+            cur[i] += col[i] * w;
+        }
+    }
+    return 0;
+}
+
+// forward columns are stored unnormalised, carrying 1 / c[t] in *scale so the next step applies it per row
+// instead of in a separate pass
+static int forward_step(fb_tables *fb, size_t t, const double *prev, double *cur, double *scale, double *log_like)
+{
+    int n = fb->n;
+    double shift;
+    const double *e = fb_emission(fb, t, &shift);
+    if (!e)
+    {
+        return -1;
+    }
+    if (!prev)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            cur[j] = fb->init[j];
+        }
+    }
+    else
+    {
+        for (int j = 0; j < n; j++)
+        {
+            cur[j] = 0;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            const double *row = fb->trans + (size_t) i * n;
+            double a = prev[i] * *scale;
+            for (int j = 0; j < n; j++)
+            {
+                cur[j] += a * row[j];
+            }
+        }
+    }
+
+    double c = 0;
+    for (int j = 0; j < n; j++)
+    {
+        cur[j] *= e[j];
+        c += cur[j];
+    }
+    if (!(c > 0))
+    {
+        errno = EDOM;
+        return -1;
+    }
+    *scale = 1 / c;
+    *log_like += log(c) + shift;
+    return 0;
+}
+
+
+void hmm_posterior_opts_init(hmm_posterior_opts *opts)
+{
+    opts->mode = HMM_POSTERIOR_FULL;
+    opts->checkpoint = 0;
+}
+
+int posterior_expect(const hmm_model *model, const hmm_obs *obs, double *log_like, const hmm_posterior_opts *opts,
+                     hmm_posterior_sink sink, void *ctx, double *trans_counts)
+{
+    hmm_posterior_opts defaults;
+    if (!opts)
+    {
+        hmm_posterior_opts_init(&defaults);
+        opts = &defaults;
+    }
+    if (!model || !obs || !sink || (!obs->data && obs->length) ||
+        (opts->mode != HMM_POSTERIOR_FULL && opts->mode != HMM_POSTERIOR_CHECKPOINT))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t length = obs->length;
+    if (length == 0)
+    {
+        if (log_like)
+        {
+            *log_like = 0;
+        }
+        return 0;
+    }
+
+    int n = model->n_states;
+    size_t k = length;
+    if (opts->mode == HMM_POSTERIOR_CHECKPOINT)
+    {
+        k = opts->checkpoint ? opts->checkpoint : (size_t) ceil(sqrt((double) length));
+        k = k < length ? k : length;
+    }
+    size_t n_segments = (length - 1) / k + 1;
+    if (k > SIZE_MAX / sizeof(double) / n || n_segments > SIZE_MAX / sizeof(double) / n)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    fb_tables fb;
+    if (fb_init(&fb, model, obs) != 0)
+    {
+        return -1;
+    }
+    double *saved = malloc(n_segments * n * sizeof(double));
+    double *betas = malloc(k * n * sizeof(double));
+    double *work = malloc(4 * n * sizeof(double));
+    int rc = -1;
+
+    if (!saved || !betas || !work)
+    {
+        errno = ENOMEM;
+        goto POSTERIOR_DONE;
+    }
+    double *alpha = work;
+    double *alpha_next = work + n;
+    double *beta = work + 2 * n;
+    double *weighted = work + 3 * n;
+
+    // backward pass, keeping beta at the last position of every segment
+    for (int j = 0; j < n; j++)
+    {
+        beta[j] = 1.0 / n;
+    }
+    memcpy(saved + (n_segments - 1) * n, beta, n * sizeof(double));
+    for (size_t s = n_segments - 1; s > 0; s--)
+    {
+        // beta of position s * k - 1 from the end of segment s, one column at a time
+        size_t end = s * k - 1;
+        size_t t = s == n_segments - 1 ? length - 1 : (s + 1) * k - 1;
+        memcpy(beta, saved + s * n, n * sizeof(double));
+        while (t > end)
+        {
+            t--;
+            if (backward_step(&fb, t, beta, alpha_next, weighted) != 0)
+            {
+                goto POSTERIOR_DONE;
+            }
+            memcpy(beta, alpha_next, n * sizeof(double));
+        }
+        memcpy(saved + (s - 1) * n, beta, n * sizeof(double));
+    }
+
+    // forward pass over the segments, recomputing their betas from the saved columns
+    double total = 0;
+    double scale = 1;
+    for (size_t s = 0; s < n_segments; s++)
+    {
+        size_t from = s * k;
+        size_t to = s == n_segments - 1 ? length - 1 : from + k - 1;
+
+        memcpy(betas + (to - from) * n, saved + s * n, n * sizeof(double));
+        for (size_t t = to; t > from; t--)
+        {
+            if (backward_step(&fb, t - 1, betas + (t - from) * n, betas + (t - 1 - from) * n, weighted) != 0)
+            {
+                goto POSTERIOR_DONE;
+            }
+        }
+
+        for (size_t t = from; t <= to; t++)
+        {
+            double used = scale;
+            if (forward_step(&fb, t, t ? alpha : NULL, alpha_next, &scale, &total) != 0)
+            {
+                goto POSTERIOR_DONE;
+            }
+            double *swap = alpha;
+            alpha = alpha_next;
+            alpha_next = swap;
+
+            const double *b = betas + (t - from) * n;
+            for (int j = 0; j < n; j++)
+            {
+                beta[j] = alpha[j] * b[j];
+            }
+            double z = normalise(n, beta);
+            if (!(z > 0))
+            {
+                errno = EDOM;
+                goto POSTERIOR_DONE;
+            }
+
+            // P(s[t - 1] = i, s[t] = j) = alpha[t - 1][i] A[i][j] e[t][j] beta[t][j] / z, where z, the sum over
+            // i and j, is the normaliser of the posterior just computed
+            if (trans_counts && t > 0)
+            {
+                double shift;
+                const double *e = fb_emission(&fb, t, &shift);
+                double inv = 1 / z;
+                for (int j = 0; j < n; j++)
+                {
+                    weighted[j] = e[j] * b[j] * inv;
+                }
+                for (int i = 0; i < n; i++)
+                {
+                    const double *row = fb.trans + (size_t) i * n;
+                    double *counts = trans_counts + (size_t) i * n;
+                    double a = alpha_next[i] * used;
+                    for (int j = 0; j < n; j++)
+                    {
+                        counts[j] += a * row[j] * weighted[j];
+                    }
+                }
+            }
+
+            if (sink(ctx, t, beta) != 0)
+            {
+                goto POSTERIOR_DONE;
+            }
+        }
+    }
+    if (log_like)
+    {
+        *log_like = total;
+    }
+    rc = 0;
+
+    POSTERIOR_DONE:
+        free(saved);
+        free(betas);
+        free(work);
+        fb_free(&fb);
+        return rc;
+}
+
+
+typedef struct
+{
+    int n;
+    double *out;
+} posterior_table;
+
+int hmm_posterior_each(const hmm_model *model, const hmm_obs *obs, double *log_like, const hmm_posterior_opts *opts,
+                       hmm_posterior_sink sink, void *ctx)
+{
+    HMM_STATS_START(mark);
+    int rc = posterior_expect(model, obs, log_like, opts, sink, ctx, NULL);
+    HMM_STATS_STOP(HMM_PHASE_POSTERIOR, mark, 0, rc == 0 ? obs->length : 0);
+    return rc;
+}
+
+
+static int store_column(void *ctx, size_t position, const double *posterior)
+{
+    posterior_table *table = ctx;
+    memcpy(table->out + position * table->n, posterior, table->n * sizeof(double));
+    return 0;
+}
+
+int hmm_posterior_obs(const hmm_model *model, const hmm_obs *obs, double *posterior, double *log_like,
+                      const hmm_posterior_opts *opts)
+{
+    if (!model || (!posterior && obs && obs->length))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    posterior_table table = { model->n_states, posterior };
+    return hmm_posterior_each(model, obs, log_like, opts, store_column, &table);
+}
+
+int hmm_posterior(const hmm_model *model, const int *obs, size_t length, double *posterior, double *log_like,
+                  const hmm_posterior_opts *opts)
+{
+    hmm_obs view = { HMM_OBS_INT, length, obs };
+    return hmm_posterior_obs(model, &view, posterior, log_like, opts);
+}
@@ -0,0 +1,161 @@
+/**
+ * Synthetic sequences drawn from a model, for benchmarks and for checking decoders on data with a known path.
+ *
+ * Every draw inverts a cumulative table (init, one per transition row, one per state's emission column) with a
+ * binary search, so a position costs O(log N + log M) whatever the model size. Poisson counts are drawn by
+ * inversion of the pmf, in pieces of at most SAMPLE_POISSON_STEP for large means so that exp(-lambda) cannot
+ * underflow. The generator is splitmix64: the same seed gives the same sequence on every platform.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "hmm.h"
+
+#define SAMPLE_POISSON_STEP 500.0
+
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+static double next_uniform(uint64_t *state)
+{
+    return (next_random(state) >> 11) * 0x1.0p-53;
+}
+
+// cdf[i] = sum of exp(log_p[0 .. i]), reading log_p with the given stride
+static void cumulate(const double *log_p, size_t count, size_t stride, double *cdf)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += exp(log_p[i * stride]);
+        cdf[i] = sum;
+    }
+}
+
+// the first index whose cumulative probability exceeds a uniform draw; -1 if the row is all zero
+static int draw(const double *cdf, int count, uint64_t *state)
+{
+    if (!(cdf[count - 1] > 0))
+    {
+        return -1;
+    }
+    double u = next_uniform(state) * cdf[count - 1];
+    int lo = 0;
+    int hi = count - 1;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (cdf[mid] > u)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static int draw_poisson(double lambda, uint64_t *state)
+{
+    int k = 0;
+    while (lambda > 0)
+    {
+        double step = lambda < SAMPLE_POISSON_STEP ? lambda : SAMPLE_POISSON_STEP;
+        double p = exp(-step);
+        double cdf = p;
+        double u = next_uniform(state);
+        int i = 0;
+        // the cutoff ends the search in the far tail, where rounding keeps cdf just below 1
+        while (u > cdf && p > 0)
+        {
+            i++;
+            p *= step / i;
+            cdf += p;
+        }
+        k += i;
+        lambda -= step;
+    }
+    return k;
+}
+
+
+int hmm_sample(const hmm_model *model, size_t length, uint64_t seed, int *obs, hmm_state *states)
+{
+    if (!model || (!obs && length))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // draws are integers: symbols or counts
+    if (model->emission != HMM_EMIT_CATEGORICAL && model->emission != HMM_EMIT_POISSON)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    size_t n = model->n_states;
+    size_t m = model->emission == HMM_EMIT_CATEGORICAL ? (size_t) model->n_symbols : 0;
+    double *cdf = malloc((n + n * n + n * m) * sizeof(double));
+    if (!cdf)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    double *init = cdf;
+    double *trans = init + n;
+    double *emit = trans + n * n;
+
+    cumulate(model->log_init, n, 1, init);
+    for (size_t i = 0; i < n; i++)
+    {
+        cumulate(model->log_trans + i * n, n, 1, trans + i * n);
+    }
+    for (size_t j = 0; j < n && m; j++)
+    {
+        cumulate(model->log_emit + j, m, n, emit + j * m);
+    }
+
+    uint64_t rng = seed;
+    int state = draw(init, n, &rng);
+    for (size_t t = 0; t < length; t++)
+    {
+        if (t > 0)
+        {
+            state = draw(trans + (size_t) state * n, n, &rng);
+        }
+        int symbol = 0;
+        if (state >= 0)
+        {
+            symbol = m ? draw(emit + (size_t) state * m, m, &rng) : draw_poisson(model->lambda[state], &rng);
+        }
+        if (state < 0 || symbol < 0)
+        {
+            // a state with no way out or nothing to emit
+            free(cdf);
+            errno = EDOM;
+            return -1;
+        }
+        obs[t] = symbol;
+        if (states)
+        {
+            states[t] = state;
+        }
+    }
+    free(cdf);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * Binary sequence files, mapped with mmap(2) and decoded in place.
+ *
+ * Layout, all fields in the byte order of the host that wrote the file:
+ *
+ *   offset  0   char[8]    magic "HMMSEQ\0" followed by format version 1
+ *   offset  8   uint32_t   0x01020304, to reject files written with the other byte order
+ *   offset 12   uint16_t   bytes per symbol, 1 or 2
+ *   offset 14   uint16_t   reserved, 0
+ *   offset 16   uint32_t   alphabet size (largest symbol + 1)
+ *   offset 20   uint32_t   reserved, 0
+ *   offset 24   uint64_t   number of symbols
+ *   offset 32              symbols, already zero-based like the arrays returned by hmm_read_sequence
+ *
+ * Symbols start 32 bytes into a page-aligned mapping, so uint16_t access is aligned.
+**/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hmm.h"
+
+#define SEQFILE_ORDER 0x01020304u
+
+static const char seqfile_magic[8] = { 'H', 'M', 'M', 'S', 'E', 'Q', '\0', 1 };
+
+typedef struct
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint16_t width;
+    uint16_t reserved0;
+    uint32_t n_symbols;
+    uint32_t reserved1;
+    uint64_t length;
+} seqfile_header;
+
+
+int hmm_seqfile_is_binary(const char *path)
+{
+    char head[sizeof(seqfile_magic)];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t got = read(fd, head, sizeof(head));
+    close(fd);
+
+    if (got < 0)
+    {
+        return -1;
+    }
+    return got == sizeof(head) && memcmp(head, seqfile_magic, sizeof(head)) == 0;
+}
+
+
+int hmm_seqfile_open(const char *path, hmm_seqfile *file)
+{
+    memset(file, 0, sizeof(*file));
+    HMM_STATS_START(mark);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if ((size_t) st.st_size < sizeof(seqfile_header))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    const seqfile_header *header = map;
+    if (memcmp(header->magic, seqfile_magic, sizeof(seqfile_magic)) != 0 ||
+        header->byte_order != SEQFILE_ORDER ||
+        (header->width != 1 && header->width != 2) ||
+        header->length > (st.st_size - sizeof(seqfile_header)) / header->width)
+    {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // the decoders read the symbols front to back exactly once
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    file->obs.type = header->width == 1 ? HMM_OBS_U8 : HMM_OBS_U16;
+    file->obs.length = header->length;
+    file->obs.data = (const char *) map + sizeof(seqfile_header);
+    file->n_symbols = header->n_symbols;
+    file->map = map;
+    file->map_length = st.st_size;
+    // the pages are read during decoding, so this counts the file but hardly any of the time spent reading it
+    HMM_STATS_STOP(HMM_PHASE_READ, mark, st.st_size, header->length);
+    return 0;
+}
+
+int hmm_seqfile_prefetch(const hmm_seqfile *file)
+{
+    if (!file->map)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    HMM_STATS_START(mark);
+    // every page is requested at once, then touched in order so that all of them are resident on return
+    madvise(file->map, file->map_length, MADV_WILLNEED);
+    size_t page = sysconf(_SC_PAGESIZE);
+    const volatile char *bytes = file->map;
+    for (size_t at = 0; at < file->map_length; at += page)
+    {
+        (void) bytes[at];
+    }
+    HMM_STATS_STOP(HMM_PHASE_READ, mark, 0, 0);
+    return 0;
+}
+
+void hmm_seqfile_close(hmm_seqfile *file)
+{
+    if (file->map)
+    {
+        munmap(file->map, file->map_length);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+
+int hmm_seqfile_write(const char *path, const int *seq, size_t length)
+{
+    int largest = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (seq[i] < 0 || seq[i] > UINT16_MAX)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        if (seq[i] > largest)
+        {
+            largest = seq[i];
+        }
+    }
+
+    seqfile_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, seqfile_magic, sizeof(seqfile_magic));
+    header.byte_order = SEQFILE_ORDER;
+    header.width = largest <= UINT8_MAX ? 1 : 2;
+    header.n_symbols = largest + 1;
+    header.length = length;
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+
+    // narrow in blocks so the conversion needs no second copy of the whole sequence
+    unsigned char block[1 << 16];
+    size_t per_block = sizeof(block) / header.width;
+    for (size_t i = 0; i < length; i += per_block)
+    {
+        size_t count = length - i < per_block ? length - i : per_block;
+        for (size_t k = 0; k < count; k++)
+        {
+            if (header.width == 1)
+            {
+                block[k] = seq[i + k];
+            }
+            else
+            {
+                uint16_t v = seq[i + k];
+                memcpy(block + 2 * k, &v, 2);
+            }
+        }
+        fwrite(block, header.width, count, f);
+    }
+
+    if (ferror(f))
+    {
+        int saved = errno;
+        fclose(f);
+        errno = saved;
+        return -1;
+    }
+    return fclose(f);
+}
@@ -0,0 +1,336 @@
+/**
+ * Bulk loader for sequence files: whitespace separated non-negative decimal integers, normally one per line
+ * as in durbin_seq.txt and sample_sequence_1.txt.
+ *
+ * The file is read in large blocks with read(2) and scanned by hand, carrying a partially read number over block
+ * boundaries. For regular files the output is sized once from the file size (a symbol takes at least two bytes
+ * including its separator, plus one for an unterminated last line) and shrunk to fit at the end; for pipes it
+ * grows geometrically.
+ *
+ * Files opened by name are read through hmm_input_open, so gzip and zstd compressed ones are decompressed on the
+ * fly (see decompress.c).
+ *
+ * Real-valued sequences, the observations of Gaussian models, are read whole into memory and converted with
+ * strtod, which is far slower than the integer scanner but handles every notation C accepts.
+**/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hmm.h"
+
+#define SEQIO_BLOCK (1 << 20)
+#define SEQIO_MIN_CAP 1024
+
+
+static int grow(int **seq, size_t *cap)
+{
+    size_t new_cap = *cap < SEQIO_MIN_CAP ? SEQIO_MIN_CAP : 2 * *cap;
+    int *grown = realloc(*seq, new_cap * sizeof(int));
+    if (!grown)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    *seq = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+
+int hmm_read_sequence_fd(int fd, int base, int **out, size_t *length)
+{
+    struct stat st;
+    size_t cap = 0;
+    int *seq = NULL;
+    HMM_STATS_START(mark);
+#ifdef HMM_STATS
+    uint64_t bytes_read = 0;
+#endif
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        cap = st.st_size / 2 + 1;
+        seq = malloc(cap * sizeof(int));
+        if (!seq)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    char *block = malloc(SEQIO_BLOCK);
+    if (!block)
+    {
+        free(seq);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t n = 0;
+    long long value = 0;
+    int in_number = 0;
+
+    for (;;)
+    {
+        ssize_t got = read(fd, block, SEQIO_BLOCK);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            goto READ_FAIL;
+        }
+        if (got == 0)
+        {
+            break;
+        }
+#ifdef HMM_STATS
+        bytes_read += got;
+#endif
+
+        for (ssize_t i = 0; i < got; i++)
+        {
+            unsigned char ch = block[i];
+            unsigned digit = ch - '0';
+
+            if (digit < 10)
+            {
+                value = value * 10 + digit;
+                in_number = 1;
+                if (value > INT_MAX)
+                {
+                    errno = EINVAL;
+                    goto READ_FAIL;
+                }
+            }
+            else if (ch == '\n' || ch == ' ' || ch == '\r' || ch == '\t' || ch == '\v' || ch == '\f')
+            {
+                if (in_number)
+                {
+                    if (n == cap && grow(&seq, &cap) != 0)
+                    {
+                        goto READ_FAIL;
+                    }
+                    seq[n++] = (int) value - base;
+                    value = 0;
+                    in_number = 0;
+                }
+            }
+            else
+            {
+                errno = EINVAL;
+                goto READ_FAIL;
+            }
+        }
+    }
+    if (in_number)
+    {
+        if (n == cap && grow(&seq, &cap) != 0)
+        {
+            goto READ_FAIL;
+        }
+        seq[n++] = (int) value - base;
+    }
+    free(block);
+
+    // give back what the size estimate over-allocated
+    if (n && n < cap)
+    {
+        int *shrunk = realloc(seq, n * sizeof(int));
+        if (shrunk)
+        {
+            seq = shrunk;
+        }
+    }
+    *out = seq;
+    *length = n;
+    HMM_STATS_STOP(HMM_PHASE_READ, mark, bytes_read, n);
+    return 0;
+
+
+    READ_FAIL:
+        free(block);
+        free(seq);
+        return -1;
+}
+
+int hmm_read_sequence(const char *path, int base, int **out, size_t *length)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    hmm_input in;
+    int rc = hmm_input_open(fd, 0, &in);
+    if (rc == 0)
+    {
+        rc = hmm_read_sequence_fd(in.fd, base, out, length);
+        int read_error = errno;
+        // a corrupt or truncated compressed file fails however much of it parsed
+        if (hmm_input_close(&in) != 0 && rc == 0)
+        {
+            free(*out);
+            rc = -1;
+        }
+        else
+        {
+            errno = read_error;
+        }
+    }
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+}
+
+
+// the whole of fd into a malloc'ed, NUL-terminated buffer
+static char *read_all(int fd, size_t *size)
+{
+    size_t cap = SEQIO_BLOCK;
+    size_t used = 0;
+    char *text = malloc(cap + 1);
+    if (!text)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (;;)
+    {
+        if (used == cap)
+        {
+            char *grown = realloc(text, 2 * cap + 1);
+            if (!grown)
+            {
+                free(text);
+                errno = ENOMEM;
+                return NULL;
+            }
+            text = grown;
+            cap *= 2;
+        }
+        ssize_t got = read(fd, text + used, cap - used);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            free(text);
+            return NULL;
+        }
+        if (got == 0)
+        {
+            break;
+        }
+        used += got;
+    }
+    text[used] = '\0';
+    *size = used;
+    return text;
+}
+
+int hmm_read_values_fd(int fd, double **out, size_t *length)
+{
+    HMM_STATS_START(mark);
+    size_t size;
+    char *text = read_all(fd, &size);
+    if (!text)
+    {
+        return -1;
+    }
+
+    // as for integers, a value takes at least two bytes with its separator
+    size_t cap = size / 2 + 1;
+    double *seq = malloc(cap * sizeof(double));
+    if (!seq)
+    {
+        free(text);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t n = 0;
+    char *pos = text;
+    for (;;)
+    {
+        while (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t' || *pos == '\v' || *pos == '\f')
+        {
+            pos++;
+        }
+        if (*pos == '\0')
+        {
+            break;
+        }
+        char *stop;
+        double value = strtod(pos, &stop);
+        if (stop == pos || !isfinite(value) ||
+            (*stop != '\0' && *stop != ' ' && *stop != '\n' && *stop != '\r' && *stop != '\t' && *stop != '\v' &&
+             *stop != '\f'))
+        {
+            free(text);
+            free(seq);
+            errno = EINVAL;
+            return -1;
+        }
+        seq[n++] = value;
+        pos = stop;
+    }
+    free(text);
+
+    if (n == 0)
+    {
+        free(seq);
+        seq = NULL;
+    }
+    else if (n < cap)
+    {
+        double *shrunk = realloc(seq, n * sizeof(double));
+        if (shrunk)
+        {
+            seq = shrunk;
+        }
+    }
+    *out = seq;
+    *length = n;
+    HMM_STATS_STOP(HMM_PHASE_READ, mark, size, n);
+    return 0;
+}
+
+int hmm_read_values(const char *path, double **out, size_t *length)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    hmm_input in;
+    int rc = hmm_input_open(fd, 0, &in);
+    if (rc == 0)
+    {
+        rc = hmm_read_values_fd(in.fd, out, length);
+        int read_error = errno;
+        // a corrupt or truncated compressed file fails however much of it parsed
+        if (hmm_input_close(&in) != 0 && rc == 0)
+        {
+            free(*out);
+            rc = -1;
+        }
+        else
+        {
+            errno = read_error;
+        }
+    }
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+}
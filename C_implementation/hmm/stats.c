@@ -0,0 +1,119 @@
+/**
+ * Per-phase counters behind the HMM_STATS_* macros of hmm.h, compiled only with -DHMM_STATS.
+ *
+ * A phase is timed from HMM_STATS_START to HMM_STATS_STOP with the monotonic clock (wall) and the process CPU
+ * clock (cpu). Phases of concurrent decodes overlap, so in batch mode wall and cpu are sums over all records,
+ * and cpu includes the work of every thread running meanwhile. Bytes are those read from sequence files or
+ * written by the output loops; symbols are positions loaded, decoded or printed.
+ *
+ * The heap high-water mark is the largest number of bytes allocated through malloc, sampled at the end of a phase
+ * but at most once every STATS_HEAP_INTERVAL seconds, because asking malloc walks its free lists. It needs
+ * glibc 2.33 or later and is reported as -1 elsewhere; the peak resident set size from getrusage is always given.
+ *
+ * Updates take a mutex once per phase, never per symbol.
+**/
+
+#ifdef HMM_STATS
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#include "hmm.h"
+
+#define STATS_HEAP_INTERVAL 1e-3
+
+
+typedef struct
+{
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t symbols;
+    double wall;
+    double cpu;
+} phase_totals;
+
+static const char *phase_names[HMM_N_PHASES] = { "read", "forward", "traceback", "posterior", "emission",
+                                                    "output" };
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static phase_totals totals[HMM_N_PHASES];
+static long long heap_high = -1;
+static double heap_sampled = -1;
+
+
+static double clock_seconds(clockid_t id)
+{
+    struct timespec now;
+    clock_gettime(id, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void hmm_stats_start(hmm_stats_mark *mark)
+{
+    mark->wall = clock_seconds(CLOCK_MONOTONIC);
+    mark->cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void hmm_stats_stop(hmm_phase phase, const hmm_stats_mark *mark, uint64_t bytes, uint64_t symbols)
+{
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    pthread_mutex_lock(&stats_lock);
+    phase_totals *p = &totals[phase];
+    p->calls++;
+    p->bytes += bytes;
+    p->symbols += symbols;
+    p->wall += wall - mark->wall;
+    p->cpu += cpu - mark->cpu;
+
+#ifdef HAVE_MALLINFO2
+    if (heap_sampled < 0 || wall - heap_sampled >= STATS_HEAP_INTERVAL)
+    {
+        struct mallinfo2 info = mallinfo2();
+        long long in_use = (long long) (info.uordblks + info.hblkhd);
+        heap_high = in_use > heap_high ? in_use : heap_high;
+        heap_sampled = wall;
+    }
+#endif
+    pthread_mutex_unlock(&stats_lock);
+}
+
+int hmm_stats_report(const char *path)
+{
+    FILE *f = path ? fopen(path, "w") : stderr;
+    if (!f)
+    {
+        return -1;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    pthread_mutex_lock(&stats_lock);
+    fprintf(f, "{\"phases\": {");
+    for (int i = 0; i < HMM_N_PHASES; i++)
+    {
+        const phase_totals *p = &totals[i];
+        fprintf(f, "%s\"%s\": {\"calls\": %llu, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"bytes\": %llu, "
+                "\"symbols\": %llu}", i ? ", " : "", phase_names[i], (unsigned long long) p->calls, p->wall, p->cpu,
+                (unsigned long long) p->bytes, (unsigned long long) p->symbols);
+    }
+    fprintf(f, "}, \"heap_high_water_bytes\": %lld, \"peak_rss_kib\": %ld}\n", heap_high, usage.ru_maxrss);
+    pthread_mutex_unlock(&stats_lock);
+
+    int rc = ferror(f) ? -1 : 0;
+    if (path && fclose(f) != 0)
+    {
+        rc = -1;
+    }
+    return rc;
+}
+
+#endif
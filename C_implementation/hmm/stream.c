@@ -0,0 +1,283 @@
+/**
+ * Online Viterbi decoding with bounded-lag output.
+ *
+ * Observations are pushed one at a time. Besides the score column of the newest position the decoder keeps the
+ * backpointers of the positions not yet decided, in a ring of trace columns, and for every current state j
+ * root[j] = the state at the oldest undecided position on the survivor path ending in j. When all roots agree
+ * every survivor shares that prefix, so the survivors are walked back to the newest position where they merge
+ * and everything up to it is final: it is the same prefix the full Viterbi traceback would produce. The roots are
+ * updated in O(N) per position, so the walk only happens when paths really coalesce.
+ *
+ * With max_lag > 0 a position is also decided once max_lag newer observations have arrived, following the
+ * survivor of the currently best state. Forced decisions trade exactness for latency: a later observation may
+ * favour a path through a different state.
+ *
+ * Scores are shifted back towards zero when they drift below -STREAM_RENORM, so unbounded streams keep full
+ * precision; this does not change which predecessor wins except through rounding.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+#define STREAM_RENORM 1e6
+#define STREAM_MIN_RING 64
+
+
+struct hmm_stream
+{
+    const hmm_model *model;
+    size_t max_lag;
+    hmm_stream_sink sink;
+    void *ctx;
+
+    size_t t;               // observations pushed since the stream was started or finished
+    size_t decided;         // positions already passed to the sink
+    double *scores;         // allocation holding col, cur and emit
+    double *col;            // scores of position t - 1
+    double *cur;
+    double *emit;
+    int32_t *bp;
+    int32_t *root;
+    int32_t *anc;           // survivor walk, ancestors at the position being visited
+    int32_t *anc_prev;      // survivor walk, ancestors one position later
+    trace_store ring;       // backpointers of position p in column p % ring.length
+    hmm_state *out;         // ring.length entries
+};
+
+
+hmm_stream *hmm_stream_new(const hmm_model *model, size_t max_lag, hmm_stream_sink sink, void *ctx)
+{
+    if (!model || !sink)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    hmm_stream *stream = calloc(1, sizeof(*stream));
+    if (!stream)
+    {
+        return NULL;
+    }
+    int n = model->n_states;
+    size_t ring = max_lag + 2 > STREAM_MIN_RING ? max_lag + 2 : STREAM_MIN_RING;
+
+    stream->model = model;
+    stream->max_lag = max_lag;
+    stream->sink = sink;
+    stream->ctx = ctx;
+    stream->scores = malloc(3 * n * sizeof(double));
+    stream->bp = malloc(4 * n * sizeof(int32_t));
+    stream->out = malloc(ring * sizeof(hmm_state));
+
+    if (!stream->scores || !stream->bp || !stream->out || trace_init(&stream->ring, HMM_TRACE_BYTES, n, ring) != 0)
+    {
+        hmm_stream_free(stream);
+        errno = ENOMEM;
+        return NULL;
+    }
+    stream->col = stream->scores;
+    stream->cur = stream->scores + n;
+    stream->emit = stream->scores + 2 * n;
+    stream->root = stream->bp + n;
+    stream->anc = stream->bp + 2 * n;
+    stream->anc_prev = stream->bp + 3 * n;
+    return stream;
+}
+
+void hmm_stream_free(hmm_stream *stream)
+{
+    if (!stream)
+    {
+        return;
+    }
+    free(stream->scores);
+    free(stream->bp);
+    free(stream->out);
+    trace_free(&stream->ring);
+    free(stream);
+}
+
+
+// doubles the ring, keeping the backpointers of the pending positions decided + 1 .. t - 1
+static int grow_ring(hmm_stream *stream)
+{
+    int n = stream->model->n_states;
+    size_t old_len = stream->ring.length;
+    size_t new_len = 2 * old_len;
+    trace_store ring;
+
+    hmm_state *out = realloc(stream->out, new_len * sizeof(hmm_state));
+    if (!out)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    stream->out = out;
+    if (trace_init(&ring, HMM_TRACE_BYTES, n, new_len) != 0)
+    {
+        return -1;
+    }
+
+    for (size_t p = stream->decided + 1; p < stream->t; p++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            stream->bp[j] = trace_get(&stream->ring, p % old_len, j);
+        }
+        trace_put(&ring, p % new_len, stream->bp);
+    }
+    trace_free(&stream->ring);
+    stream->ring = ring;
+    return 0;
+}
+
+// traces back from state at position last and hands positions decided .. last to the sink
+static int emit_until(hmm_stream *stream, size_t last, int state)
+{
+    size_t count = last - stream->decided + 1;
+    size_t len = stream->ring.length;
+
+    stream->out[count - 1] = state;
+    for (size_t p = last; p > stream->decided; p--)
+    {
+        state = trace_get(&stream->ring, p % len, state);
+        stream->out[p - 1 - stream->decided] = state;
+    }
+
+    size_t first = stream->decided;
+    stream->decided = last + 1;
+    return stream->sink(stream->ctx, first, stream->out, count);
+}
+
+static int all_equal(int n, const int32_t *v)
+{
+    for (int j = 1; j < n; j++)
+    {
+        if (v[j] != v[0])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// emits whatever the survivors agree on, or what max_lag forces
+static int settle(hmm_stream *stream)
+{
+    int n = stream->model->n_states;
+    size_t newest = stream->t - 1;
+    int forced = stream->max_lag && newest - stream->decided >= stream->max_lag;
+
+    if (!forced && !all_equal(n, stream->root))
+    {
+        return 0;
+    }
+
+    // walk every survivor back from the newest position, stopping where they merge or at the forced limit
+    size_t lowest = forced ? newest - stream->max_lag : stream->decided;
+    size_t len = stream->ring.length;
+    size_t p = newest;
+    int best = hmm_argmax(stream->col, n);
+    int merged;
+
+    for (int j = 0; j < n; j++)
+    {
+        stream->anc[j] = j;
+    }
+    while (!(merged = all_equal(n, stream->anc)) && p > lowest)
+    {
+        memcpy(stream->anc_prev, stream->anc, n * sizeof(int32_t));
+        for (int j = 0; j < n; j++)
+        {
+            stream->anc[j] = trace_get(&stream->ring, p % len, stream->anc[j]);
+        }
+        p--;
+    }
+
+    int state = merged ? stream->anc[0] : stream->anc[best];
+    if (p < newest)
+    {
+        memcpy(stream->root, stream->anc_prev, n * sizeof(int32_t));
+    }
+    return emit_until(stream, p, state);
+}
+
+
+int hmm_stream_push(hmm_stream *stream, int obs)
+{
+    const hmm_model *model = stream->model;
+    int n = model->n_states;
+    size_t t = stream->t;
+
+    if (t == 0)
+    {
+        hmm_obs first = { HMM_OBS_INT, 1, &obs };
+        if (viterbi_first_column(model, &first, stream->col) != 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        if (t - stream->decided >= stream->ring.length && grow_ring(stream) != 0)
+        {
+            return -1;
+        }
+        const double *emit = emission_lookup(model, obs, stream->emit);
+        if (!emit)
+        {
+            return -1;
+        }
+        viterbi_column(model, stream->col, emit, stream->cur, stream->bp);
+        trace_put(&stream->ring, t % stream->ring.length, stream->bp);
+
+        double *swap = stream->col;
+        stream->col = stream->cur;
+        stream->cur = swap;
+    }
+
+    // the survivor of state j reaches the oldest pending position through its predecessor bp[j]
+    if (stream->decided == t)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            stream->root[j] = j;
+        }
+    }
+    else
+    {
+        for (int j = 0; j < n; j++)
+        {
+            stream->anc[j] = stream->root[stream->bp[j]];
+        }
+        memcpy(stream->root, stream->anc, n * sizeof(int32_t));
+    }
+    stream->t = t + 1;
+
+    double top = stream->col[hmm_argmax(stream->col, n)];
+    if (top < -STREAM_RENORM && isfinite(top))
+    {
+        for (int j = 0; j < n; j++)
+        {
+            stream->col[j] -= top;
+        }
+    }
+    return settle(stream);
+}
+
+int hmm_stream_finish(hmm_stream *stream)
+{
+    int rc = 0;
+    if (stream->t > stream->decided)
+    {
+        int best = hmm_argmax(stream->col, stream->model->n_states);
+        rc = emit_until(stream, stream->t - 1, best);
+    }
+    stream->t = 0;
+    stream->decided = 0;
+    return rc;
+}
@@ -0,0 +1,162 @@
+/**
+ * Backpointer storage for the Viterbi traceback.
+ *
+ * A backpointer only ever holds a state number, so instead of a double (or int) per state and position it is
+ * stored in the narrowest form that can hold n_states - 1:
+ *
+ *   HMM_TRACE_BYTES    one uint8_t per entry for up to 256 states, uint16_t above that
+ *   HMM_TRACE_PACKED   ceil(log2 n_states) bits per entry in a continuous bit stream, e.g. 2 bits per
+ *                      position for a 2-state model
+ *
+ * Entry (t, j) lives at index t * n_states + j.
+**/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "hmm_internal.h"
+
+
+static int bits_for(int n_states)
+{
+    int bits = 1;
+    while ((1 << bits) < n_states)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+
+size_t trace_size(hmm_trace kind, int n_states, size_t length)
+{
+    if (length > SIZE_MAX / 16 / n_states)
+    {
+        return 0;
+    }
+    size_t entries = length * n_states;
+
+    switch (kind)
+    {
+        case HMM_TRACE_BYTES:
+            return entries * (n_states <= 256 ? sizeof(uint8_t) : sizeof(uint16_t));
+        case HMM_TRACE_PACKED:
+            // one spare word so that reads and writes may always touch two neighbouring words
+            return ((entries * bits_for(n_states) + 63) / 64 + 1) * sizeof(uint64_t);
+        default:
+            return 0;
+    }
+}
+
+void trace_attach(trace_store *trace, hmm_trace kind, int n_states, size_t length, void *data)
+{
+    trace->kind = kind;
+    trace->n_states = n_states;
+    trace->bits = bits_for(n_states);
+    trace->length = length;
+    trace->data = data;
+}
+
+int trace_init(trace_store *trace, hmm_trace kind, int n_states, size_t length)
+{
+    trace_attach(trace, kind, n_states, length, NULL);
+    if (kind != HMM_TRACE_BYTES && kind != HMM_TRACE_PACKED)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t size = trace_size(kind, n_states, length);
+    if (size == 0 && length > 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    trace->data = kind == HMM_TRACE_PACKED ? calloc(size, 1) : malloc(size ? size : 1);
+    if (!trace->data)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void trace_free(trace_store *trace)
+{
+    free(trace->data);
+    trace->data = NULL;
+}
+
+
+void trace_put(trace_store *trace, size_t t, const int32_t *bp)
+{
+    int n = trace->n_states;
+    size_t base = t * n;
+
+    if (trace->kind == HMM_TRACE_BYTES)
+    {
+        if (n <= 256)
+        {
+            uint8_t *col = (uint8_t *) trace->data + base;
+            for (int j = 0; j < n; j++)
+            {
+                col[j] = bp[j];
+            }
+        }
+        else
+        {
+            uint16_t *col = (uint16_t *) trace->data + base;
+            for (int j = 0; j < n; j++)
+            {
+                col[j] = bp[j];
+            }
+        }
+        return;
+    }
+
+    // packed: clear the entry's bits before setting them, columns are rewritten when a trace is reused
+    uint64_t *words = trace->data;
+    int bits = trace->bits;
+    uint64_t mask = (UINT64_C(1) << bits) - 1;
+    for (int j = 0; j < n; j++)
+    {
+        size_t bit = (base + j) * bits;
+        size_t w = bit / 64;
+        int shift = bit % 64;
+        uint64_t v = (uint64_t) bp[j];
+
+        words[w] = (words[w] & ~(mask << shift)) | (v << shift);
+        if (shift + bits > 64)
+        {
+            words[w + 1] = (words[w + 1] & ~(mask >> (64 - shift))) | (v >> (64 - shift));
+        }
+    }
+}
+
+int trace_get(const trace_store *trace, size_t t, int state)
+{
+    int n = trace->n_states;
+    size_t entry = t * n + state;
+
+    if (trace->kind == HMM_TRACE_BYTES)
+    {
+        if (n <= 256)
+        {
+            return ((const uint8_t *) trace->data)[entry];
+        }
+        return ((const uint16_t *) trace->data)[entry];
+    }
+
+    const uint64_t *words = trace->data;
+    int bits = trace->bits;
+    size_t bit = entry * bits;
+    size_t w = bit / 64;
+    int shift = bit % 64;
+    uint64_t v = words[w] >> shift;
+
+    if (shift + bits > 64)
+    {
+        v |= words[w + 1] << (64 - shift);
+    }
+    return (int) (v & ((UINT64_C(1) << bits) - 1));
+}
@@ -0,0 +1,384 @@
+/**
+ * Parameter estimation by expectation maximisation over many independent sequences.
+ *
+ * Each iteration runs the E-step over every sequence with the current, read-only model and sums the expected
+ * counts: first states, transitions, and symbols (categorical) or counts and their weights (Poisson). The M-step
+ * then sets every probability to its share of its row's counts and every lambda to the weighted mean count.
+ *
+ *   HMM_TRAIN_BAUM_WELCH   expected counts from Forward-Backward posteriors (posterior.c)
+ *   HMM_TRAIN_VITERBI      hard counts along the Viterbi path; cheaper, and a local optimum of the path score
+ *
+ * Sequences are split, in input order, into up to TRAIN_BLOCKS blocks of about equal total length, each with its
+ * own accumulator. Blocks are the unit of work of parallel_for, so each accumulator is only ever touched by one
+ * thread; they are summed in block order at the end, which makes the result independent of the thread count.
+ * Rows whose counts are all zero (states never visited) keep their previous values.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+#define TRAIN_BLOCKS 64
+// upper bound on the memory of all accumulators together
+#define TRAIN_ACC_BYTES (1 << 28)
+// smallest lambda the M-step sets, for states that only ever see zero counts
+#define TRAIN_MIN_LAMBDA 1e-10
+
+
+typedef struct
+{
+    hmm_model *model;
+    const hmm_obs *seqs;
+    const hmm_train_opts *opts;
+    size_t *block_start;    // n_blocks + 1 sequence indices
+    size_t n_blocks;
+    size_t acc_size;        // doubles per accumulator: log-likelihood, init, trans, emission counts
+    double *acc;
+} train_job;
+
+typedef struct
+{
+    const hmm_model *model;
+    const hmm_obs *obs;
+    double *init;
+    double *emit;
+} gamma_ctx;
+
+
+static size_t emit_counts(const hmm_model *model)
+{
+    size_t n = model->n_states;
+    return model->emission == HMM_EMIT_CATEGORICAL ? (size_t) model->n_symbols * n : 2 * n;
+}
+
+// adds the posteriors of one position to the first-state and emission counts
+static int add_gamma(void *ctx, size_t position, const double *posterior)
+{
+    gamma_ctx *g = ctx;
+    int n = g->model->n_states;
+    int obs = obs_at(g->obs, position);
+
+    if (position == 0)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            g->init[j] += posterior[j];
+        }
+    }
+    if (g->model->emission == HMM_EMIT_CATEGORICAL)
+    {
+        double *row = g->emit + (size_t) obs * n;
+        for (int j = 0; j < n; j++)
+        {
+            row[j] += posterior[j];
+        }
+    }
+    else
+    {
+        for (int j = 0; j < n; j++)
+        {
+            g->emit[j] += posterior[j] * obs;
+            g->emit[n + j] += posterior[j];
+        }
+    }
+    return 0;
+}
+
+static int viterbi_counts(const hmm_model *model, const hmm_obs *obs, double *log_like, double *init, double *trans,
+                          double *emit)
+{
+    int n = model->n_states;
+    hmm_state *path = malloc(obs->length * sizeof(hmm_state));
+    if (!path)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (hmm_viterbi_obs(model, obs, path, log_like, NULL) != 0)
+    {
+        free(path);
+        return -1;
+    }
+    if (*log_like == -INFINITY)
+    {
+        free(path);
+        errno = EDOM;
+        return -1;
+    }
+
+    init[path[0]] += 1;
+    for (size_t t = 0; t < obs->length; t++)
+    {
+        int j = path[t];
+        int k = obs_at(obs, t);
+        if (t > 0)
+        {
+            trans[(size_t) path[t - 1] * n + j] += 1;
+        }
+        if (model->emission == HMM_EMIT_CATEGORICAL)
+        {
+            emit[(size_t) k * n + j] += 1;
+        }
+        else
+        {
+            emit[j] += k;
+            emit[n + j] += 1;
+        }
+    }
+    free(path);
+    return 0;
+}
+
+// E-step over the sequences of block b
+static int expect_task(void *ctx, size_t b)
+{
+    train_job *job = ctx;
+    const hmm_model *model = job->model;
+    size_t n = model->n_states;
+    double *acc = job->acc + b * job->acc_size;
+    double *init = acc + 1;
+    double *trans = init + n;
+    double *emit = trans + n * n;
+
+    memset(acc, 0, job->acc_size * sizeof(double));
+    for (size_t s = job->block_start[b]; s < job->block_start[b + 1]; s++)
+    {
+        const hmm_obs *obs = &job->seqs[s];
+        double log_like;
+        if (obs->length == 0)
+        {
+            continue;
+        }
+
+        if (job->opts->method == HMM_TRAIN_VITERBI)
+        {
+            if (viterbi_counts(model, obs, &log_like, init, trans, emit) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            gamma_ctx g = { model, obs, init, emit };
+            if (posterior_expect(model, obs, &log_like, &job->opts->posterior, add_gamma, &g, trans) != 0)
+            {
+                return -1;
+            }
+        }
+        acc[0] += log_like;
+    }
+    return 0;
+}
+
+
+// sets p[i * stride] to (counts[i * stride] + pseudo) / their sum, leaving p as it is if that sum is 0
+static void normalise_counts(const double *counts, size_t count, size_t stride, double pseudo, double *p)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += counts[i * stride] + pseudo;
+    }
+    if (!(sum > 0))
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        p[i * stride] = (counts[i * stride] + pseudo) / sum;
+    }
+}
+
+static void exp_table(const double *log_p, size_t count, double *p)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        p[i] = exp(log_p[i]);
+    }
+}
+
+static int maximise(hmm_model *model, const double *acc, double pseudo, double *p)
+{
+    size_t n = model->n_states;
+    const double *init = acc + 1;
+    const double *trans = init + n;
+    const double *emit = trans + n * n;
+
+    exp_table(model->log_init, n, p);
+    normalise_counts(init, n, 1, pseudo, p);
+    if (hmm_model_set_init(model, p) != 0)
+    {
+        return -1;
+    }
+
+    exp_table(model->log_trans, n * n, p);
+    for (size_t i = 0; i < n; i++)
+    {
+        normalise_counts(trans + i * n, n, 1, pseudo, p + i * n);
+    }
+    if (hmm_model_set_trans(model, p) != 0)
+    {
+        return -1;
+    }
+
+    if (model->emission == HMM_EMIT_CATEGORICAL)
+    {
+        // each state's column of the emission table sums to 1
+        size_t m = model->n_symbols;
+        exp_table(model->log_emit, m * n, p);
+        for (size_t j = 0; j < n; j++)
+        {
+            normalise_counts(emit + j, m, n, pseudo, p + j);
+        }
+        return hmm_model_set_emit(model, p);
+    }
+
+    for (size_t j = 0; j < n; j++)
+    {
+        double weight = emit[n + j];
+        p[j] = model->lambda[j];
+        if (weight > 0)
+        {
+            p[j] = emit[j] / weight > TRAIN_MIN_LAMBDA ? emit[j] / weight : TRAIN_MIN_LAMBDA;
+        }
+    }
+    return hmm_model_set_lambda(model, p);
+}
+
+
+void hmm_train_opts_init(hmm_train_opts *opts)
+{
+    opts->method = HMM_TRAIN_BAUM_WELCH;
+    opts->max_iterations = 100;
+    opts->tolerance = 1e-8;
+    opts->pseudocount = 0;
+    opts->threads = 0;
+    hmm_posterior_opts_init(&opts->posterior);
+}
+
+int hmm_train(hmm_model *model, const hmm_obs *seqs, size_t count, const hmm_train_opts *opts,
+              hmm_train_result *result)
+{
+    hmm_train_opts defaults;
+    if (!opts)
+    {
+        hmm_train_opts_init(&defaults);
+        opts = &defaults;
+    }
+    if (!model || (!seqs && count) || opts->max_iterations < 0 || !(opts->pseudocount >= 0) ||
+        (opts->method != HMM_TRAIN_BAUM_WELCH && opts->method != HMM_TRAIN_VITERBI))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // the M-step only knows the table and count emissions
+    if (model->emission != HMM_EMIT_CATEGORICAL && model->emission != HMM_EMIT_POISSON)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    size_t n = model->n_states;
+    train_job job;
+    memset(&job, 0, sizeof(job));
+    job.model = model;
+    job.seqs = seqs;
+    job.opts = opts;
+    job.acc_size = 1 + n + n * n + emit_counts(model);
+
+    // blocks of about equal total length, as many as the memory bound allows
+    size_t total = 0;
+    for (size_t s = 0; s < count; s++)
+    {
+        total += seqs[s].length;
+    }
+    job.n_blocks = TRAIN_BLOCKS;
+    if (job.n_blocks > count)
+    {
+        job.n_blocks = count ? count : 1;
+    }
+    while (job.n_blocks > 1 && job.n_blocks * job.acc_size > TRAIN_ACC_BYTES / sizeof(double))
+    {
+        job.n_blocks /= 2;
+    }
+
+    job.block_start = malloc((job.n_blocks + 1) * sizeof(size_t));
+    job.acc = malloc(job.n_blocks * job.acc_size * sizeof(double));
+    size_t table = n * n > emit_counts(model) ? n * n : emit_counts(model);
+    double *p = malloc(table * sizeof(double));
+    int rc = -1;
+
+    if (!job.block_start || !job.acc || !p)
+    {
+        errno = ENOMEM;
+        goto TRAIN_DONE;
+    }
+    size_t seen = 0;
+    size_t s = 0;
+    job.block_start[0] = 0;
+    for (size_t b = 1; b < job.n_blocks; b++)
+    {
+        while (s < count && seen + seqs[s].length <= total / job.n_blocks * b)
+        {
+            seen += seqs[s++].length;
+        }
+        job.block_start[b] = s;
+    }
+    job.block_start[job.n_blocks] = count;
+
+    int threads = parallel_threads(opts->threads);
+    double log_like = -INFINITY;
+    int updates;
+    for (updates = 0; ; updates++)
+    {
+        // E-step workers share the model, so every Poisson row they need is cached beforehand
+        for (size_t k = 0; k < count; k++)
+        {
+            if (hmm_model_cache_obs(model, &seqs[k]) != 0)
+            {
+                goto TRAIN_DONE;
+            }
+        }
+        if (parallel_for(threads, job.n_blocks, expect_task, &job) != 0)
+        {
+            goto TRAIN_DONE;
+        }
+        for (size_t b = 1; b < job.n_blocks; b++)
+        {
+            const double *from = job.acc + b * job.acc_size;
+            for (size_t i = 0; i < job.acc_size; i++)
+            {
+                job.acc[i] += from[i];
+            }
+        }
+
+        // the model is left as evaluated, so log_like is always that of the model returned
+        double previous = log_like;
+        log_like = job.acc[0];
+        if ((updates > 0 && log_like - previous <= opts->tolerance * fabs(log_like)) ||
+            updates == opts->max_iterations)
+        {
+            break;
+        }
+        if (maximise(model, job.acc, opts->pseudocount, p) != 0)
+        {
+            goto TRAIN_DONE;
+        }
+    }
+
+    if (result)
+    {
+        result->iterations = updates;
+        result->log_like = log_like;
+    }
+    rc = 0;
+
+    TRAIN_DONE:
+        free(job.block_start);
+        free(job.acc);
+        free(p);
+        return rc;
+}
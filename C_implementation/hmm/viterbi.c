@@ -0,0 +1,241 @@
+/**
+ * Viterbi decoding for any number of states and symbols.
+ *
+ * Scores are kept for two positions only (the previous and the current column); the backpointers of every
+ * position are kept for the traceback in the compact form selected by hmm_viterbi_opts (see trace.c).
+ * For each position the recurrence
+ *
+ *   score[t][j] = emit[obs[t]][j] + max_i ( score[t - 1][i] + trans[i][j] )
+ *
+ * is evaluated by viterbi_step, whose SIMD variants and their run-time selection live in kernel.c. Models with
+ * 2, 3, 4 or 8 states take the unrolled loops of kernel_small.c instead, and large models with few transitions
+ * the predecessor lists of kernel_sparse.c, all with the same results.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+
+int hmm_argmax(const double *v, int n)
+{
+    int best = 0;
+    for (int j = 1; j < n; j++)
+    {
+        if (v[j] >= v[best])
+        {
+            best = j;
+        }
+    }
+    return best;
+}
+
+
+void viterbi_column(const hmm_model *model, const double *restrict prev, const double *restrict emit,
+                    double *restrict cur, int32_t *restrict bp)
+{
+    if (model->pred_start)
+    {
+        viterbi_step_sparse(model, prev, emit, cur, bp);
+    }
+    else
+    {
+        viterbi_step(model->n_states, prev, model->log_trans, emit, cur, bp);
+    }
+}
+
+
+int viterbi_first_column(const hmm_model *model, const hmm_obs *obs, double *col)
+{
+    const double *emit = emission_at(model, obs, 0, col);
+    if (!emit)
+    {
+        return -1;
+    }
+    for (int j = 0; j < model->n_states; j++)
+    {
+        col[j] = emit[j] + model->log_init[j];
+    }
+    return 0;
+}
+
+size_t viterbi_work_size(int n_states)
+{
+    return n_states + emit_block_size(n_states);
+}
+
+int viterbi_advance(const hmm_model *model, const hmm_obs *obs, size_t from, size_t to, double *col,
+                    double *work, int32_t *bp, trace_store *trace, size_t trace_offset)
+{
+    int n = model->n_states;
+    small_advance_fn small = model->pred_start ? NULL : small_advance(n);
+    if (small)
+    {
+        return small(model, obs, from, to, col, work + n, trace, trace_offset);
+    }
+
+    double *prev = col;
+    double *cur = work;
+    emit_block rows;
+    emit_block_init(&rows, model, obs, work + n);
+
+    for (size_t t = from + 1; t <= to; t++)
+    {
+        const double *emit = emit_row(&rows, t);
+        if (!emit)
+        {
+            return -1;
+        }
+        viterbi_column(model, prev, emit, cur, bp);
+        if (trace)
+        {
+            trace_put(trace, t - trace_offset, bp);
+        }
+
+        double *swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+    if (prev != col)
+    {
+        memcpy(col, prev, n * sizeof(double));
+    }
+    return 0;
+}
+
+
+void hmm_viterbi_opts_init(hmm_viterbi_opts *opts)
+{
+    opts->mode = HMM_VITERBI_FULL;
+    opts->trace = HMM_TRACE_BYTES;
+    opts->checkpoint = 0;
+    opts->chunk = 0;
+    opts->threads = 0;
+    opts->beam_width = 0;
+    opts->beam_threshold = 0;
+    opts->lanes = 0;
+    opts->backend = HMM_BACKEND_CPU;
+    opts->score = HMM_SCORE_DOUBLE;
+    opts->timing = NULL;
+}
+
+
+int viterbi_full_run(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                     const hmm_viterbi_opts *opts, trace_store *trace, double *scores, int32_t *bp)
+{
+    int n = model->n_states;
+    size_t length = obs->length;
+    double start = timing_mark(opts);
+    HMM_STATS_START(forward);
+    double *col = scores;
+    double *work = scores + n;
+
+    if (viterbi_first_column(model, obs, col) != 0 ||
+        viterbi_advance(model, obs, 0, length - 1, col, work, bp, trace, 0) != 0)
+    {
+        return -1;
+    }
+
+    // traceback from the best final state
+    double forward_done = timing_mark(opts);
+    HMM_STATS_STOP(HMM_PHASE_FORWARD, forward, 0, length);
+    HMM_STATS_START(traceback);
+    int state = hmm_argmax(col, n);
+    if (log_prob)
+    {
+        *log_prob = col[state];
+    }
+    for (size_t t = length - 1; t > 0; t--)
+    {
+        path[t] = state;
+        state = trace_get(trace, t, state);
+    }
+    path[0] = state;
+    timing_record(opts, start, forward_done, timing_mark(opts));
+    HMM_STATS_STOP(HMM_PHASE_TRACEBACK, traceback, 0, length);
+    return 0;
+}
+
+// backpointers for every position, one forward pass and one traceback
+static int viterbi_full(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                        const hmm_viterbi_opts *opts)
+{
+    int n = model->n_states;
+    trace_store trace;
+    if (trace_init(&trace, opts->trace, n, obs->length) != 0)
+    {
+        return -1;
+    }
+
+    double *scores = malloc((n + viterbi_work_size(n)) * sizeof(double));
+    int32_t *bp = malloc(n * sizeof(int32_t));
+    int rc = -1;
+    if (!scores || !bp)
+    {
+        errno = ENOMEM;
+    }
+    else
+    {
+        rc = viterbi_full_run(model, obs, path, log_prob, opts, &trace, scores, bp);
+    }
+
+    free(scores);
+    free(bp);
+    trace_free(&trace);
+    return rc;
+}
+
+
+int hmm_viterbi_obs(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                    const hmm_viterbi_opts *opts)
+{
+    hmm_viterbi_opts defaults;
+    if (!opts)
+    {
+        hmm_viterbi_opts_init(&defaults);
+        opts = &defaults;
+    }
+
+    if (!model || !obs || (!obs->data && obs->length) || (!path && obs->length))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (obs->length == 0)
+    {
+        if (log_prob)
+        {
+            *log_prob = 0;
+        }
+        return 0;
+    }
+
+    if (opts->score != HMM_SCORE_DOUBLE)
+    {
+        return viterbi_narrow(model, obs, path, log_prob, opts);
+    }
+    switch (opts->mode)
+    {
+        case HMM_VITERBI_FULL:
+            return viterbi_full(model, obs, path, log_prob, opts);
+        case HMM_VITERBI_CHECKPOINT:
+            return viterbi_checkpoint(model, obs, path, log_prob, opts);
+        case HMM_VITERBI_PARALLEL:
+            return viterbi_parallel(model, obs, path, log_prob, opts);
+        case HMM_VITERBI_BEAM:
+            return viterbi_beam(model, obs, path, log_prob, opts);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+int hmm_viterbi(const hmm_model *model, const int *obs, size_t length, hmm_state *path, double *log_prob,
+                const hmm_viterbi_opts *opts)
+{
+    hmm_obs view = { HMM_OBS_INT, length, obs };
+    return hmm_viterbi_obs(model, &view, path, log_prob, opts);
+}
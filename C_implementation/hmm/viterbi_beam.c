@@ -0,0 +1,440 @@
+/**
+ * Beam-pruned Viterbi decoding: an approximate path for very large state spaces.
+ *
+ * Instead of a full score column, every position keeps a compact list of active states: at most
+ * opts->beam_width of them (the best scores; 0 for no limit) and only those within opts->beam_threshold of the
+ * best score (0 for no margin). A position costs O(active * N) with a dense transition table and
+ * O(outgoing edges of the active states) with predecessor lists, whose successor form is built once per decode.
+ * It pays off with hundreds of states; for a few dozen the vectorised dense kernels of HMM_VITERBI_FULL are faster.
+ *
+ * For every active state the trace records its state number and the index of its predecessor in the previous
+ * position's list, so the traceback follows indices without any search. Lists are kept in increasing state order
+ * and candidates compared with >=, as in viterbi_step, so with neither limit binding (width >= N, no threshold)
+ * the path and score equal those of HMM_VITERBI_FULL. States with a score of -INFINITY are never kept; when no
+ * state survives a position the decode fails with EDOM.
+ *
+ * A pruned path is not necessarily the most likely one; its score is the exact log probability of the path
+ * returned. Where the width ties at the cut-off, the lower-numbered states are kept.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+// trace entries reserved per position up front
+#define BEAM_INITIAL_WIDTH 4
+
+
+// one active state of one position
+typedef struct
+{
+    hmm_state state;
+    uint16_t from;          // index of its predecessor in the previous position's list
+} beam_entry;
+
+typedef struct
+{
+    const hmm_model *model;
+    size_t width;           // active states kept at most, at least 1
+    double threshold;       // score margin below the best, INFINITY without one
+
+    // successors of every state when the model has predecessor lists: the same edges grouped by source
+    int32_t *succ_start;
+    int32_t *succ_state;
+    double *succ_log;
+
+    // the trace: entries[start[t] .. start[t + 1] - 1] are the active states of position t
+    beam_entry *entries;
+    size_t n_entries;
+    size_t cap_entries;
+    size_t *start;
+
+    double *active;         // scores of the previous position's active states, in the order of its entries
+    double *col;            // candidate scores of the position being computed
+    int32_t *arg;           // and the index of their best predecessor
+    int32_t *touched;       // the states with a candidate, n_touched of them
+    size_t n_touched;
+    size_t *stamp;          // position at which a state last got a candidate, with successor lists
+    double *select;         // scratch for finding the width-th best score
+    emit_block rows;        // emission rows of the positions
+    double *rows_buf;
+} beam_search;
+
+
+static void beam_free(beam_search *b)
+{
+    free(b->succ_start);
+    free(b->succ_state);
+    free(b->succ_log);
+    free(b->entries);
+    free(b->start);
+    free(b->active);
+    free(b->col);
+    free(b->arg);
+    free(b->touched);
+    free(b->stamp);
+    free(b->select);
+    free(b->rows_buf);
+}
+
+// turns the predecessor lists into successor lists, sources in increasing order within every list of
+// destinations because these are visited in order
+static int build_successors(beam_search *b)
+{
+    const hmm_model *model = b->model;
+    int n = model->n_states;
+    int32_t edges = model->pred_start[n];
+
+    b->succ_start = calloc(n + 1, sizeof(int32_t));
+    b->succ_state = malloc((edges ? edges : 1) * sizeof(int32_t));
+    b->succ_log = malloc((edges ? edges : 1) * sizeof(double));
+    if (!b->succ_start || !b->succ_state || !b->succ_log)
+    {
+        return -1;
+    }
+
+    for (int32_t e = 0; e < edges; e++)
+    {
+        b->succ_start[model->pred_state[e] + 1]++;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        b->succ_start[i + 1] += b->succ_start[i];
+    }
+    // succ_start[i] serves as the fill cursor of source i, which leaves it at the start of source i + 1
+    for (int j = 0; j < n; j++)
+    {
+        for (int32_t e = model->pred_start[j]; e < model->pred_start[j + 1]; e++)
+        {
+            int32_t slot = b->succ_start[model->pred_state[e]]++;
+            b->succ_state[slot] = j;
+            b->succ_log[slot] = model->pred_log[e];
+        }
+    }
+    for (int i = n; i > 0; i--)
+    {
+        b->succ_start[i] = b->succ_start[i - 1];
+    }
+    b->succ_start[0] = 0;
+    return 0;
+}
+
+static int beam_init(beam_search *b, const hmm_model *model, const hmm_obs *obs, const hmm_viterbi_opts *opts)
+{
+    size_t n = model->n_states;
+    size_t length = obs->length;
+    memset(b, 0, sizeof(*b));
+    b->model = model;
+    b->width = opts->beam_width && opts->beam_width < n ? opts->beam_width : n;
+    b->threshold = opts->beam_threshold > 0 ? opts->beam_threshold : INFINITY;
+    if (length > SIZE_MAX / sizeof(size_t) - 1)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // a few states per position to begin with, grown by doubling where more survive
+    size_t per = b->width < BEAM_INITIAL_WIDTH ? b->width : BEAM_INITIAL_WIDTH;
+    b->cap_entries = length <= SIZE_MAX / sizeof(beam_entry) / per ? length * per : length;
+
+    b->entries = malloc(b->cap_entries * sizeof(beam_entry));
+    b->start = malloc((length + 1) * sizeof(size_t));
+    b->active = malloc(n * sizeof(double));
+    b->col = malloc(n * sizeof(double));
+    b->arg = malloc(n * sizeof(int32_t));
+    b->touched = malloc(n * sizeof(int32_t));
+    b->stamp = calloc(n, sizeof(size_t));
+    b->select = malloc(n * sizeof(double));
+    b->rows_buf = malloc(emit_block_size(n) * sizeof(double));
+    if (!b->entries || !b->start || !b->active || !b->col || !b->arg || !b->touched || !b->stamp || !b->select ||
+        !b->rows_buf || (model->pred_start && build_successors(b) != 0))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    emit_block_init(&b->rows, model, obs, b->rows_buf);
+    return 0;
+}
+
+
+// the k-th largest of v[0 .. count - 1], counted from 1, reordering v
+static double kth_largest(double *v, size_t count, size_t k)
+{
+    size_t lo = 0;
+    size_t hi = count;
+    while (1)
+    {
+        // three-way partition of v[lo .. hi - 1] into > pivot, == pivot, < pivot, so ties cannot stall it
+        double pivot = v[lo + (hi - lo) / 2];
+        size_t gt = lo;
+        size_t i = lo;
+        size_t lt = hi;
+        while (i < lt)
+        {
+            double x = v[i];
+            if (x > pivot)
+            {
+                v[i++] = v[gt];
+                v[gt++] = x;
+            }
+            else if (x < pivot)
+            {
+                v[i] = v[--lt];
+                v[lt] = x;
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        if (k <= gt)
+        {
+            hi = gt;
+        }
+        else if (k <= lt)
+        {
+            return pivot;
+        }
+        else
+        {
+            lo = lt;
+        }
+    }
+}
+
+static int by_state(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *) a;
+    int32_t y = *(const int32_t *) b;
+    return (x > y) - (x < y);
+}
+
+// adds the emissions to the candidates of position t and keeps as its active list those with a finite score,
+// within the threshold of the best and among the width best, in increasing state order
+static int prune(beam_search *b, size_t t, const double *emit)
+{
+    int32_t *touched = b->touched;
+    double *col = b->col;
+    size_t m = 0;
+    double best = -INFINITY;
+    for (size_t k = 0; k < b->n_touched; k++)
+    {
+        int32_t j = touched[k];
+        double score = col[j] + emit[j];
+        col[j] = score;
+        if (score > -INFINITY)
+        {
+            touched[m++] = j;
+            best = score > best ? score : best;
+        }
+    }
+    if (m == 0)
+    {
+        errno = EDOM;
+        return -1;
+    }
+
+    double cut = best - b->threshold;
+    size_t kept = 0;
+    for (size_t k = 0; k < m; k++)
+    {
+        touched[kept] = touched[k];
+        kept += col[touched[k]] >= cut;
+    }
+    m = kept;
+    // candidates from successor lists come in the order they were reached
+    if (b->succ_start)
+    {
+        qsort(touched, m, sizeof(int32_t), by_state);
+    }
+
+    // beyond the width only scores above the width-th best, and as many equal to it as are left
+    double floor = -INFINITY;
+    size_t at_floor = m;
+    if (m > b->width)
+    {
+        for (size_t k = 0; k < m; k++)
+        {
+            b->select[k] = col[touched[k]];
+        }
+        floor = kth_largest(b->select, m, b->width);
+        size_t above = 0;
+        for (size_t k = 0; k < m; k++)
+        {
+            above += col[touched[k]] > floor;
+        }
+        at_floor = b->width - above;
+        m = b->width;
+    }
+
+    if (m > b->cap_entries - b->n_entries)
+    {
+        size_t cap = b->cap_entries > SIZE_MAX / sizeof(beam_entry) / 2 ? SIZE_MAX / sizeof(beam_entry)
+                                                                           : 2 * b->cap_entries;
+        beam_entry *grown = cap - b->n_entries >= m ? realloc(b->entries, cap * sizeof(beam_entry)) : NULL;
+        if (!grown)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        b->entries = grown;
+        b->cap_entries = cap;
+    }
+
+    beam_entry *out = b->entries + b->n_entries;
+    size_t count = 0;
+    for (size_t k = 0; count < m; k++)
+    {
+        int32_t j = touched[k];
+        double score = col[j];
+        if (score < floor || (score == floor && at_floor == 0))
+        {
+            continue;
+        }
+        at_floor -= score == floor;
+        out[count].state = j;
+        out[count].from = t ? b->arg[j] : 0;
+        b->active[count++] = score;
+    }
+    b->n_entries += count;
+    b->start[t + 1] = b->n_entries;
+    return 0;
+}
+
+// candidate scores of position t, before emissions, from the active list of position t - 1
+static void expand(beam_search *b, size_t t)
+{
+    const hmm_model *model = b->model;
+    int n = model->n_states;
+    const beam_entry *prev = b->entries + b->start[t - 1];
+    size_t n_prev = b->start[t] - b->start[t - 1];
+    double *restrict col = b->col;
+    int32_t *restrict arg = b->arg;
+
+    if (!b->succ_start)
+    {
+        // dense table: every state is a candidate, the active states visited in increasing order as in
+        // viterbi_step so that >= leaves ties to the higher-numbered predecessor
+        for (int j = 0; j < n; j++)
+        {
+            col[j] = -INFINITY;
+            arg[j] = 0;
+            b->touched[j] = j;
+        }
+        b->n_touched = n;
+        for (size_t a = 0; a < n_prev; a++)
+        {
+            const double *restrict row = model->log_trans + (size_t) prev[a].state * n;
+            double p = b->active[a];
+            for (int j = 0; j < n; j++)
+            {
+                double cand = p + row[j];
+                int take = cand >= col[j];
+                col[j] = take ? cand : col[j];
+                arg[j] = take ? (int32_t) a : arg[j];
+            }
+        }
+        return;
+    }
+
+    b->n_touched = 0;
+    for (size_t a = 0; a < n_prev; a++)
+    {
+        int32_t i = prev[a].state;
+        double p = b->active[a];
+        for (int32_t e = b->succ_start[i]; e < b->succ_start[i + 1]; e++)
+        {
+            int32_t j = b->succ_state[e];
+            double cand = p + b->succ_log[e];
+            if (b->stamp[j] != t)
+            {
+                b->stamp[j] = t;
+                col[j] = cand;
+                arg[j] = (int32_t) a;
+                b->touched[b->n_touched++] = j;
+            }
+            else if (cand >= col[j])
+            {
+                col[j] = cand;
+                arg[j] = (int32_t) a;
+            }
+        }
+    }
+}
+
+
+int viterbi_beam(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                 const hmm_viterbi_opts *opts)
+{
+    if (!(opts->beam_threshold >= 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int n = model->n_states;
+    size_t length = obs->length;
+    double start = timing_mark(opts);
+    HMM_STATS_START(forward);
+
+    beam_search b;
+    int rc = -1;
+    if (beam_init(&b, model, obs, opts) != 0)
+    {
+        goto BEAM_DONE;
+    }
+
+    // every state is a candidate for the first position
+    for (int j = 0; j < n; j++)
+    {
+        b.col[j] = model->log_init[j];
+        b.touched[j] = j;
+    }
+    b.n_touched = n;
+    b.start[0] = 0;
+    for (size_t t = 0; t < length; t++)
+    {
+        if (t)
+        {
+            expand(&b, t);
+        }
+        const double *emit = emit_row(&b.rows, t);
+        if (!emit || prune(&b, t, emit) != 0)
+        {
+            goto BEAM_DONE;
+        }
+    }
+
+    double forward_done = timing_mark(opts);
+    HMM_STATS_STOP(HMM_PHASE_FORWARD, forward, 0, length);
+    HMM_STATS_START(traceback);
+
+    // the best of the last list, ties to the higher-numbered state as in hmm_argmax
+    size_t count = b.start[length] - b.start[length - 1];
+    size_t k = 0;
+    for (size_t a = 1; a < count; a++)
+    {
+        k = b.active[a] >= b.active[k] ? a : k;
+    }
+    if (log_prob)
+    {
+        *log_prob = b.active[k];
+    }
+    for (size_t t = length; t-- > 0; )
+    {
+        const beam_entry *e = &b.entries[b.start[t] + k];
+        path[t] = e->state;
+        k = e->from;
+    }
+    timing_record(opts, start, forward_done, timing_mark(opts));
+    HMM_STATS_STOP(HMM_PHASE_TRACEBACK, traceback, 0, length);
+    rc = 0;
+
+    BEAM_DONE:
+        beam_free(&b);
+        return rc;
+}
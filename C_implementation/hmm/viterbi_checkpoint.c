@@ -0,0 +1,120 @@
+/**
+ * Checkpointed Viterbi decoding in O(N * sqrt(T)) memory.
+ *
+ * The forward pass keeps the score column of every k-th position only (k = sqrt(T) unless set in
+ * hmm_viterbi_opts.checkpoint) and no backpointers at all. The traceback then walks the segments between
+ * checkpoints from last to first: each segment is recomputed from its saved column with backpointers into a
+ * trace of k columns, and traced back from the state already known at its end.
+ *
+ * Every position is therefore computed twice, and memory is T / k score columns plus one k-column trace.
+ * The recomputation runs the same kernel on the same saved scores, so the path is identical to HMM_VITERBI_FULL.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+
+int viterbi_checkpoint(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                       const hmm_viterbi_opts *opts)
+{
+    int n = model->n_states;
+    size_t length = obs->length;
+    size_t k = opts->checkpoint ? opts->checkpoint : (size_t) ceil(sqrt((double) length));
+    if (k > length)
+    {
+        k = length;
+    }
+    size_t n_checkpoints = (length - 1) / k + 1;
+    double start = timing_mark(opts);
+    HMM_STATS_START(forward);
+
+    if (n_checkpoints > SIZE_MAX / sizeof(double) / n)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    trace_store trace;
+    if (trace_init(&trace, opts->trace, n, k + 1) != 0)
+    {
+        return -1;
+    }
+    double *saved = malloc(n_checkpoints * n * sizeof(double));
+    double *scores = malloc((n + viterbi_work_size(n)) * sizeof(double));
+    int32_t *bp = malloc(n * sizeof(int32_t));
+
+    if (!saved || !scores || !bp)
+    {
+        errno = ENOMEM;
+        goto CHECKPOINT_FAIL;
+    }
+    double *col = scores;
+    double *work = scores + n;
+
+    // forward pass, saving the column at positions 0, k, 2k, ...
+    if (viterbi_first_column(model, obs, col) != 0)
+    {
+        goto CHECKPOINT_FAIL;
+    }
+    memcpy(saved, col, n * sizeof(double));
+    for (size_t c = 1; c < n_checkpoints; c++)
+    {
+        if (viterbi_advance(model, obs, (c - 1) * k, c * k, col, work, bp, NULL, 0) != 0)
+        {
+            goto CHECKPOINT_FAIL;
+        }
+        memcpy(saved + c * n, col, n * sizeof(double));
+    }
+    if (viterbi_advance(model, obs, (n_checkpoints - 1) * k, length - 1, col, work, bp, NULL, 0) != 0)
+    {
+        goto CHECKPOINT_FAIL;
+    }
+
+    double forward_done = timing_mark(opts);
+    HMM_STATS_STOP(HMM_PHASE_FORWARD, forward, 0, length);
+    HMM_STATS_START(traceback);
+    int state = hmm_argmax(col, n);
+    if (log_prob)
+    {
+        *log_prob = col[state];
+    }
+
+    // traceback segment by segment; state always holds the state at the end of the segment being traced
+    for (size_t c = n_checkpoints; c-- > 0; )
+    {
+        size_t from = c * k;
+        size_t to = from + k < length ? from + k : length - 1;
+
+        memcpy(col, saved + c * n, n * sizeof(double));
+        if (viterbi_advance(model, obs, from, to, col, work, bp, &trace, from) != 0)
+        {
+            goto CHECKPOINT_FAIL;
+        }
+        for (size_t t = to; t > from; t--)
+        {
+            path[t] = state;
+            state = trace_get(&trace, t - from, state);
+        }
+    }
+    path[0] = state;
+    timing_record(opts, start, forward_done, timing_mark(opts));
+    HMM_STATS_STOP(HMM_PHASE_TRACEBACK, traceback, 0, length);
+
+    free(saved);
+    free(scores);
+    free(bp);
+    trace_free(&trace);
+    return 0;
+
+
+    CHECKPOINT_FAIL:
+        free(saved);
+        free(scores);
+        free(bp);
+        trace_free(&trace);
+        return -1;
+}
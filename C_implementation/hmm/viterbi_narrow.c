@@ -0,0 +1,415 @@
+/**
+ * Viterbi decoding with narrow scores, selected by hmm_viterbi_opts.score.
+ *
+ *   HMM_SCORE_FLOAT    float log scores
+ *   HMM_SCORE_FIXED    int32_t log scores in units of 1 / FIXED_SCALE, FIXED_FLOOR and below meaning impossible
+ *
+ * The model's tables are rounded to the score type once per decode. After every position the column maximum is
+ * subtracted from the column, so scores stay near 0, where both types are most precise, however long the
+ * sequence. The score reported for the path is recomputed from the double tables along it, so it is exact.
+ *
+ * Both types are half the width of a double, so a SIMD register holds twice as many states: 8 for AVX2 and 16 for
+ * AVX-512, enough for a whole column of the small models these modes are meant for. The step variant matching
+ * the max-plus kernel in use (hmm_kernel_name()) is taken, the scalar one without a SIMD kernel.
+ *
+ * Ties are broken by the rule of viterbi_step: the largest candidate wins and among equal candidates the
+ * higher-numbered predecessor. Paths therefore only differ from double precision where two candidates are so
+ * close that rounding makes them equal or swaps them. hmm_decode -v reports such divergence for a given input.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "hmm_internal.h"
+
+#define FIXED_SCALE 65536.0
+// a log probability below FIXED_FLOOR / FIXED_SCALE (8192 nats) is treated as impossible; sums of three floors
+// still fit an int32_t
+#define FIXED_FLOOR (-(1 << 29))
+
+
+static void round_float(const double *from, size_t count, float *to)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        to[i] = (float) from[i];
+    }
+}
+
+static void round_fixed(const double *from, size_t count, int32_t *to)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        double x = from[i] * FIXED_SCALE;
+        to[i] = x > FIXED_FLOOR ? (int32_t) lrint(x) : FIXED_FLOOR;
+    }
+}
+
+#define FLOAT_DEAD(x) ((x) == -INFINITY)
+#define FLOAT_CLAMP(x) (x)
+
+#define FIXED_DEAD(x) ((x) <= FIXED_FLOOR)
+#define FIXED_CLAMP(x) ((x) > FIXED_FLOOR ? (x) : FIXED_FLOOR)
+
+
+typedef void (*float_step_fn)(int n, const float *restrict prev, const float *restrict trans,
+                              const float *restrict emit, float *restrict cur, int32_t *restrict bp);
+typedef void (*fixed_step_fn)(int n, const int32_t *restrict prev, const int32_t *restrict trans,
+                              const int32_t *restrict emit, int32_t *restrict cur, int32_t *restrict bp);
+
+
+// one position of the recurrence without SIMD, i-outer like viterbi_step
+#define DEFINE_SCALAR_STEP(NAME, T)                                                                                \
+static void NAME(int n, const T *restrict prev, const T *restrict trans, const T *restrict emit,                  \
+                 T *restrict cur, int32_t *restrict bp)                                                            \
+{                                                                                                                  \
+    for (int j = 0; j < n; j++)                                                                                    \
+    {                                                                                                              \
+        cur[j] = prev[0] + trans[j];                                                                               \
+        bp[j] = 0;                                                                                                 \
+    }                                                                                                              \
+    for (int i = 1; i < n; i++)                                                                                    \
+    {                                                                                                              \
+        T from = prev[i];                                                                                          \
+        const T *row = trans + (size_t) i * n;                                                                     \
+        for (int j = 0; j < n; j++)                                                                                \
+        {                                                                                                          \
+            T cand = from + row[j];                                                                                \
+            if (cand >= cur[j])                                                                                    \
+            {                                                                                                      \
+                cur[j] = cand;                                                                                     \
+                bp[j] = i;                                                                                         \
+            }                                                                                                      \
+        }                                                                                                          \
+    }                                                                                                              \
+    for (int j = 0; j < n; j++)                                                                                    \
+    {                                                                                                              \
+        cur[j] += emit[j];                                                                                         \
+    }                                                                                                              \
+}
+
+DEFINE_SCALAR_STEP(step_float, float)
+DEFINE_SCALAR_STEP(step_fixed, int32_t)
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// The SIMD steps cover a block of 8 (AVX2) or 16 (AVX-512) destination states per register and load the last,
+// partial block under a mask, so models with fewer states than a register holds run in one block.
+
+// lane masks for maskload: entries 8 - left .. 15 - left enable the first left lanes
+static const int32_t lane_masks[16] = { -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+__attribute__((target("avx2")))
+static void step_float_avx2(int n, const float *restrict prev, const float *restrict trans,
+                            const float *restrict emit, float *restrict cur, int32_t *restrict bp)
+{
+    for (int j0 = 0; j0 < n; j0 += 8)
+    {
+        int left = n - j0 < 8 ? n - j0 : 8;
+        __m256i lanes = _mm256_loadu_si256((const __m256i *) (lane_masks + 8 - left));
+        __m256 best = _mm256_add_ps(_mm256_set1_ps(prev[0]), _mm256_maskload_ps(trans + j0, lanes));
+        __m256i arg = _mm256_setzero_si256();
+
+        for (int i = 1; i < n; i++)
+        {
+            __m256 cand = _mm256_add_ps(_mm256_set1_ps(prev[i]),
+                                        _mm256_maskload_ps(trans + (size_t) i * n + j0, lanes));
+            __m256 take = _mm256_cmp_ps(cand, best, _CMP_GE_OQ);
+            best = _mm256_blendv_ps(best, cand, take);
+            arg = _mm256_blendv_epi8(arg, _mm256_set1_epi32(i), _mm256_castps_si256(take));
+        }
+        _mm256_maskstore_ps(cur + j0, lanes, _mm256_add_ps(best, _mm256_maskload_ps(emit + j0, lanes)));
+        _mm256_maskstore_epi32(bp + j0, lanes, arg);
+    }
+}
+
+__attribute__((target("avx2")))
+static void step_fixed_avx2(int n, const int32_t *restrict prev, const int32_t *restrict trans,
+                            const int32_t *restrict emit, int32_t *restrict cur, int32_t *restrict bp)
+{
+    for (int j0 = 0; j0 < n; j0 += 8)
+    {
+        int left = n - j0 < 8 ? n - j0 : 8;
+        __m256i lanes = _mm256_loadu_si256((const __m256i *) (lane_masks + 8 - left));
+        __m256i best = _mm256_add_epi32(_mm256_set1_epi32(prev[0]), _mm256_maskload_epi32(trans + j0, lanes));
+        __m256i arg = _mm256_setzero_si256();
+
+        for (int i = 1; i < n; i++)
+        {
+            __m256i cand = _mm256_add_epi32(_mm256_set1_epi32(prev[i]),
+                                            _mm256_maskload_epi32(trans + (size_t) i * n + j0, lanes));
+            // cand >= best unless best > cand
+            __m256i keep = _mm256_cmpgt_epi32(best, cand);
+            best = _mm256_blendv_epi8(cand, best, keep);
+            arg = _mm256_blendv_epi8(_mm256_set1_epi32(i), arg, keep);
+        }
+        _mm256_maskstore_epi32(cur + j0, lanes, _mm256_add_epi32(best, _mm256_maskload_epi32(emit + j0, lanes)));
+        _mm256_maskstore_epi32(bp + j0, lanes, arg);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void step_float_avx512(int n, const float *restrict prev, const float *restrict trans,
+                              const float *restrict emit, float *restrict cur, int32_t *restrict bp)
+{
+    for (int j0 = 0; j0 < n; j0 += 16)
+    {
+        __mmask16 lanes = n - j0 < 16 ? (__mmask16) ((1u << (n - j0)) - 1) : (__mmask16) 0xffff;
+        __m512 best = _mm512_add_ps(_mm512_set1_ps(prev[0]), _mm512_maskz_loadu_ps(lanes, trans + j0));
+        __m512i arg = _mm512_setzero_si512();
+
+        for (int i = 1; i < n; i++)
+        {
+            __m512 cand = _mm512_add_ps(_mm512_set1_ps(prev[i]),
+                                        _mm512_maskz_loadu_ps(lanes, trans + (size_t) i * n + j0));
+            __mmask16 take = _mm512_cmp_ps_mask(cand, best, _CMP_GE_OQ);
+            best = _mm512_mask_blend_ps(take, best, cand);
+            arg = _mm512_mask_blend_epi32(take, arg, _mm512_set1_epi32(i));
+        }
+        _mm512_mask_storeu_ps(cur + j0, lanes, _mm512_add_ps(best, _mm512_maskz_loadu_ps(lanes, emit + j0)));
+        _mm512_mask_storeu_epi32(bp + j0, lanes, arg);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void step_fixed_avx512(int n, const int32_t *restrict prev, const int32_t *restrict trans,
+                              const int32_t *restrict emit, int32_t *restrict cur, int32_t *restrict bp)
+{
+    for (int j0 = 0; j0 < n; j0 += 16)
+    {
+        __mmask16 lanes = n - j0 < 16 ? (__mmask16) ((1u << (n - j0)) - 1) : (__mmask16) 0xffff;
+        __m512i best = _mm512_add_epi32(_mm512_set1_epi32(prev[0]), _mm512_maskz_loadu_epi32(lanes, trans + j0));
+        __m512i arg = _mm512_setzero_si512();
+
+        for (int i = 1; i < n; i++)
+        {
+            __m512i cand = _mm512_add_epi32(_mm512_set1_epi32(prev[i]),
+                                            _mm512_maskz_loadu_epi32(lanes, trans + (size_t) i * n + j0));
+            __mmask16 take = _mm512_cmpge_epi32_mask(cand, best);
+            best = _mm512_mask_blend_epi32(take, best, cand);
+            arg = _mm512_mask_blend_epi32(take, arg, _mm512_set1_epi32(i));
+        }
+        _mm512_mask_storeu_epi32(cur + j0, lanes,
+                                 _mm512_add_epi32(best, _mm512_maskz_loadu_epi32(lanes, emit + j0)));
+        _mm512_mask_storeu_epi32(bp + j0, lanes, arg);
+    }
+}
+
+#endif
+
+
+// subtracts the column maximum from every score, unless every state is impossible
+#define DEFINE_RENORMALISE(NAME, T, DEAD, CLAMP)                                                                   \
+static void NAME(int n, T *col)                                                                                    \
+{                                                                                                                  \
+    T top = col[0];                                                                                                \
+    for (int j = 1; j < n; j++)                                                                                    \
+    {                                                                                                              \
+        top = col[j] > top ? col[j] : top;                                                                         \
+    }                                                                                                              \
+    if (DEAD(top))                                                                                                 \
+    {                                                                                                              \
+        top = 0;                                                                                                   \
+    }                                                                                                              \
+    for (int j = 0; j < n; j++)                                                                                    \
+    {                                                                                                              \
+        col[j] = CLAMP(col[j] - top);                                                                              \
+    }                                                                                                              \
+}
+
+DEFINE_RENORMALISE(renormalise_float, float, FLOAT_DEAD, FLOAT_CLAMP)
+DEFINE_RENORMALISE(renormalise_fixed, int32_t, FIXED_DEAD, FIXED_CLAMP)
+
+
+// the forward pass of viterbi_full over narrow scores, with tables already rounded; leaves the final column in col
+#define DEFINE_NARROW_PASS(NAME, T, STEP_FN, ROUND, RENORMALISE)                                                    \
+static int NAME(const hmm_model *model, const hmm_obs *obs, const T *trans, const T *emit_table, int rows,         \
+                STEP_FN step, T *col, T *work, T *row, double *scratch, int32_t *bp, trace_store *trace)           \
+{                                                                                                                  \
+    int n = model->n_states;                                                                                       \
+    if (viterbi_first_column(model, obs, scratch) != 0)                                                            \
+    {                                                                                                              \
+        return -1;                                                                                                 \
+    }                                                                                                              \
+    ROUND(scratch, n, col);                                                                                        \
+    RENORMALISE(n, col);                                                                                           \
+                                                                                                                   \
+    T *prev = col;                                                                                                 \
+    T *cur = work;                                                                                                 \
+    for (size_t t = 1; t < obs->length; t++)                                                                       \
+    {                                                                                                              \
+        int k = obs_at(obs, t);                                                                                    \
+        const T *emit = row;                                                                                       \
+        if (k >= 0 && k < rows)                                                                                    \
+        {                                                                                                          \
+            emit = emit_table + (size_t) k * n;                                                                    \
+        }                                                                                                          \
+        else                                                                                                       \
+        {                                                                                                          \
+            const double *wide = emission_at(model, obs, t, scratch);                                              \
+            if (!wide)                                                                                             \
+            {                                                                                                      \
+                return -1;                                                                                         \
+            }                                                                                                      \
+            ROUND(wide, n, row);                                                                                   \
+        }                                                                                                          \
+                                                                                                                   \
+        step(n, prev, trans, emit, cur, bp);                                                                       \
+        RENORMALISE(n, cur);                                                                                       \
+        trace_put(trace, t, bp);                                                                                   \
+                                                                                                                   \
+        T *swap = prev;                                                                                            \
+        prev = cur;                                                                                                \
+        cur = swap;                                                                                                \
+    }                                                                                                              \
+    if (prev != col)                                                                                               \
+    {                                                                                                              \
+        memcpy(col, prev, n * sizeof(T));                                                                          \
+    }                                                                                                              \
+    return 0;                                                                                                      \
+}
+
+DEFINE_NARROW_PASS(pass_float, float, float_step_fn, round_float, renormalise_float)
+DEFINE_NARROW_PASS(pass_fixed, int32_t, fixed_step_fn, round_fixed, renormalise_fixed)
+
+
+// decodes obs into path with scores of type T; the tables and columns live in one allocation
+#define DEFINE_NARROW_DECODE(NAME, T, ROUND, PASS, STEP)                                                           \
+static int NAME(const hmm_model *model, const hmm_obs *obs, hmm_state *path, const hmm_viterbi_opts *opts)        \
+{                                                                                                                  \
+    size_t n = model->n_states;                                                                                    \
+    int rows = model->emission == HMM_EMIT_CATEGORICAL ? model->n_symbols : model->n_cached;                       \
+    double start = timing_mark(opts);                                                                              \
+    HMM_STATS_START(forward);                                                                                      \
+    trace_store trace;                                                                                             \
+    if (trace_init(&trace, opts->trace, n, obs->length) != 0)                                                      \
+    {                                                                                                              \
+        return -1;                                                                                                 \
+    }                                                                                                              \
+                                                                                                                   \
+    T *tables = malloc((n * n + (size_t) rows * n + 3 * n) * sizeof(T));                                           \
+    double *scratch = malloc(n * sizeof(double));                                                                  \
+    int32_t *bp = malloc(n * sizeof(int32_t));                                                                     \
+    int rc = -1;                                                                                                   \
+    if (!tables || !scratch || !bp)                                                                                \
+    {                                                                                                              \
+        errno = ENOMEM;                                                                                            \
+        goto NARROW_DONE;                                                                                          \
+    }                                                                                                              \
+    T *trans = tables;                                                                                             \
+    T *emit = trans + n * n;                                                                                       \
+    T *col = emit + (size_t) rows * n;                                                                             \
+    ROUND(model->log_trans, n * n, trans);                                                                         \
+    ROUND(model->log_emit, (size_t) rows * n, emit);                                                               \
+                                                                                                                   \
+    if (PASS(model, obs, trans, emit, rows, STEP, col, col + n, col + 2 * n, scratch, bp, &trace) != 0)            \
+    {                                                                                                              \
+        goto NARROW_DONE;                                                                                          \
+    }                                                                                                              \
+                                                                                                                   \
+    double forward_done = timing_mark(opts);                                                                       \
+    HMM_STATS_STOP(HMM_PHASE_FORWARD, forward, 0, obs->length);                                                    \
+    HMM_STATS_START(traceback);                                                                                    \
+    int state = 0;                                                                                                 \
+    for (size_t j = 1; j < n; j++)                                                                                 \
+    {                                                                                                              \
+        state = col[j] >= col[state] ? (int) j : state;                                                            \
+    }                                                                                                              \
+    for (size_t t = obs->length - 1; t > 0; t--)                                                                   \
+    {                                                                                                              \
+        path[t] = state;                                                                                           \
+        state = trace_get(&trace, t, state);                                                                       \
+    }                                                                                                              \
+    path[0] = state;                                                                                               \
+    timing_record(opts, start, forward_done, timing_mark(opts));                                                   \
+    HMM_STATS_STOP(HMM_PHASE_TRACEBACK, traceback, 0, obs->length);                                                \
+    rc = 0;                                                                                                        \
+                                                                                                                   \
+    NARROW_DONE:                                                                                                   \
+        free(tables);                                                                                              \
+        free(scratch);                                                                                             \
+        free(bp);                                                                                                  \
+        trace_free(&trace);                                                                                        \
+        return rc;                                                                                                 \
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the step variant for the instruction set of the max-plus kernel in use
+#define PICK_STEP(PLAIN, AVX2, AVX512)                                                                             \
+    (strcmp(hmm_kernel_name(), "avx512") == 0 ? AVX512 : strcmp(hmm_kernel_name(), "avx2") == 0 ? AVX2 : PLAIN)
+#else
+#define PICK_STEP(PLAIN, AVX2, AVX512) PLAIN
+#endif
+
+DEFINE_NARROW_DECODE(decode_float, float, round_float, pass_float,
+                     PICK_STEP(step_float, step_float_avx2, step_float_avx512))
+DEFINE_NARROW_DECODE(decode_fixed, int32_t, round_fixed, pass_fixed,
+                     PICK_STEP(step_fixed, step_fixed_avx2, step_fixed_avx512))
+
+
+// log probability of path in double precision; -INFINITY for an impossible path
+static int path_score(const hmm_model *model, const hmm_obs *obs, const hmm_state *path, double *log_prob)
+{
+    size_t n = model->n_states;
+    double *scratch = malloc(n * sizeof(double));
+    if (!scratch)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    double score = model->log_init[path[0]];
+    for (size_t t = 0; t < obs->length; t++)
+    {
+        const double *emit = emission_at(model, obs, t, scratch);
+        if (!emit)
+        {
+            free(scratch);
+            return -1;
+        }
+        if (t > 0)
+        {
+            score += model->log_trans[path[t - 1] * n + path[t]];
+        }
+        score += emit[path[t]];
+    }
+    free(scratch);
+    *log_prob = score;
+    return 0;
+}
+
+
+int viterbi_narrow(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                   const hmm_viterbi_opts *opts)
+{
+    int rc;
+    if (opts->mode != HMM_VITERBI_FULL)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    switch (opts->score)
+    {
+        case HMM_SCORE_FLOAT:
+            rc = decode_float(model, obs, path, opts);
+            break;
+        case HMM_SCORE_FIXED:
+            rc = decode_fixed(model, obs, path, opts);
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    if (rc != 0 || !log_prob)
+    {
+        return rc;
+    }
+    return path_score(model, obs, path, log_prob);
+}
@@ -0,0 +1,287 @@
+/**
+ * Viterbi decoding of one long sequence on several threads, using the associativity of max-plus products.
+ *
+ * The transitions into positions 1 .. T - 1 are cut into chunks of opts->chunk positions and decoded in five
+ * phases, the parallel ones running over chunks:
+ *
+ *   1. parallel    transfer matrix of every chunk, M[i][j] = best score of entering the chunk in state i and
+ *                  leaving it in state j. This runs the recurrence once per entry state, N times the work of a
+ *                  plain pass, which pays off for small N and very large T
+ *   2. sequential  prefix scan of the score column at every chunk boundary, v' = v (max,+) M
+ *   3. parallel    every chunk rerun from its boundary column with backpointers, and for each exit state the
+ *                  state its survivor entered the chunk in
+ *   4. sequential  exit state of every chunk, from the last chunk backwards through the entry states
+ *   5. parallel    traceback inside every chunk from its exit state
+ *
+ * The boundary columns of phase 2 add the same terms as a sequential pass in a different order, so they can differ
+ * from it in the last bits and a path through an exact or near tie may differ from HMM_VITERBI_FULL; its score is
+ * the optimum up to rounding. The chunk length, not the thread count, fixes the result: any number of threads
+ * gives the same path.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmm_internal.h"
+
+// default chunk length, independent of the thread count so that results are too
+#define PARALLEL_CHUNK (1 << 16)
+
+
+typedef struct
+{
+    const hmm_model *model;
+    const hmm_obs *obs;
+    hmm_trace trace_kind;
+    size_t chunk;
+    size_t n_chunks;
+    double *transfer;       // n_chunks matrices of n * n
+    double *boundary;       // n_chunks + 1 columns, scores at the positions c * chunk and T - 1
+    double *last_col;       // scores at T - 1 as recomputed in phase 3
+    trace_store *traces;
+    int32_t *entry;         // n_chunks * n, entry state by exit state
+    int32_t *exit_state;    // n_chunks
+    hmm_state *path;
+} parallel_job;
+
+
+static size_t chunk_from(const parallel_job *job, size_t c)
+{
+    return c * job->chunk;
+}
+
+static size_t chunk_to(const parallel_job *job, size_t c)
+{
+    size_t length = job->obs->length;
+    return (c + 1) * job->chunk < length - 1 ? (c + 1) * job->chunk : length - 1;
+}
+
+
+// phase 1: each row i of the transfer matrix is an ordinary recurrence started from state i alone
+static int transfer_task(void *ctx, size_t c)
+{
+    parallel_job *job = ctx;
+    int n = job->model->n_states;
+    double *m = job->transfer + c * n * n;
+    double *work = malloc(viterbi_work_size(n) * sizeof(double));
+    int32_t *bp = malloc(n * sizeof(int32_t));
+    int rc = -1;
+
+    if (!work || !bp)
+    {
+        errno = ENOMEM;
+        goto TRANSFER_DONE;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        double *row = m + (size_t) i * n;
+        for (int j = 0; j < n; j++)
+        {
+            row[j] = i == j ? 0 : -INFINITY;
+        }
+        if (viterbi_advance(job->model, job->obs, chunk_from(job, c), chunk_to(job, c), row, work, bp, NULL, 0) != 0)
+        {
+            goto TRANSFER_DONE;
+        }
+    }
+    rc = 0;
+
+    TRANSFER_DONE:
+        free(work);
+        free(bp);
+        return rc;
+}
+
+// phase 3: backpointers of the chunk and the entry state of every exit state's survivor
+static int rerun_task(void *ctx, size_t c)
+{
+    parallel_job *job = ctx;
+    int n = job->model->n_states;
+    size_t from = chunk_from(job, c);
+    size_t to = chunk_to(job, c);
+    trace_store *trace = &job->traces[c];
+    int32_t *entry = job->entry + c * n;
+    double *col = malloc((n + viterbi_work_size(n)) * sizeof(double));
+    int32_t *bp = malloc(n * sizeof(int32_t));
+    int rc = -1;
+
+    if (!col || !bp)
+    {
+        errno = ENOMEM;
+        goto RERUN_DONE;
+    }
+    if (trace_init(trace, job->trace_kind, n, to - from + 1) != 0)
+    {
+        goto RERUN_DONE;
+    }
+
+    memcpy(col, job->boundary + c * n, n * sizeof(double));
+    if (viterbi_advance(job->model, job->obs, from, to, col, col + n, bp, trace, from) != 0)
+    {
+        goto RERUN_DONE;
+    }
+    if (c == job->n_chunks - 1)
+    {
+        memcpy(job->last_col, col, n * sizeof(double));
+    }
+
+    for (int j = 0; j < n; j++)
+    {
+        entry[j] = j;
+    }
+    for (size_t t = to; t > from; t--)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            entry[j] = trace_get(trace, t - from, entry[j]);
+        }
+    }
+    rc = 0;
+
+    RERUN_DONE:
+        free(col);
+        free(bp);
+        return rc;
+}
+
+// phase 5
+static int traceback_task(void *ctx, size_t c)
+{
+    parallel_job *job = ctx;
+    size_t from = chunk_from(job, c);
+    size_t to = chunk_to(job, c);
+    int state = job->exit_state[c];
+
+    for (size_t t = to; t > from; t--)
+    {
+        job->path[t] = state;
+        state = trace_get(&job->traces[c], t - from, state);
+    }
+    if (c == 0)
+    {
+        job->path[0] = state;
+    }
+    return 0;
+}
+
+
+int viterbi_parallel(const hmm_model *model, const hmm_obs *obs, hmm_state *path, double *log_prob,
+                     const hmm_viterbi_opts *opts)
+{
+    int n = model->n_states;
+    size_t length = obs->length;
+    int threads = parallel_threads(opts->threads);
+    int rc = -1;
+
+    parallel_job job;
+    memset(&job, 0, sizeof(job));
+    job.model = model;
+    job.obs = obs;
+    job.trace_kind = opts->trace;
+    job.chunk = opts->chunk ? opts->chunk : PARALLEL_CHUNK;
+    job.n_chunks = length > 1 ? (length - 2) / job.chunk + 1 : 0;
+    job.path = path;
+
+    if (job.n_chunks == 0)
+    {
+        hmm_viterbi_opts single = *opts;
+        single.mode = HMM_VITERBI_FULL;
+        return hmm_viterbi_obs(model, obs, path, log_prob, &single);
+    }
+
+    size_t nn = (size_t) n * n;
+    if (job.n_chunks > SIZE_MAX / sizeof(double) / (nn + n + 1))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    double start = timing_mark(opts);
+    HMM_STATS_START(forward);
+    job.transfer = malloc(job.n_chunks * nn * sizeof(double));
+    job.boundary = malloc((job.n_chunks + 1) * n * sizeof(double));
+    job.last_col = malloc(n * sizeof(double));
+    job.traces = calloc(job.n_chunks, sizeof(trace_store));
+    job.entry = malloc(job.n_chunks * n * sizeof(int32_t));
+    job.exit_state = malloc(job.n_chunks * sizeof(int32_t));
+
+    if (!job.transfer || !job.boundary || !job.last_col || !job.traces || !job.entry || !job.exit_state)
+    {
+        errno = ENOMEM;
+        goto PARALLEL_DONE;
+    }
+
+    if (parallel_for(threads, job.n_chunks, transfer_task, &job) != 0)
+    {
+        goto PARALLEL_DONE;
+    }
+
+    // phase 2, with the tie rule of viterbi_step
+    if (viterbi_first_column(model, obs, job.boundary) != 0)
+    {
+        goto PARALLEL_DONE;
+    }
+    for (size_t c = 0; c < job.n_chunks; c++)
+    {
+        const double *in = job.boundary + c * n;
+        const double *m = job.transfer + c * nn;
+        double *out = job.boundary + (c + 1) * n;
+
+        for (int j = 0; j < n; j++)
+        {
+            out[j] = in[0] + m[j];
+        }
+        for (int i = 1; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                double cand = in[i] + m[(size_t) i * n + j];
+                if (cand >= out[j])
+                {
+                    out[j] = cand;
+                }
+            }
+        }
+    }
+
+    if (parallel_for(threads, job.n_chunks, rerun_task, &job) != 0)
+    {
+        goto PARALLEL_DONE;
+    }
+
+    // phase 4
+    double forward_done = timing_mark(opts);
+    HMM_STATS_STOP(HMM_PHASE_FORWARD, forward, 0, length);
+    HMM_STATS_START(traceback);
+    int state = hmm_argmax(job.last_col, n);
+    if (log_prob)
+    {
+        *log_prob = job.last_col[state];
+    }
+    for (size_t c = job.n_chunks; c-- > 0; )
+    {
+        job.exit_state[c] = state;
+        state = job.entry[c * n + state];
+    }
+
+    rc = parallel_for(threads, job.n_chunks, traceback_task, &job);
+    timing_record(opts, start, forward_done, timing_mark(opts));
+    HMM_STATS_STOP(HMM_PHASE_TRACEBACK, traceback, 0, length);
+
+    PARALLEL_DONE:
+        if (job.traces)
+        {
+            for (size_t c = 0; c < job.n_chunks; c++)
+            {
+                trace_free(&job.traces[c]);
+            }
+        }
+        free(job.transfer);
+        free(job.boundary);
+        free(job.last_col);
+        free(job.traces);
+        free(job.entry);
+        free(job.exit_state);
+        return rc;
+}
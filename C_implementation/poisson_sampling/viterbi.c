@@ -9,10 +9,16 @@
  * Sequence file is assumed to be one entry per line, and state file is assumed to give corresponding state on same line separated
  * by whitespace (see .txt files for example).
  * 
- * Usage: ./viterbi my_sequence_file.txt my_state_file.txt
+ * -m replaces the built-in model with another built-in model or a model file (see ../hmm/model_file.c), including its
+ * start distribution, so refitted parameters need no rebuild.
+ *
+ * Usage: ./viterbi [-m model] my_sequence_file.txt my_state_file.txt
  * my_sequence_file.txt = sequence file (required)
  * my_state_file.txt = state file (optional)
  *
+ * Decoding is done by the generic engine in ../hmm. Build by compiling viterbi.c together with every .c file in ../hmm,
+ * e.g. cc -O3 -std=gnu99 -o viterbi viterbi.c ../hmm/[a-z]*.c -lm -pthread
+ *
 **/
 
 
@@ -20,51 +26,53 @@
 #include <stdlib.h>
 #include <math.h>
 #include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
 
-double max (double a, double b);
-double poisson (double k, double lambda);
-int argmax (double row0, double row1);
+#include "../hmm/hmm.h"
 
 int main (int argc, char *argv[]) 
 {
+    const char *model_name = "poisson";
+    int opt;
+    while ((opt = getopt(argc, argv, "m:")) != -1)
+    {
+        if (opt != 'm')
+        {
+            printf("Usage: ./viterbi [-m model] my_sequence_file.txt my_state_file.txt .  Include at least sequence file.\n");
+            return 1;
+        }
+        model_name = optarg;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     // check for correct number of command line args
     if (argc != 2 && argc != 3)
     {
-        printf("Usage: ./viterbi my_sequence_file.txt my_state_file.txt .  Include at least sequence file.\n");
+        printf("Usage: ./viterbi [-m model] my_sequence_file.txt my_state_file.txt .  Include at least sequence file.\n");
         return 1;
     }
-    
-    // open sequence file and store in array. Dynamically allocate memory and automatically detect sequence n value
-    FILE *seqf = fopen(argv[1], "r");
-    if (!seqf)
+
+    // state transition matrix and emission lambdas live in ../hmm/example_models.c, unless -m gave others
+    hmm_modelfile loaded;
+    if (hmm_modelfile_load(model_name, &loaded) != 0 || !loaded.info.labels)
     {
-        printf("Invalid sequence file.\n");
+        printf("Invalid model %s.\n", model_name);
         return 1;
     }
+    hmm_model *model = loaded.model;
     
-    int num;
-    int memsize = 100;
-    int n = 0;
-    int *seq = calloc(memsize, sizeof(int));
-    
-    while(fscanf(seqf, "%i", &num) == 1)
+    // read sequence file into an array, automatically detecting sequence n value
+    size_t length;
+    int *seq;
+    if (hmm_read_sequence(argv[1], loaded.info.symbol_base, &seq, &length) != 0 || length == 0 || length > INT_MAX)
     {
-        seq[n] = num;
-        n++;
-
-        if (n == memsize)
-        {
-            memsize += 100;
-            seq = realloc(seq, memsize * sizeof(int));
-        }
-        
-        if(!seq)
-        {
-            printf("Not enough memory.");
-            return 1;
-        }
+        printf("Invalid sequence file.\n");
+        return 1;
     }
-    fclose(seqf);
+    int n = length;
+    int num;
     
     // if passed as an argument, open the state solution file and print. Assumes n is same as sequence n above
     if(argv[2])
@@ -96,120 +104,42 @@ int main (int argc, char *argv[])
         printf("\n\n");
     }
 
-    // state transition matrix in log space
-    double a[2][2] = {
-        { log(0.9551),  log(0.0449) },
-        { log(0.0880),  log(0.9120) }
-    };
-    
-    // emission lambdas for sampling from poisson distribution
-    double e[2] = {1.8234, 5.7812};
-    
-    // allocate memory
-    int *path = calloc(n, sizeof(double));
-    double **vprob = calloc(n, sizeof *vprob);
-    double **ptr = calloc(n, sizeof *ptr);
-    double **pi = calloc(n, sizeof *pi);
-    
-    for (int i = 0; i < 2; i++)
+    hmm_state *path = calloc(n, sizeof(*path));
+    if (!path)
     {
-        vprob[i] = calloc(n, sizeof *vprob[i]);
-        ptr[i] = calloc(n, sizeof *ptr[i]);
-        pi[i] = calloc(n, sizeof *pi[i]);
+        printf("Not enough memory.");
+        return 1;
     }
-
-    // initialize vprob array; assumed starting state is state 1
-    vprob[0][0] = 1;
-    vprob[1][0] = 0;
-    double row0;
-    double row1;
     
-    // viterbi algorithm in log space to avoid underflow. Emission probabilities sampled from poisson distribution
-    for (int i = 1; i < n; i++)
+    // precompute the poisson log emission of every count in the sequence, so decoding only does table lookups
+    hmm_obs counts = { HMM_OBS_INT, length, seq };
+    if (hmm_model_cache_obs(model, &counts) != 0)
     {
-        for (int j = 0; j < 2; j++)
-        {
-            row0 = (vprob[0][i - 1] + a[0][j]);
-            row1 = (vprob[1][i - 1] + a[1][j]);
-            
-            vprob[j][i] = log( poisson(seq[i - 1], e[j]) ) + max( row0, row1 );
-            ptr[j][i] = argmax( row0, row1 );
-            pi[j][i] = max( row0 , row1 );
-        }
+        printf("Not enough memory.");
+        return 1;
     }
-    free(seq);
     
-    // traceback to find most likely path
-    path[n - 1] = argmax( pi[0][n - 1], pi[1][n - 1] );
-    for (int i = n - 2; i > 0; i--)
+    // viterbi algorithm in log space to avoid underflow. Emission probabilities sampled from poisson distribution
+    if (hmm_viterbi_obs(model, &counts, path, NULL, NULL) != 0)
     {
-        path[i] = ptr[path[i + 1]][i + 1];
+        printf("Invalid sequence file.\n");
+        return 1;
     }
+    free(seq);
     
-    // print most likely path, incrementing by 1 for states 1 and 2
-    for (int i = 0; i < n; i++)
+    // print most likely path, as the labels 1 and 2 for the built-in model
+    HMM_STATS_START(mark);
+    hmm_path_writer *out = hmm_path_writer_new(stdout, HMM_PATH_LABELS, loaded.info.labels, model->n_states, 0);
+    if (!out || hmm_path_write(out, path, n) != 0 || hmm_path_end(out) != 0)
     {
-        path[i]++;
-        printf("%i", path[i]);
-    }
-    printf("\n");
-
-    // free remaining memory
-    for (int i = 0; i < 2; i++)
-    {
-        free(vprob[i]);
-        free(ptr[i]);
-        free(pi[i]);
+        printf("Could not write output.\n");
+        return 1;
     }
-    free(vprob);
-    free(ptr);
-    free(pi);
+    hmm_path_writer_free(out);
+    hmm_modelfile_close(&loaded);
+    HMM_STATS_STOP(HMM_PHASE_OUTPUT, mark, n + 1, n);
     free(path);
     
+    HMM_STATS_REPORT(getenv("HMM_STATS_FILE"));
     return 0;
 }
-
-double max (double a, double b)
-{
-    if (a > b)
-    {
-        return a;
-    }
-    else if (a < b)
-    {
-    return b;
-    }
-    // if equal, returns arbitrary argument for specific use in this algorithm
-    return b;
-}
-
-int argmax (double row0, double row1)
-{
-    if (row0 > row1)
-    {
-        return 0;
-    }
-    else if (row0 < row1)
-    {
-        return 1;
-    }
-    return row1;
-}
-
-double poisson (double k, double lambda)
-{
-    int factk;
-    if (k == 0)
-    {
-        factk = 1;
-    }
-    else
-    {
-        factk = k;
-        for (int i = k - 1; i > 0; i--)
-        {
-            factk *= i;
-        }
-    }
-    return ( (pow(lambda, k) * exp(-lambda)) / factk );
-}